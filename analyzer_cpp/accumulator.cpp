@@ -0,0 +1,99 @@
+#include "accumulator.hpp"
+#include "fen_parser.hpp"
+#include "kernels.hpp"
+#include <stdexcept>
+
+static const char* PIECE_LETTERS = "PNBRQKpnbrqk";
+
+template <typename Real>
+static void add_row(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, int feature, Real sign) {
+    const BasicLayer<Real>& first = network.layers.front();
+    axpy(first.outputs, sign, &first.weights[feature * first.outputs], acc.values.data());
+}
+
+template <typename Real>
+BasicAccumulator<Real> accumulator_from_fen(const BasicNetwork<Real>& network, const std::string& fen) {
+    const BasicLayer<Real>& first = network.layers.front();
+    if (first.inputs != FEN_INPUT_SIZE) {
+        throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+    }
+    
+    BasicAccumulator<Real> acc;
+    acc.values.assign(first.outputs, Real(0));
+    acc.white_to_move = false;
+    for (char& square : acc.board) {
+        square = '\0';
+    }
+    
+    for (int feature : fen_to_features(fen)) {
+        if (feature == FEN_INPUT_SIZE - 1) {
+            acc.white_to_move = true;
+        } else {
+            acc.board[feature / 12] = PIECE_LETTERS[feature % 12];
+        }
+        add_row(network, acc, feature, Real(1));
+    }
+    
+    return acc;
+}
+
+template <typename Real>
+void accumulator_add(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, char piece, int square) {
+    int feature = piece_feature(piece, square);
+    if (acc.board[square] != '\0') {
+        throw std::runtime_error("Square " + std::to_string(square) + " is already occupied");
+    }
+    acc.board[square] = piece;
+    add_row(network, acc, feature, Real(1));
+}
+
+template <typename Real>
+void accumulator_remove(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, int square) {
+    if (square < 0 || square >= 64 || acc.board[square] == '\0') {
+        throw std::runtime_error("No piece to remove on square " + std::to_string(square));
+    }
+    add_row(network, acc, piece_feature(acc.board[square], square), Real(-1));
+    acc.board[square] = '\0';
+}
+
+template <typename Real>
+void accumulator_move(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, int from, int to) {
+    if (from < 0 || from >= 64 || acc.board[from] == '\0') {
+        throw std::runtime_error("No piece to move on square " + std::to_string(from));
+    }
+    if (from == to) return;
+    
+    char piece = acc.board[from];
+    if (to >= 0 && to < 64 && acc.board[to] != '\0') {
+        accumulator_remove(network, acc, to);
+    }
+    
+    int to_feature = piece_feature(piece, to);
+    add_row(network, acc, piece_feature(piece, from), Real(-1));
+    add_row(network, acc, to_feature, Real(1));
+    acc.board[from] = '\0';
+    acc.board[to] = piece;
+}
+
+template <typename Real>
+void accumulator_set_turn(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, bool white_to_move) {
+    if (acc.white_to_move == white_to_move) return;
+    add_row(network, acc, FEN_INPUT_SIZE - 1, Real(white_to_move ? 1 : -1));
+    acc.white_to_move = white_to_move;
+}
+
+template <typename Real>
+std::vector<Real> accumulator_evaluate(const BasicNetwork<Real>& network, const BasicAccumulator<Real>& acc) {
+    return forward_from_first_layer(network, acc.values);
+}
+
+#define INSTANTIATE_ACCUMULATOR(Real) \
+    template BasicAccumulator<Real> accumulator_from_fen(const BasicNetwork<Real>&, const std::string&); \
+    template void accumulator_add(const BasicNetwork<Real>&, BasicAccumulator<Real>&, char, int); \
+    template void accumulator_remove(const BasicNetwork<Real>&, BasicAccumulator<Real>&, int); \
+    template void accumulator_move(const BasicNetwork<Real>&, BasicAccumulator<Real>&, int, int); \
+    template void accumulator_set_turn(const BasicNetwork<Real>&, BasicAccumulator<Real>&, bool); \
+    template std::vector<Real> accumulator_evaluate(const BasicNetwork<Real>&, const BasicAccumulator<Real>&);
+
+INSTANTIATE_ACCUMULATOR(double)
+INSTANTIATE_ACCUMULATOR(float)
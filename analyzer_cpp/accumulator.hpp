@@ -0,0 +1,33 @@
+#pragma once
+#include "network.hpp"
+#include <string>
+#include <vector>
+
+// First-layer state of a position that is updated move by move: adding or removing
+// a piece adds or subtracts one weight row instead of redoing the first layer.
+// Squares are numbered like the FEN board: 0 = a8 ... 63 = h1. Runs in the
+// precision of the network.
+template <typename Real>
+struct BasicAccumulator {
+    // W^T * x of the first layer, bias not included
+    std::vector<Real> values;
+    // FEN piece letter on each square, '\0' when empty
+    char board[64];
+    bool white_to_move;
+};
+
+using Accumulator = BasicAccumulator<double>;
+
+template <typename Real>
+BasicAccumulator<Real> accumulator_from_fen(const BasicNetwork<Real>& network, const std::string& fen);
+template <typename Real>
+void accumulator_add(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, char piece, int square);
+template <typename Real>
+void accumulator_remove(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, int square);
+// Moves the piece on `from` to `to`, removing whatever stood on `to`
+template <typename Real>
+void accumulator_move(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, int from, int to);
+template <typename Real>
+void accumulator_set_turn(const BasicNetwork<Real>& network, BasicAccumulator<Real>& acc, bool white_to_move);
+template <typename Real>
+std::vector<Real> accumulator_evaluate(const BasicNetwork<Real>& network, const BasicAccumulator<Real>& acc);
@@ -0,0 +1,201 @@
+#include "checkpoint.hpp"
+#include "model_io.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+template <typename Real>
+void save_checkpoint(const BasicNetwork<Real>& network, const BasicNetwork<Real>* best, const TrainingState& state, const std::string& path) {
+    std::vector<unsigned char> image = network_to_binary(network);
+    std::vector<unsigned char> best_image;
+    if (best) {
+        best_image = network_to_binary(*best);
+    }
+    
+    NnkHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, NNK_MAGIC, sizeof(NNK_MAGIC));
+    header.version = NNK_VERSION;
+    header.epoch = state.epoch;
+    header.batch_size = state.batch_size;
+    header.position = state.position;
+    header.dataset_size = state.dataset_size;
+    header.epoch_loss = state.epoch_loss;
+    header.best_loss = state.best_loss;
+    header.no_improvement_count = state.no_improvement_count;
+    header.best_validation_loss = state.best_validation_loss;
+    header.best_epoch = state.best_epoch;
+    header.rng_size = state.rng_state.size();
+    header.run_rng_size = state.run_rng_state.size();
+    uint64_t rng_end = sizeof(NnkHeader) + header.rng_size + header.run_rng_size;
+    header.network_offset = (rng_end + NNB_ALIGNMENT - 1) / NNB_ALIGNMENT * NNB_ALIGNMENT;
+    header.network_size = image.size();
+    if (best) {
+        header.best_offset = (header.network_offset + image.size() + NNB_ALIGNMENT - 1) / NNB_ALIGNMENT * NNB_ALIGNMENT;
+        header.best_size = best_image.size();
+    }
+    
+    std::vector<unsigned char> bytes(best ? header.best_offset + best_image.size() : header.network_offset + image.size(), 0);
+    std::memcpy(bytes.data() + sizeof(NnkHeader), state.rng_state.data(), header.rng_size);
+    std::memcpy(bytes.data() + sizeof(NnkHeader) + header.rng_size, state.run_rng_state.data(), header.run_rng_size);
+    std::memcpy(bytes.data() + header.network_offset, image.data(), image.size());
+    if (best) {
+        std::memcpy(bytes.data() + header.best_offset, best_image.data(), best_image.size());
+    }
+    header.checksum = fnv1a(bytes.data() + sizeof(NnkHeader), header.rng_size + header.run_rng_size);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    
+    if (!write_file_atomic(path, bytes.data(), bytes.size())) {
+        throw std::runtime_error("Cannot write checkpoint: " + path);
+    }
+}
+
+template <typename Real>
+BasicNetwork<Real> load_checkpoint(const std::string& path, TrainingState& state, BasicNetwork<Real>& best) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open checkpoint: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(NnkHeader)) {
+        close(fd);
+        throw std::runtime_error("Invalid checkpoint: " + path);
+    }
+    size_t size = st.st_size;
+    
+    // Writable like a mapped .nnb: the network trains in copy-on-write pages
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Cannot map checkpoint: " + path);
+    }
+    std::shared_ptr<void> mapping(addr, [size](void* p) { munmap(p, size); });
+    unsigned char* base = static_cast<unsigned char*>(addr);
+    
+    NnkHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, NNK_MAGIC, sizeof(NNK_MAGIC)) != 0 || header.version != NNK_VERSION) {
+        throw std::runtime_error("Not a checkpoint: " + path);
+    }
+    if (header.rng_size > size || header.run_rng_size > size || header.network_offset < sizeof(NnkHeader) + header.rng_size + header.run_rng_size
+        || header.network_offset % NNB_ALIGNMENT != 0 || header.network_offset > size || header.network_size > size - header.network_offset) {
+        throw std::runtime_error("Corrupted checkpoint: " + path);
+    }
+    uint64_t network_end = header.network_offset + header.network_size;
+    bool has_best = header.best_offset != 0;
+    // The last image ends the file
+    bool valid = network_end == size;
+    if (has_best) {
+        valid = header.best_offset >= network_end && header.best_offset % NNB_ALIGNMENT == 0 && header.best_offset <= size && header.best_size == size - header.best_offset;
+    }
+    if (!valid) {
+        throw std::runtime_error("Corrupted checkpoint: " + path);
+    }
+    if (fnv1a(base + sizeof(NnkHeader), header.rng_size + header.run_rng_size) != header.checksum) {
+        throw std::runtime_error("Checksum mismatch in checkpoint: " + path);
+    }
+    
+    state.epoch = header.epoch;
+    state.batch_size = header.batch_size;
+    state.position = header.position;
+    state.dataset_size = header.dataset_size;
+    state.epoch_loss = header.epoch_loss;
+    state.best_loss = header.best_loss;
+    state.no_improvement_count = static_cast<int>(header.no_improvement_count);
+    state.best_validation_loss = header.best_validation_loss;
+    state.best_epoch = header.best_epoch;
+    const char* rng = reinterpret_cast<const char*>(base + sizeof(NnkHeader));
+    state.rng_state.assign(rng, header.rng_size);
+    state.run_rng_state.assign(rng + header.rng_size, header.run_rng_size);
+    
+    BasicNetwork<Real> network = network_from_binary<Real>(base + header.network_offset, header.network_size, path);
+    network.mapping = mapping;
+    if (has_best) {
+        best = network_from_binary<Real>(base + header.best_offset, header.best_size, path);
+        best.mapping = mapping;
+    }
+    return network;
+}
+
+template <typename Real>
+CheckpointWriter<Real>::CheckpointWriter(const std::string& path) : path(path) {
+    writer = std::thread(&CheckpointWriter::write_loop, this);
+}
+
+template <typename Real>
+CheckpointWriter<Real>::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+}
+
+template <typename Real>
+void CheckpointWriter<Real>::check_error() {
+    if (error) {
+        std::exception_ptr failure = error;
+        error = nullptr;
+        std::rethrow_exception(failure);
+    }
+}
+
+template <typename Real>
+void CheckpointWriter<Real>::write(const BasicNetwork<Real>& network, const BasicNetwork<Real>* best, const TrainingState& state) {
+    // The copies are the only work done on the training thread
+    std::unique_ptr<Job> job(new Job{network, nullptr, state});
+    if (best) {
+        job->best = std::make_unique<BasicNetwork<Real>>(*best);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        check_error();
+        pending = std::move(job);
+    }
+    wake.notify_all();
+}
+
+template <typename Real>
+void CheckpointWriter<Real>::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return !pending && !busy; });
+    check_error();
+}
+
+template <typename Real>
+void CheckpointWriter<Real>::write_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // Pending checkpoints are still written when stopping
+        wake.wait(lock, [this] { return stopping || pending; });
+        if (!pending) return;
+        std::unique_ptr<Job> job = std::move(pending);
+        busy = true;
+        lock.unlock();
+        
+        std::exception_ptr failure;
+        try {
+            save_checkpoint(job->network, job->best.get(), job->state, path);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        job.reset();
+        
+        lock.lock();
+        busy = false;
+        if (failure) error = failure;
+        idle.notify_all();
+    }
+}
+
+template void save_checkpoint<double>(const Network& network, const Network* best, const TrainingState& state, const std::string& path);
+template void save_checkpoint<float>(const BasicNetwork<float>& network, const BasicNetwork<float>* best, const TrainingState& state, const std::string& path);
+template Network load_checkpoint<double>(const std::string& path, TrainingState& state, Network& best);
+template BasicNetwork<float> load_checkpoint<float>(const std::string& path, TrainingState& state, BasicNetwork<float>& best);
+template class CheckpointWriter<double>;
+template class CheckpointWriter<float>;
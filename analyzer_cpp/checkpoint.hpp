@@ -0,0 +1,113 @@
+#pragma once
+#include "model.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Training checkpoints, little-endian on disk:
+//   NnkHeader, then rng_size and run_rng_size bytes of generator state as
+//   written by operator<< of std::mt19937, then at network_offset (64-byte
+//   aligned) a complete .nnb image of the network and its optimizer state,
+//   then at best_offset (aligned too, 0 when absent) the image of the network
+//   with the best validation loss so far.
+//   The checksum is FNV-1a 64 of the generator states; the images have their own.
+
+const char NNK_MAGIC[4] = {'N', 'N', 'K', '1'};
+const uint32_t NNK_VERSION = 2;
+
+struct NnkHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t epoch;
+    uint32_t batch_size;
+    uint64_t position;
+    uint64_t dataset_size;
+    double epoch_loss;
+    double best_loss;
+    int64_t no_improvement_count;
+    double best_validation_loss;
+    uint32_t best_epoch;
+    uint32_t reserved;
+    uint64_t rng_size;
+    uint64_t run_rng_size;
+    uint64_t network_offset;
+    uint64_t network_size;
+    uint64_t best_offset;
+    uint64_t best_size;
+    uint64_t checksum;
+};
+
+// Where train_model is in its run, enough to continue it exactly
+struct TrainingState {
+    // Epoch in progress and the samples of it already trained
+    uint32_t epoch = 0;
+    uint64_t position = 0;
+    // Loss summed over those samples
+    double epoch_loss = 0.0;
+    // Early stopping tracker
+    double best_loss = 1e9;
+    int no_improvement_count = 0;
+    // With a validation set: its best loss and the epoch (from 1) that reached it
+    double best_validation_loss = 1e9;
+    uint32_t best_epoch = 0;
+    // Shuffling generator as it was at the start of the epoch and of the run.
+    // The sample order is shuffled again every epoch, so it is rebuilt by
+    // replaying the shuffles of the earlier epochs from the run's state.
+    std::string rng_state;
+    std::string run_rng_state;
+    // Checked on resume: the position means nothing for other data
+    uint64_t dataset_size = 0;
+    uint32_t batch_size = 0;
+};
+
+// best may be null
+template <typename Real>
+void save_checkpoint(const BasicNetwork<Real>& network, const BasicNetwork<Real>* best, const TrainingState& state, const std::string& path);
+// Reads every part of a checkpoint, checking the checksums. best is left
+// untouched when the checkpoint holds no best network.
+template <typename Real>
+BasicNetwork<Real> load_checkpoint(const std::string& path, TrainingState& state, BasicNetwork<Real>& best);
+
+// Saves checkpoints on a background thread so that training is not held up
+// by serialization and disk writes. write() only copies the network; when
+// the previous checkpoint is still being saved, the newer one replaces any
+// checkpoint waiting behind it.
+template <typename Real>
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const std::string& path);
+    // Finishes the checkpoint in progress, ignoring its errors
+    ~CheckpointWriter();
+    
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+    
+    // Rethrows the error of an earlier checkpoint, if any
+    void write(const BasicNetwork<Real>& network, const BasicNetwork<Real>* best, const TrainingState& state);
+    // Waits until every checkpoint is on disk
+    void flush();
+
+private:
+    struct Job {
+        BasicNetwork<Real> network;
+        std::unique_ptr<BasicNetwork<Real>> best;
+        TrainingState state;
+    };
+    
+    void write_loop();
+    void check_error();
+    
+    std::string path;
+    std::unique_ptr<Job> pending;
+    bool busy = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::thread writer;
+};
@@ -0,0 +1,259 @@
+#include "dataset.hpp"
+#include "fen_parser.hpp"
+#include "model_io.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string dataset_cache_path(const std::string& path) {
+    return path + ".nnd";
+}
+
+static struct stat source_stat(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("Cannot open data file: " + path);
+    }
+    return st;
+}
+
+static int64_t mtime_ns(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static const size_t COPY_CHUNK = 1 << 20;
+// Bytes of text handed to one parser thread at a time
+static const size_t COMPILE_BLOCK_BYTES = 1 << 20;
+
+static void write_all(int fd, const void* data, size_t size, const std::string& path) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) {
+            throw std::runtime_error("Cannot write dataset cache: " + path);
+        }
+        p += n;
+        size -= n;
+    }
+}
+
+void read_cache(int fd, void* data, size_t size, uint64_t offset) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n <= 0) {
+            throw std::runtime_error("Cannot read dataset cache");
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+// Appends a temporary section file to the cache, hashing it on the way
+static uint64_t append_section(int fd, FILE* section, uint64_t hash, const std::string& path) {
+    std::vector<unsigned char> buffer(COPY_CHUNK);
+    std::rewind(section);
+    size_t n;
+    while ((n = std::fread(buffer.data(), 1, buffer.size(), section)) > 0) {
+        hash = fnv1a(buffer.data(), n, hash);
+        write_all(fd, buffer.data(), n, path);
+    }
+    if (std::ferror(section)) {
+        throw std::runtime_error("Cannot write dataset cache: " + path);
+    }
+    return hash;
+}
+
+// Encodes one block of "FEN label" lines; runs on the pipeline's parser threads
+static void parse_block(const std::string& text, DatasetBlock& block) {
+    for_each_line(text, [&](std::string_view line) {
+        // FEN (6 fields) + label
+        std::string_view parts[7];
+        if (split_fields(line, parts, 7) < 7) return;
+        
+        int index = find_label(line.substr(parts[6].data() - line.data()));
+        uint16_t active[FEN_MAX_FEATURES];
+        int count;
+        if (index < 0 || !encode_fen_features(line, active, count)) return;
+        
+        block.add(active, active + count, static_cast<uint8_t>(index));
+    });
+}
+
+void compile_dataset(const std::string& path, int fd) {
+    struct stat st = source_stat(path);
+    
+    // Sections are spooled to anonymous files, then concatenated behind the header
+    std::unique_ptr<FILE, int (*)(FILE*)> offsets(std::tmpfile(), std::fclose);
+    std::unique_ptr<FILE, int (*)(FILE*)> features(std::tmpfile(), std::fclose);
+    std::unique_ptr<FILE, int (*)(FILE*)> labels(std::tmpfile(), std::fclose);
+    if (!offsets || !features || !labels) {
+        throw std::runtime_error("Cannot create temporary files to compile " + path);
+    }
+    
+    uint64_t num_samples = 0;
+    uint64_t num_features = 0;
+    std::fwrite(&num_features, sizeof(num_features), 1, offsets.get());
+    
+    // Blocks are encoded in parallel but come back in file order
+    ParsePipeline<DatasetBlock> pipeline(path, COMPILE_BLOCK_BYTES, resolve_thread_count(0), parse_block);
+    DatasetBlock block;
+    while (pipeline.next(block)) {
+        for (size_t i = 1; i < block.offsets.size(); i++) {
+            block.offsets[i] += num_features;
+        }
+        std::fwrite(block.offsets.data() + 1, sizeof(uint64_t), block.size(), offsets.get());
+        std::fwrite(block.features.data(), sizeof(uint16_t), block.features.size(), features.get());
+        std::fwrite(block.labels.data(), 1, block.labels.size(), labels.get());
+        num_samples += block.size();
+        num_features += block.features.size();
+    }
+    if (std::fflush(offsets.get()) != 0 || std::fflush(features.get()) != 0 || std::fflush(labels.get()) != 0) {
+        throw std::runtime_error("Cannot write dataset cache: " + path);
+    }
+    
+    NndHeader header;
+    std::memset(&header, 0, sizeof(header));
+    write_all(fd, &header, sizeof(header), path);
+    uint64_t hash = append_section(fd, offsets.get(), FNV1A_BASIS, path);
+    hash = append_section(fd, features.get(), hash, path);
+    hash = append_section(fd, labels.get(), hash, path);
+    
+    std::memcpy(header.magic, NND_MAGIC, sizeof(NND_MAGIC));
+    header.version = NND_VERSION;
+    header.source_size = st.st_size;
+    header.source_mtime = mtime_ns(st);
+    header.num_samples = num_samples;
+    header.num_features = num_features;
+    header.checksum = hash;
+    if (pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        throw std::runtime_error("Cannot write dataset cache: " + path);
+    }
+}
+
+static uint64_t cache_size(const NndHeader& header) {
+    return sizeof(NndHeader) + (header.num_samples + 1) * sizeof(uint64_t) + header.num_features * sizeof(uint16_t) + header.num_samples;
+}
+
+// Whether fd holds a cache built from this version of the text file. Hashing
+// every byte would cost about as much as mapping it, so the checksum is only
+// compared when verify is set.
+static bool check_cache(int fd, const struct stat& source, NndHeader& header, bool verify) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(header)) return false;
+    if (pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) return false;
+    if (std::memcmp(header.magic, NND_MAGIC, sizeof(NND_MAGIC)) != 0 || header.version != NND_VERSION) return false;
+    
+    // Stale when the text file was edited after the cache was built
+    if (header.source_size != static_cast<uint64_t>(source.st_size) || header.source_mtime != mtime_ns(source)) return false;
+    
+    uint64_t size = st.st_size;
+    if (header.num_samples >= size / sizeof(uint64_t) || header.num_features >= size / sizeof(uint16_t)) return false;
+    if (cache_size(header) != size) return false;
+    if (!verify) return true;
+    
+    std::vector<unsigned char> buffer(COPY_CHUNK);
+    uint64_t hash = FNV1A_BASIS;
+    for (uint64_t offset = sizeof(header); offset < size; offset += buffer.size()) {
+        size_t n = std::min<uint64_t>(buffer.size(), size - offset);
+        if (pread(fd, buffer.data(), n, offset) != static_cast<ssize_t>(n)) return false;
+        hash = fnv1a(buffer.data(), n, hash);
+    }
+    return hash == header.checksum;
+}
+
+int open_dataset_cache(const std::string& path, NndHeader& header, bool verify) {
+    struct stat source = source_stat(path);
+    std::string cache_path = dataset_cache_path(path);
+    
+    int fd = open(cache_path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        if (check_cache(fd, source, header, verify)) return fd;
+        close(fd);
+    }
+    
+    // Replace the file rather than truncating it: another run may have it mapped.
+    // The temporary name is per process, as another run may be compiling too.
+    std::string tmp_path = cache_path + "." + std::to_string(getpid()) + ".tmp";
+    fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        try {
+            compile_dataset(path, fd);
+            if (std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+                throw std::runtime_error("Cannot write dataset cache: " + cache_path);
+            }
+            read_cache(fd, &header, sizeof(header), 0);
+            std::cout << "Compiled " << path << " to " << cache_path << std::endl;
+            return fd;
+        } catch (const std::exception&) {
+            close(fd);
+            std::remove(tmp_path.c_str());
+        }
+    }
+    
+    // Read-only data directory: compile to an anonymous temporary file instead
+    std::cerr << "warning: cannot write dataset cache " << cache_path << std::endl;
+    FILE* tmp = std::tmpfile();
+    fd = tmp ? dup(fileno(tmp)) : -1;
+    if (tmp) std::fclose(tmp);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create temporary files to compile " + path);
+    }
+    try {
+        compile_dataset(path, fd);
+        read_cache(fd, &header, sizeof(header), 0);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    return fd;
+}
+
+Dataset DatasetBlock::view() const {
+    Dataset dataset;
+    dataset.num_samples = labels.size();
+    dataset.offsets = offsets.data();
+    dataset.features = features.data();
+    dataset.labels = labels.data();
+    return dataset;
+}
+
+Dataset load_dataset(const std::string& path, bool verify) {
+    NndHeader header;
+    int fd = open_dataset_cache(path, header, verify);
+    size_t size = cache_size(header);
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Cannot map dataset cache of " + path);
+    }
+    
+    Dataset dataset;
+    dataset.mapping = std::shared_ptr<void>(addr, [size](void* p) { munmap(p, size); });
+    const unsigned char* data = static_cast<const unsigned char*>(addr) + sizeof(NndHeader);
+    dataset.num_samples = header.num_samples;
+    dataset.offsets = reinterpret_cast<const uint64_t*>(data);
+    dataset.features = reinterpret_cast<const uint16_t*>(data + (header.num_samples + 1) * sizeof(uint64_t));
+    dataset.labels = reinterpret_cast<const uint8_t*>(dataset.features + header.num_features);
+    
+    if (dataset.offsets[0] != 0 || dataset.offsets[dataset.num_samples] != header.num_features) {
+        throw std::runtime_error("Corrupted dataset cache of " + path);
+    }
+    for (size_t i = 0; i < dataset.num_samples; i++) {
+        if (dataset.offsets[i] > dataset.offsets[i + 1]) {
+            throw std::runtime_error("Corrupted dataset cache of " + path);
+        }
+    }
+    return dataset;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Binary dataset caches (.nnd), written next to the text file they are
+// compiled from (data.txt -> data.txt.nnd), little-endian on disk:
+//   NndHeader, then num_samples + 1 uint64 offsets into the features,
+//   num_features uint16 active-feature indices and num_samples label bytes.
+//   The checksum is FNV-1a 64 of every byte after the header.
+
+const char NND_MAGIC[4] = {'N', 'N', 'D', '1'};
+const uint32_t NND_VERSION = 1;
+
+struct NndHeader {
+    char magic[4];
+    uint32_t version;
+    // Size and modification time of the text file, to detect edits
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t num_samples;
+    uint64_t num_features;
+    uint64_t checksum;
+};
+
+// Labelled positions as sorted active-feature lists, pointing into a mapped
+// cache file (or into memory when the cache could not be written)
+struct Dataset {
+    size_t num_samples = 0;
+    const uint64_t* offsets = nullptr;
+    const uint16_t* features = nullptr;
+    // Class index, as returned by label_to_index
+    const uint8_t* labels = nullptr;
+    std::shared_ptr<void> mapping;
+
+    size_t size() const { return num_samples; }
+    const uint16_t* features_begin(size_t i) const { return features + offsets[i]; }
+    const uint16_t* features_end(size_t i) const { return features + offsets[i + 1]; }
+};
+
+// Samples held in memory in the same layout, e.g. one shard of a cache
+struct DatasetBlock {
+    std::vector<uint64_t> offsets = {0};
+    std::vector<uint16_t> features;
+    std::vector<uint8_t> labels;
+
+    size_t size() const { return labels.size(); }
+    void clear() {
+        offsets.assign(1, 0);
+        features.clear();
+        labels.clear();
+    }
+    void add(const uint16_t* begin, const uint16_t* end, uint8_t label) {
+        features.insert(features.end(), begin, end);
+        offsets.push_back(features.size());
+        labels.push_back(label);
+    }
+    // Valid until the block is modified
+    Dataset view() const;
+};
+
+std::string dataset_cache_path(const std::string& path);
+// Writes the cache of a "FEN label" file to fd, skipping lines that are
+// incomplete or do not parse. Memory use does not depend on the file size.
+void compile_dataset(const std::string& path, int fd);
+// Opens the cache of a text file for reading, compiling it first when it is
+// missing, damaged or older than the text. The header is checked against the
+// size and modification time of the text and the size of the cache; verify
+// also rehashes the whole cache against its checksum.
+int open_dataset_cache(const std::string& path, NndHeader& header, bool verify = false);
+// Reads size bytes at offset, throwing on a short read
+void read_cache(int fd, void* data, size_t size, uint64_t offset);
+// Maps the whole cache of a text file
+Dataset load_dataset(const std::string& path, bool verify = false);
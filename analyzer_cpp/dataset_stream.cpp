@@ -0,0 +1,200 @@
+#include "dataset_stream.hpp"
+#include "fen_parser.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <unistd.h>
+
+// Samples read from disk in one go
+static const size_t SHARD_SAMPLES = 16384;
+// Shards read ahead of the one being consumed
+static const size_t PREFETCH_SHARDS = 2;
+static const size_t LABEL_CHUNK = 1 << 20;
+
+DatasetStream::DatasetStream(const std::string& path, size_t window_size, bool verify) : window_size(window_size) {
+    if (window_size == 0) {
+        throw std::runtime_error("Shuffle window must hold at least one sample");
+    }
+    fd = open_dataset_cache(path, header, verify);
+    num_shards = (header.num_samples + SHARD_SAMPLES - 1) / SHARD_SAMPLES;
+    window.reserve(std::min<uint64_t>(window_size, header.num_samples));
+    prefetcher = std::thread(&DatasetStream::prefetch_loop, this);
+}
+
+DatasetStream::~DatasetStream() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    shard_taken.notify_all();
+    prefetcher.join();
+    close(fd);
+}
+
+std::vector<double> DatasetStream::class_counts(size_t num_classes) const {
+    std::vector<double> counts(num_classes, 0.0);
+    std::vector<uint8_t> labels(LABEL_CHUNK);
+    uint64_t base = sizeof(NndHeader) + (header.num_samples + 1) * sizeof(uint64_t) + header.num_features * sizeof(uint16_t);
+    for (uint64_t start = 0; start < header.num_samples; start += labels.size()) {
+        size_t n = std::min<uint64_t>(labels.size(), header.num_samples - start);
+        read_cache(fd, labels.data(), n, base + start);
+        for (size_t i = 0; i < n; i++) {
+            if (labels[i] >= num_classes) {
+                throw std::runtime_error("Corrupted dataset cache: invalid label");
+            }
+            counts[labels[i]]++;
+        }
+    }
+    return counts;
+}
+
+// Called on the prefetch thread: three reads, one per section of the cache
+void DatasetStream::read_shard(size_t shard, DatasetBlock& block) const {
+    uint64_t begin = shard * SHARD_SAMPLES;
+    uint64_t end = std::min<uint64_t>(begin + SHARD_SAMPLES, header.num_samples);
+    size_t count = end - begin;
+    
+    uint64_t offsets_base = sizeof(NndHeader);
+    uint64_t features_base = offsets_base + (header.num_samples + 1) * sizeof(uint64_t);
+    uint64_t labels_base = features_base + header.num_features * sizeof(uint16_t);
+    
+    block.offsets.resize(count + 1);
+    read_cache(fd, block.offsets.data(), (count + 1) * sizeof(uint64_t), offsets_base + begin * sizeof(uint64_t));
+    for (size_t i = 0; i <= count; i++) {
+        bool valid = block.offsets[i] <= header.num_features;
+        if (i > 0) {
+            valid = valid && block.offsets[i] >= block.offsets[i - 1] && block.offsets[i] - block.offsets[i - 1] <= MAX_SAMPLE_FEATURES;
+        }
+        if (!valid) {
+            throw std::runtime_error("Corrupted dataset cache: invalid offsets");
+        }
+    }
+    uint64_t first = block.offsets[0];
+    for (auto& offset : block.offsets) {
+        offset -= first;
+    }
+    
+    block.features.resize(block.offsets[count]);
+    read_cache(fd, block.features.data(), block.features.size() * sizeof(uint16_t), features_base + first * sizeof(uint16_t));
+    for (uint16_t feature : block.features) {
+        if (feature >= FEN_INPUT_SIZE) {
+            throw std::runtime_error("Corrupted dataset cache: invalid feature");
+        }
+    }
+    
+    block.labels.resize(count);
+    read_cache(fd, block.labels.data(), count, labels_base + begin);
+}
+
+void DatasetStream::prefetch_loop() {
+    while (true) {
+        size_t shard;
+        size_t read_epoch;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            shard_taken.wait(lock, [this] {
+                return stopping || (!error && next_read < shard_order.size() && ready.size() < PREFETCH_SHARDS);
+            });
+            if (stopping) return;
+            shard = shard_order[next_read];
+            read_epoch = epoch;
+        }
+        
+        DatasetBlock block;
+        std::exception_ptr failure;
+        try {
+            read_shard(shard, block);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // Dropped if a new epoch started meanwhile
+            if (read_epoch != epoch) continue;
+            if (failure) {
+                error = failure;
+            } else {
+                ready.push_back(std::move(block));
+                next_read++;
+            }
+        }
+        shard_read.notify_all();
+    }
+}
+
+void DatasetStream::begin_epoch(std::mt19937& gen) {
+    std::vector<size_t> order(num_shards);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), gen);
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shard_order = std::move(order);
+        next_read = 0;
+        epoch++;
+        ready.clear();
+        error = nullptr;
+    }
+    shard_taken.notify_all();
+    
+    window.clear();
+    current.clear();
+    current_pos = 0;
+    shards_taken = 0;
+}
+
+void DatasetStream::take_shard() {
+    std::unique_lock<std::mutex> lock(mutex);
+    shard_read.wait(lock, [this] { return !ready.empty() || error; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    current = std::move(ready.front());
+    ready.pop_front();
+    current_pos = 0;
+    shards_taken++;
+    lock.unlock();
+    shard_taken.notify_all();
+}
+
+bool DatasetStream::next(size_t count, std::mt19937& gen, DatasetBlock& block) {
+    block.clear();
+    auto emit = [&](size_t slot) {
+        const Sample& sample = window[slot];
+        block.add(sample.features, sample.features + sample.count, sample.label);
+    };
+    
+    while (block.size() < count) {
+        if (current_pos < current.size()) {
+            // Incoming samples fill the window, then each one evicts a random resident
+            const uint16_t* begin = current.features.data() + current.offsets[current_pos];
+            const uint16_t* end = current.features.data() + current.offsets[current_pos + 1];
+            Sample sample;
+            sample.label = current.labels[current_pos];
+            sample.count = static_cast<uint8_t>(end - begin);
+            std::copy(begin, end, sample.features);
+            current_pos++;
+            
+            if (window.size() < window_size) {
+                window.push_back(sample);
+                continue;
+            }
+            size_t slot = std::uniform_int_distribution<size_t>(0, window.size() - 1)(gen);
+            emit(slot);
+            window[slot] = sample;
+        } else if (shards_taken < num_shards) {
+            take_shard();
+        } else if (!window.empty()) {
+            // End of the epoch: drain the window in random order
+            size_t slot = std::uniform_int_distribution<size_t>(0, window.size() - 1)(gen);
+            emit(slot);
+            window[slot] = window.back();
+            window.pop_back();
+        } else {
+            break;
+        }
+    }
+    
+    return block.size() > 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "dataset.hpp"
+#include "fen_parser.hpp"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <random>
+#include <thread>
+
+const size_t MAX_SAMPLE_FEATURES = FEN_MAX_FEATURES;
+
+// Reads a compiled dataset shard by shard on a background thread and hands out
+// its samples through a fixed-size shuffle window, so memory stays bounded
+// whatever the size of the file. Each epoch visits the shards in a new order.
+class DatasetStream {
+public:
+    // verify is passed to open_dataset_cache
+    DatasetStream(const std::string& path, size_t window_size, bool verify = false);
+    ~DatasetStream();
+    
+    DatasetStream(const DatasetStream&) = delete;
+    DatasetStream& operator=(const DatasetStream&) = delete;
+    
+    size_t size() const { return header.num_samples; }
+    // Samples per class index, counted from the label section
+    std::vector<double> class_counts(size_t num_classes) const;
+    
+    void begin_epoch(std::mt19937& gen);
+    // Replaces block with the next count samples (fewer at the end of the epoch);
+    // false once the epoch is exhausted
+    bool next(size_t count, std::mt19937& gen, DatasetBlock& block);
+
+private:
+    struct Sample {
+        uint8_t label;
+        uint8_t count;
+        uint16_t features[MAX_SAMPLE_FEATURES];
+    };
+    
+    void prefetch_loop();
+    void read_shard(size_t shard, DatasetBlock& block) const;
+    void take_shard();
+    
+    int fd;
+    NndHeader header;
+    size_t window_size;
+    size_t num_shards;
+    
+    // Shared with the prefetch thread
+    std::thread prefetcher;
+    std::mutex mutex;
+    std::condition_variable shard_read;
+    std::condition_variable shard_taken;
+    std::vector<size_t> shard_order;
+    size_t next_read = 0;
+    size_t epoch = 0;
+    std::deque<DatasetBlock> ready;
+    std::exception_ptr error;
+    bool stopping = false;
+    
+    // Consumer side
+    std::vector<Sample> window;
+    DatasetBlock current;
+    size_t current_pos = 0;
+    size_t shards_taken = 0;
+};
@@ -0,0 +1,134 @@
+#include "evaluation.hpp"
+#include "fen_parser.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+// Samples evaluated together by one forward_batch_sparse call
+static const size_t EVALUATION_BATCH = 256;
+
+void EvaluationReport::reset(size_t classes) {
+    num_classes = classes;
+    confusion.assign(classes * classes, 0);
+    samples = 0;
+    total_loss = 0.0;
+}
+
+void EvaluationReport::add(size_t expected, size_t predicted, double loss) {
+    confusion[expected * num_classes + predicted]++;
+    samples++;
+    total_loss += loss;
+}
+
+void EvaluationReport::merge(const EvaluationReport& other) {
+    for (size_t i = 0; i < confusion.size(); i++) {
+        confusion[i] += other.confusion[i];
+    }
+    samples += other.samples;
+    total_loss += other.total_loss;
+}
+
+double EvaluationReport::loss() const {
+    return samples > 0 ? total_loss / samples : 0.0;
+}
+
+uint64_t EvaluationReport::correct() const {
+    uint64_t total = 0;
+    for (size_t c = 0; c < num_classes; c++) {
+        total += confusion[c * num_classes + c];
+    }
+    return total;
+}
+
+double EvaluationReport::accuracy() const {
+    return samples > 0 ? static_cast<double>(correct()) / samples : 0.0;
+}
+
+double EvaluationReport::precision(size_t c) const {
+    uint64_t predicted = 0;
+    for (size_t e = 0; e < num_classes; e++) {
+        predicted += confusion[e * num_classes + c];
+    }
+    return predicted > 0 ? static_cast<double>(confusion[c * num_classes + c]) / predicted : -1.0;
+}
+
+double EvaluationReport::recall(size_t c) const {
+    uint64_t expected = 0;
+    for (size_t p = 0; p < num_classes; p++) {
+        expected += confusion[c * num_classes + p];
+    }
+    return expected > 0 ? static_cast<double>(confusion[c * num_classes + c]) / expected : -1.0;
+}
+
+template <typename Real>
+static void evaluate_range(const BasicNetwork<Real>& network, const Dataset& data, const std::vector<size_t>& rows, size_t begin, size_t end, EvaluationScratch<Real>& scratch) {
+    const size_t output_size = network.layers.back().outputs;
+    scratch.report.reset(output_size);
+    
+    for (size_t start = begin; start < end; start += EVALUATION_BATCH) {
+        size_t count = std::min(EVALUATION_BATCH, end - start);
+        scratch.inputs.clear();
+        for (size_t b = 0; b < count; b++) {
+            size_t i = rows[start + b];
+            scratch.inputs.add(data.features_begin(i), data.features_end(i));
+        }
+        
+        const auto& output = forward_batch_sparse(network, scratch.inputs, scratch.cache);
+        for (size_t b = 0; b < count; b++) {
+            const Real* row = &output[b * output_size];
+            size_t label = data.labels[rows[start + b]];
+            if (label >= output_size) {
+                throw std::runtime_error("Sample label does not match the network outputs");
+            }
+            size_t predicted = std::max_element(row, row + output_size) - row;
+            scratch.report.add(label, predicted, cross_entropy_loss(row, label, {}));
+        }
+    }
+}
+
+template <typename Real>
+EvaluationReport evaluate_network(const BasicNetwork<Real>& network, const Dataset& data, const std::vector<size_t>& rows, ThreadPool& pool, std::vector<EvaluationScratch<Real>>& scratch) {
+    size_t count = rows.size();
+    size_t workers = std::max<size_t>(1, std::min(pool.size(), count));
+    if (scratch.size() < workers) {
+        scratch.resize(workers);
+    }
+    
+    // One contiguous range per worker so each one keeps its own scratch
+    pool.run(workers, [&](size_t w) {
+        size_t begin = w * count / workers;
+        size_t end = (w + 1) * count / workers;
+        evaluate_range(network, data, rows, begin, end, scratch[w]);
+    });
+    
+    // Merged in worker order
+    EvaluationReport report;
+    report.reset(network.layers.back().outputs);
+    for (size_t w = 0; w < workers; w++) {
+        report.merge(scratch[w].report);
+    }
+    return report;
+}
+
+static std::string format_percent(double ratio) {
+    if (ratio < 0.0) return "-";
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << ratio * 100.0 << "%";
+    return out.str();
+}
+
+void print_evaluation(const EvaluationReport& report, std::ostream& out) {
+    out << "  Validation: loss " << report.loss() << ", accuracy " << format_percent(report.accuracy())
+        << " (" << report.correct() << "/" << report.samples << ")" << std::endl;
+    for (size_t c = 0; c < report.num_classes; c++) {
+        std::ostringstream line;
+        line << "    " << std::left << std::setw(16) << label_name(static_cast<int>(c))
+             << " precision " << std::setw(7) << format_percent(report.precision(c))
+             << " recall " << format_percent(report.recall(c));
+        out << line.str() << std::endl;
+    }
+}
+
+template EvaluationReport evaluate_network<double>(const Network& network, const Dataset& data, const std::vector<size_t>& rows, ThreadPool& pool, std::vector<EvaluationScratch<double>>& scratch);
+template EvaluationReport evaluate_network<float>(const BasicNetwork<float>& network, const Dataset& data, const std::vector<size_t>& rows, ThreadPool& pool, std::vector<EvaluationScratch<float>>& scratch);
@@ -0,0 +1,42 @@
+#pragma once
+#include "dataset.hpp"
+#include "network.hpp"
+#include "thread_pool.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Confusion matrix and summed loss of a network over labelled samples
+struct EvaluationReport {
+    size_t num_classes = 0;
+    // confusion[expected * num_classes + predicted]
+    std::vector<uint64_t> confusion;
+    uint64_t samples = 0;
+    double total_loss = 0.0;
+    
+    void reset(size_t classes);
+    void add(size_t expected, size_t predicted, double loss);
+    void merge(const EvaluationReport& other);
+    // Mean unweighted cross-entropy
+    double loss() const;
+    uint64_t correct() const;
+    double accuracy() const;
+    // Negative when the class was never predicted, or never expected
+    double precision(size_t c) const;
+    double recall(size_t c) const;
+};
+
+// Buffers of one evaluation thread, reused from one call to the next
+template <typename Real>
+struct EvaluationScratch {
+    BasicBatchCache<Real> cache;
+    SparseBatch inputs;
+    EvaluationReport report;
+};
+
+// Scores the samples data lists in rows, in batches spread over the pool's threads
+template <typename Real>
+EvaluationReport evaluate_network(const BasicNetwork<Real>& network, const Dataset& data, const std::vector<size_t>& rows, ThreadPool& pool, std::vector<EvaluationScratch<Real>>& scratch);
+
+// Loss and accuracy on one line, then precision and recall of each class
+void print_evaluation(const EvaluationReport& report, std::ostream& out);
@@ -1,80 +1,262 @@
 #include "fen_parser.hpp"
-#include <sstream>
-#include <stdexcept>
-#include <map>
 #include <algorithm>
-#include <cctype>
+#include <array>
+#include <stdexcept>
 
-static std::string to_lower(std::string s) {
-    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
-    return s;
+static constexpr std::array<int8_t, 256> make_piece_table() {
+    std::array<int8_t, 256> table{};
+    for (size_t i = 0; i < table.size(); i++) {
+        table[i] = -1;
+    }
+    const char pieces[] = "PNBRQKpnbrqk";
+    for (int i = 0; i < 12; i++) {
+        table[static_cast<unsigned char>(pieces[i])] = static_cast<int8_t>(i);
+    }
+    return table;
 }
 
-std::vector<double> fen_to_vector(const std::string& fen) {
-    std::istringstream iss(fen);
-    std::string board_part, turn;
-    iss >> board_part >> turn;
-    
-    if (board_part.empty() || turn.empty()) {
-        throw std::runtime_error("Invalid FEN: " + fen);
+// Piece type of each FEN letter, -1 for any other character
+static constexpr std::array<int8_t, 256> PIECE_TABLE = make_piece_table();
+
+static constexpr std::array<uint64_t, FEN_INPUT_SIZE> make_zobrist_keys() {
+    std::array<uint64_t, FEN_INPUT_SIZE> keys{};
+    // splitmix64
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < keys.size(); i++) {
+        state += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        keys[i] = z ^ (z >> 31);
     }
+    return keys;
+}
+
+// Random key of each input: a position's key is the XOR of its active inputs' keys
+static constexpr std::array<uint64_t, FEN_INPUT_SIZE> ZOBRIST_KEYS = make_zobrist_keys();
+
+static const char* const LABELS[] = {"Nothing", "Check White", "Check Black", "Checkmate White", "Checkmate Black", "Stalemate"};
+static const int NUM_LABELS = 6;
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Walks the board of a FEN, calling on_piece(square, piece) in square order
+template <typename Fn>
+static bool parse_fen(std::string_view fen, bool& white, Fn on_piece) {
+    size_t i = 0;
+    const size_t n = fen.size();
+    while (i < n && is_space(fen[i])) i++;
     
-    std::map<char, int> piece_map = {
-        {'P', 0}, {'N', 1}, {'B', 2}, {'R', 3}, {'Q', 4}, {'K', 5},
-        {'p', 6}, {'n', 7}, {'b', 8}, {'r', 9}, {'q', 10}, {'k', 11}
-    };
-    
-    std::vector<double> vec(769, 0.0);
-    
-    int square = 0;
-    for (char c : board_part) {
+    int rank = 0;
+    int file = 0;
+    for (; i < n && !is_space(fen[i]); i++) {
+        char c = fen[i];
         if (c == '/') {
-            continue;
-        } else if (std::isdigit(c)) {
-            square += (c - '0');
+            if (file != 8 || rank == 7) return false;
+            rank++;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8) return false;
         } else {
-            auto it = piece_map.find(c);
-            if (it != piece_map.end()) {
-                vec[square * 12 + it->second] = 1.0;
-            }
-            square++;
+            int piece = PIECE_TABLE[static_cast<unsigned char>(c)];
+            if (piece < 0 || file == 8) return false;
+            on_piece(rank * 8 + file, piece);
+            file++;
         }
     }
+    if (rank != 7 || file != 8) return false;
     
-    vec[768] = (turn == "w" || turn == "W") ? 1.0 : 0.0;
-    
-    return vec;
+    while (i < n && is_space(fen[i])) i++;
+    if (i == n || (i + 1 < n && !is_space(fen[i + 1]))) return false;
+    char side = lower(fen[i]);
+    if (side != 'w' && side != 'b') return false;
+    white = side == 'w';
+    return true;
 }
 
-std::vector<double> label_to_vector(const std::string& label) {
-    std::string lower_label = to_lower(label);
-    
-    std::map<std::string, int> labels = {
-        {"nothing", 0},
-        {"check white", 1},
-        {"check black", 2},
-        {"checkmate white", 3},
-        {"checkmate black", 4},
-        {"stalemate", 5}
+bool encode_fen_features(std::string_view fen, uint16_t* out, int& count) {
+    int n = 0;
+    bool white;
+    if (!parse_fen(fen, white, [&](int square, int piece) { out[n++] = static_cast<uint16_t>(square * 12 + piece); })) {
+        return false;
+    }
+    if (white) {
+        out[n++] = FEN_INPUT_SIZE - 1;
+    }
+    count = n;
+    return true;
+}
+
+bool hash_fen(std::string_view fen, uint64_t& key) {
+    uint64_t hash = 0;
+    bool white;
+    if (!parse_fen(fen, white, [&](int square, int piece) { hash ^= ZOBRIST_KEYS[square * 12 + piece]; })) {
+        return false;
+    }
+    if (white) {
+        hash ^= ZOBRIST_KEYS[FEN_INPUT_SIZE - 1];
+    }
+    key = hash;
+    return true;
+}
+
+bool encode_fen_features(std::string_view fen, uint16_t* out, int& count, uint64_t& key) {
+    int n = 0;
+    uint64_t hash = 0;
+    auto add = [&](int square, int piece) {
+        int feature = square * 12 + piece;
+        out[n++] = static_cast<uint16_t>(feature);
+        hash ^= ZOBRIST_KEYS[feature];
     };
-    
-    auto it = labels.find(lower_label);
-    if (it == labels.end()) {
-        throw std::runtime_error("Invalid label: " + label);
+    bool white;
+    if (!parse_fen(fen, white, add)) {
+        return false;
     }
-    
-    std::vector<double> vec(6, 0.0);
-    vec[it->second] = 1.0;
+    if (white) {
+        out[n++] = FEN_INPUT_SIZE - 1;
+        hash ^= ZOBRIST_KEYS[FEN_INPUT_SIZE - 1];
+    }
+    count = n;
+    key = hash;
+    return true;
+}
+
+template <typename Real>
+static bool encode_dense(std::string_view fen, Real* out) {
+    std::fill(out, out + FEN_INPUT_SIZE, Real(0));
+    bool white;
+    if (!parse_fen(fen, white, [&](int square, int piece) { out[square * 12 + piece] = Real(1); })) {
+        return false;
+    }
+    out[FEN_INPUT_SIZE - 1] = white ? Real(1) : Real(0);
+    return true;
+}
+
+bool encode_fen_dense(std::string_view fen, double* out) {
+    return encode_dense(fen, out);
+}
+
+bool encode_fen_dense(std::string_view fen, float* out) {
+    return encode_dense(fen, out);
+}
+
+bool encode_fen_bitboards(std::string_view fen, FenBitboards& out) {
+    for (auto& board : out.pieces) {
+        board = 0;
+    }
+    return parse_fen(fen, out.white_to_move, [&](int square, int piece) { out.pieces[piece] |= uint64_t(1) << square; });
+}
+
+std::vector<int> fen_to_features(std::string_view fen) {
+    uint16_t active[FEN_MAX_FEATURES];
+    int count;
+    if (!encode_fen_features(fen, active, count)) {
+        throw std::runtime_error("Invalid FEN: " + std::string(fen));
+    }
+    return std::vector<int>(active, active + count);
+}
+
+int piece_feature(char piece, int square) {
+    int index = PIECE_TABLE[static_cast<unsigned char>(piece)];
+    if (index < 0) {
+        throw std::runtime_error(std::string("Invalid piece: ") + piece);
+    }
+    if (square < 0 || square >= 64) {
+        throw std::runtime_error("Invalid square: " + std::to_string(square));
+    }
+    return square * 12 + index;
+}
+
+int square_from_name(const std::string& name) {
+    if (name.size() != 2 || name[0] < 'a' || name[0] > 'h' || name[1] < '1' || name[1] > '8') {
+        throw std::runtime_error("Invalid square: " + name);
+    }
+    int file = name[0] - 'a';
+    int rank = name[1] - '1';
+    return (7 - rank) * 8 + file;
+}
+
+std::vector<double> fen_to_vector(std::string_view fen) {
+    std::vector<double> vec(FEN_INPUT_SIZE);
+    if (!encode_fen_dense(fen, vec.data())) {
+        throw std::runtime_error("Invalid FEN: " + std::string(fen));
+    }
+    return vec;
+}
+
+int split_fields(std::string_view line, std::string_view* fields, int max_fields) {
+    int count = 0;
+    size_t i = 0;
+    while (true) {
+        while (i < line.size() && is_space(line[i])) i++;
+        if (i == line.size()) return count;
+        size_t start = i;
+        while (i < line.size() && !is_space(line[i])) i++;
+        if (count < max_fields) {
+            fields[count] = line.substr(start, i - start);
+        }
+        count++;
+    }
+}
+
+// Whether label spells name, ignoring case and runs of whitespace between words
+static bool label_matches(std::string_view label, const char* name) {
+    size_t i = 0;
+    while (i < label.size() && is_space(label[i])) i++;
+    for (; *name; name++) {
+        if (*name == ' ') {
+            if (i == label.size() || !is_space(label[i])) return false;
+            while (i < label.size() && is_space(label[i])) i++;
+        } else {
+            if (i == label.size() || lower(label[i]) != lower(*name)) return false;
+            i++;
+        }
+    }
+    while (i < label.size() && is_space(label[i])) i++;
+    return i == label.size();
+}
+
+int find_label(std::string_view label) {
+    for (int i = 0; i < NUM_LABELS; i++) {
+        if (label_matches(label, LABELS[i])) return i;
+    }
+    return -1;
+}
+
+int label_to_index(std::string_view label) {
+    int index = find_label(label);
+    if (index < 0) {
+        throw std::runtime_error("Invalid label: " + std::string(label));
+    }
+    return index;
+}
+
+const char* label_name(int index) {
+    if (index < 0 || index >= NUM_LABELS) {
+        throw std::runtime_error("Invalid label index: " + std::to_string(index));
+    }
+    return LABELS[index];
+}
+
+std::vector<double> label_to_vector(std::string_view label) {
+    std::vector<double> vec(NUM_LABELS, 0.0);
+    vec[label_to_index(label)] = 1.0;
     return vec;
 }
 
 std::string vector_to_label(const std::vector<double>& vec) {
-    std::vector<std::string> labels = {"Nothing", "Check White", "Check Black", "Checkmate White", "Checkmate Black", "Stalemate"};
     int max_idx = 0;
     for (size_t i = 1; i < vec.size(); i++) {
         if (vec[i] > vec[max_idx]) {
             max_idx = i;
         }
     }
-    return labels[max_idx];
+    return LABELS[max_idx];
 }
@@ -1,7 +1,52 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 
-std::vector<double> fen_to_vector(const std::string& fen);
-std::vector<double> label_to_vector(const std::string& label);
+// 64 squares x 12 piece types, plus the side to move
+const int FEN_INPUT_SIZE = 769;
+// Largest number of active inputs: one per square plus the side to move
+const int FEN_MAX_FEATURES = 65;
+
+// One bitboard per piece type in "PNBRQKpnbrqk" order, bit n = square n
+struct FenBitboards {
+    uint64_t pieces[12];
+    bool white_to_move;
+};
+
+// Allocation-free encoders reading "board side ..." from the start of fen.
+// They return false, leaving out unspecified, unless the board is 8 ranks of
+// 8 files and the side to move is w or b.
+//   features: sorted active inputs, out holds FEN_MAX_FEATURES entries
+//   dense: FEN_INPUT_SIZE values of 0 or 1
+bool encode_fen_features(std::string_view fen, uint16_t* out, int& count);
+bool encode_fen_dense(std::string_view fen, double* out);
+bool encode_fen_dense(std::string_view fen, float* out);
+bool encode_fen_bitboards(std::string_view fen, FenBitboards& out);
+// Zobrist key of the inputs a FEN encodes to (board and side to move),
+// computed in the same walk over the board without encoding it
+bool hash_fen(std::string_view fen, uint64_t& key);
+// Features and their Zobrist key together, in a single walk
+bool encode_fen_features(std::string_view fen, uint16_t* out, int& count, uint64_t& key);
+
+// Indices of the inputs set to 1, in increasing order
+std::vector<int> fen_to_features(std::string_view fen);
+// Input index of a piece (FEN letter) standing on a square, numbered like the
+// FEN board: 0 = a8 ... 63 = h1
+int piece_feature(char piece, int square);
+// Square index of an algebraic square name such as "e4"
+int square_from_name(const std::string& name);
+std::vector<double> fen_to_vector(std::string_view fen);
+// Splits line on whitespace into at most max_fields views; returns the total
+// number of fields, which may be larger
+int split_fields(std::string_view line, std::string_view* fields, int max_fields);
+// Class of a label, matched case-insensitively with any whitespace between
+// words: 0 = Nothing, 1/2 = Check White/Black, 3/4 = Checkmate White/Black,
+// 5 = Stalemate. find_label returns -1 for unknown labels.
+int find_label(std::string_view label);
+int label_to_index(std::string_view label);
+// Name of a class index, e.g. "Check White"
+const char* label_name(int index);
+std::vector<double> label_to_vector(std::string_view label);
 std::string vector_to_label(const std::vector<double>& vec);
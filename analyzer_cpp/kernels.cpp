@@ -0,0 +1,320 @@
+#include "kernels.hpp"
+#include "kernels_dispatch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Block sizes chosen so that one panel of B (BLOCK_K x BLOCK_N values) stays in L2
+static const size_t BLOCK_M = 64;
+static const size_t BLOCK_N = 256;
+static const size_t BLOCK_K = 128;
+
+// Scalar reference implementations, also used when no SIMD extension is available
+
+template <typename Real>
+static void scalar_gemm_nn(size_t m, size_t n, size_t k, const Real* a, const Real* b, Real* c) {
+    for (size_t kk = 0; kk < k; kk += BLOCK_K) {
+        size_t k_end = std::min(kk + BLOCK_K, k);
+        for (size_t jj = 0; jj < n; jj += BLOCK_N) {
+            size_t j_end = std::min(jj + BLOCK_N, n);
+            for (size_t ii = 0; ii < m; ii += BLOCK_M) {
+                size_t i_end = std::min(ii + BLOCK_M, m);
+                for (size_t i = ii; i < i_end; i++) {
+                    Real* __restrict c_row = c + i * n;
+                    const Real* a_row = a + i * k;
+                    for (size_t p = kk; p < k_end; p++) {
+                        const Real a_ip = a_row[p];
+                        const Real* __restrict b_row = b + p * n;
+                        for (size_t j = jj; j < j_end; j++) {
+                            c_row[j] += a_ip * b_row[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Real>
+static void scalar_gemm_tn(size_t m, size_t n, size_t k, const Real* a, const Real* b, Real* c) {
+    for (size_t pp = 0; pp < k; pp += BLOCK_K) {
+        size_t p_end = std::min(pp + BLOCK_K, k);
+        for (size_t jj = 0; jj < n; jj += BLOCK_N) {
+            size_t j_end = std::min(jj + BLOCK_N, n);
+            for (size_t ii = 0; ii < m; ii += BLOCK_M) {
+                size_t i_end = std::min(ii + BLOCK_M, m);
+                for (size_t p = pp; p < p_end; p++) {
+                    const Real* a_row = a + p * m;
+                    const Real* __restrict b_row = b + p * n;
+                    for (size_t i = ii; i < i_end; i++) {
+                        const Real a_pi = a_row[i];
+                        Real* __restrict c_row = c + i * n;
+                        for (size_t j = jj; j < j_end; j++) {
+                            c_row[j] += a_pi * b_row[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Real>
+static void scalar_gemm_nt(size_t m, size_t n, size_t k, const Real* a, const Real* b, Real* c) {
+    for (size_t ii = 0; ii < m; ii += BLOCK_M) {
+        size_t i_end = std::min(ii + BLOCK_M, m);
+        for (size_t jj = 0; jj < n; jj += BLOCK_N) {
+            size_t j_end = std::min(jj + BLOCK_N, n);
+            for (size_t i = ii; i < i_end; i++) {
+                const Real* __restrict a_row = a + i * k;
+                Real* c_row = c + i * n;
+                for (size_t j = jj; j < j_end; j++) {
+                    const Real* __restrict b_row = b + j * k;
+                    Real sum = 0;
+                    for (size_t p = 0; p < k; p++) {
+                        sum += a_row[p] * b_row[p];
+                    }
+                    c_row[j] += sum;
+                }
+            }
+        }
+    }
+}
+
+template <typename Real>
+static void scalar_axpy(size_t n, Real alpha, const Real* x, Real* y) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+template <typename Real>
+static Real scalar_dot(size_t n, const Real* x, const Real* y) {
+    Real sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+template <typename Real>
+static void scalar_bias_relu(size_t n, const Real* bias, Real* z, Real* a) {
+    for (size_t i = 0; i < n; i++) {
+        z[i] += bias[i];
+        a[i] = std::max(Real(0), z[i]);
+    }
+}
+
+template <typename Real>
+static void scalar_relu_mask(size_t n, const Real* z, Real* delta) {
+    for (size_t i = 0; i < n; i++) {
+        if (!(z[i] > 0)) delta[i] = 0;
+    }
+}
+
+template <typename Real>
+static void scalar_backprop_delta(size_t m, size_t n, const Real* w, const Real* delta, const Real* z, Real* next) {
+    for (size_t k = 0; k < m; k++) {
+        next[k] = (!z || z[k] > 0) ? scalar_dot(n, w + k * n, delta) : Real(0);
+    }
+}
+
+template <typename Real>
+static void scalar_outer_sgd_update(size_t m, size_t n, Real learning_rate, Real limit, const Real* x, const Real* delta, Real* w) {
+    for (size_t k = 0; k < m; k++) {
+        if (x[k] == 0) continue;
+        Real* w_row = w + k * n;
+        for (size_t j = 0; j < n; j++) {
+            Real g = std::max(-limit, std::min(limit, delta[j] * x[k]));
+            w_row[j] -= learning_rate * g;
+        }
+    }
+}
+
+template <typename Real>
+static void scalar_momentum_update(size_t n, Real learning_rate, Real momentum, bool nesterov, const Real* grad, Real* w, Real* velocity) {
+    for (size_t i = 0; i < n; i++) {
+        Real v = momentum * velocity[i] + grad[i];
+        velocity[i] = v;
+        w[i] -= learning_rate * (nesterov ? grad[i] + momentum * v : v);
+    }
+}
+
+template <typename Real>
+static void scalar_adam_update(size_t n, Real rate, Real beta1, Real beta2, Real epsilon, Real decay, const Real* grad, Real* w, Real* m, Real* v) {
+    for (size_t i = 0; i < n; i++) {
+        m[i] = beta1 * m[i] + (1 - beta1) * grad[i];
+        v[i] = beta2 * v[i] + (1 - beta2) * grad[i] * grad[i];
+        w[i] = (1 - decay) * w[i] - rate * (m[i] / (std::sqrt(v[i]) + epsilon));
+    }
+}
+
+static int32_t scalar_dot_u8_i8(size_t n, const uint8_t* a, const int8_t* b) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += static_cast<int32_t>(a[i]) * b[i];
+    }
+    return sum;
+}
+
+static void scalar_accumulate_i8(size_t n, const int8_t* x, int32_t* acc) {
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += x[i];
+    }
+}
+
+const KernelTable scalar_kernels = {
+    "scalar",
+    {
+        scalar_gemm_nn<double>, scalar_gemm_tn<double>, scalar_gemm_nt<double>, scalar_axpy<double>,
+        scalar_dot<double>, scalar_bias_relu<double>, scalar_relu_mask<double>,
+        scalar_backprop_delta<double>, scalar_outer_sgd_update<double>,
+        scalar_momentum_update<double>, scalar_adam_update<double>,
+    },
+    {
+        scalar_gemm_nn<float>, scalar_gemm_tn<float>, scalar_gemm_nt<float>, scalar_axpy<float>,
+        scalar_dot<float>, scalar_bias_relu<float>, scalar_relu_mask<float>,
+        scalar_backprop_delta<float>, scalar_outer_sgd_update<float>,
+        scalar_momentum_update<float>, scalar_adam_update<float>,
+    },
+    scalar_dot_u8_i8,
+    scalar_accumulate_i8,
+};
+
+static const KernelTable& select_kernels() {
+    const char* forced = std::getenv("MY_TORCH_KERNELS");
+    std::string cap = forced ? forced : "";
+    if (!cap.empty() && cap != "scalar" && cap != "sse2" && cap != "avx2" && cap != "avx512") {
+        std::cerr << "warning: unknown MY_TORCH_KERNELS value \"" << cap
+                  << "\" (expected scalar, sse2, avx2 or avx512), using the best kernels supported" << std::endl;
+        cap.clear();
+    }
+    
+    if (cap == "scalar") return scalar_kernels;
+#ifdef MY_TORCH_X86_KERNELS
+    __builtin_cpu_init();
+    bool has_avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    
+    if (has_avx512 && (cap.empty() || cap == "avx512")) return avx512_kernels;
+    if (has_avx2 && (cap.empty() || cap == "avx512" || cap == "avx2")) return avx2_kernels;
+    return sse2_kernels;
+#else
+    return scalar_kernels;
+#endif
+}
+
+static const KernelTable& kernels() {
+    static const KernelTable& table = select_kernels();
+    return table;
+}
+
+void gemm_nn(size_t m, size_t n, size_t k, const double* a, const double* b, double* c) {
+    kernels().f64.gemm_nn(m, n, k, a, b, c);
+}
+
+void gemm_tn(size_t m, size_t n, size_t k, const double* a, const double* b, double* c) {
+    kernels().f64.gemm_tn(m, n, k, a, b, c);
+}
+
+void gemm_nt(size_t m, size_t n, size_t k, const double* a, const double* b, double* c) {
+    kernels().f64.gemm_nt(m, n, k, a, b, c);
+}
+
+void axpy(size_t n, double alpha, const double* x, double* y) {
+    kernels().f64.axpy(n, alpha, x, y);
+}
+
+double dot(size_t n, const double* x, const double* y) {
+    return kernels().f64.dot(n, x, y);
+}
+
+void bias_relu(size_t n, const double* bias, double* z, double* a) {
+    kernels().f64.bias_relu(n, bias, z, a);
+}
+
+void relu_mask(size_t n, const double* z, double* delta) {
+    kernels().f64.relu_mask(n, z, delta);
+}
+
+void sgd_update(size_t n, double learning_rate, const double* grad, double* w) {
+    kernels().f64.axpy(n, -learning_rate, grad, w);
+}
+
+void backprop_delta(size_t m, size_t n, const double* w, const double* delta, const double* z, double* next) {
+    kernels().f64.backprop_delta(m, n, w, delta, z, next);
+}
+
+void outer_sgd_update(size_t m, size_t n, double learning_rate, double limit, const double* x, const double* delta, double* w) {
+    kernels().f64.outer_sgd_update(m, n, learning_rate, limit, x, delta, w);
+}
+
+void momentum_update(size_t n, double learning_rate, double momentum, bool nesterov, const double* grad, double* w, double* velocity) {
+    kernels().f64.momentum_update(n, learning_rate, momentum, nesterov, grad, w, velocity);
+}
+
+void adam_update(size_t n, double rate, double beta1, double beta2, double epsilon, double decay, const double* grad, double* w, double* m, double* v) {
+    kernels().f64.adam_update(n, rate, beta1, beta2, epsilon, decay, grad, w, m, v);
+}
+
+void gemm_nn(size_t m, size_t n, size_t k, const float* a, const float* b, float* c) {
+    kernels().f32.gemm_nn(m, n, k, a, b, c);
+}
+
+void gemm_tn(size_t m, size_t n, size_t k, const float* a, const float* b, float* c) {
+    kernels().f32.gemm_tn(m, n, k, a, b, c);
+}
+
+void gemm_nt(size_t m, size_t n, size_t k, const float* a, const float* b, float* c) {
+    kernels().f32.gemm_nt(m, n, k, a, b, c);
+}
+
+void axpy(size_t n, float alpha, const float* x, float* y) {
+    kernels().f32.axpy(n, alpha, x, y);
+}
+
+float dot(size_t n, const float* x, const float* y) {
+    return kernels().f32.dot(n, x, y);
+}
+
+void bias_relu(size_t n, const float* bias, float* z, float* a) {
+    kernels().f32.bias_relu(n, bias, z, a);
+}
+
+void relu_mask(size_t n, const float* z, float* delta) {
+    kernels().f32.relu_mask(n, z, delta);
+}
+
+void sgd_update(size_t n, double learning_rate, const float* grad, float* w) {
+    kernels().f32.axpy(n, -static_cast<float>(learning_rate), grad, w);
+}
+
+void backprop_delta(size_t m, size_t n, const float* w, const float* delta, const float* z, float* next) {
+    kernels().f32.backprop_delta(m, n, w, delta, z, next);
+}
+
+void outer_sgd_update(size_t m, size_t n, double learning_rate, double limit, const float* x, const float* delta, float* w) {
+    kernels().f32.outer_sgd_update(m, n, static_cast<float>(learning_rate), static_cast<float>(limit), x, delta, w);
+}
+
+void momentum_update(size_t n, double learning_rate, double momentum, bool nesterov, const float* grad, float* w, float* velocity) {
+    kernels().f32.momentum_update(n, static_cast<float>(learning_rate), static_cast<float>(momentum), nesterov, grad, w, velocity);
+}
+
+void adam_update(size_t n, double rate, double beta1, double beta2, double epsilon, double decay, const float* grad, float* w, float* m, float* v) {
+    kernels().f32.adam_update(n, static_cast<float>(rate), static_cast<float>(beta1), static_cast<float>(beta2), static_cast<float>(epsilon), static_cast<float>(decay), grad, w, m, v);
+}
+
+int32_t dot_u8_i8(size_t n, const uint8_t* a, const int8_t* b) {
+    return kernels().dot_u8_i8(n, a, b);
+}
+
+void accumulate_i8(size_t n, const int8_t* x, int32_t* acc) {
+    kernels().accumulate_i8(n, x, acc);
+}
+
+const char* kernel_isa() {
+    return kernels().name;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Dense row-major matrix kernels, in double and single precision. The GEMMs
+// accumulate into C.
+// The implementation is picked at startup from the CPU features (scalar, SSE2,
+// AVX2 or AVX-512); MY_TORCH_KERNELS=scalar|sse2|avx2|avx512 caps the choice,
+// and any other value is reported on stderr and ignored.
+
+// C[m x n] += A[m x k] * B[k x n]
+void gemm_nn(size_t m, size_t n, size_t k, const double* a, const double* b, double* c);
+
+// C[m x n] += A^T * B with A stored [k x m] and B stored [k x n]
+void gemm_tn(size_t m, size_t n, size_t k, const double* a, const double* b, double* c);
+
+// C[m x n] += A * B^T with A stored [m x k] and B stored [n x k]
+void gemm_nt(size_t m, size_t n, size_t k, const double* a, const double* b, double* c);
+
+// y += alpha * x
+void axpy(size_t n, double alpha, const double* x, double* y);
+
+double dot(size_t n, const double* x, const double* y);
+
+// z += bias, then a = max(z, 0)
+void bias_relu(size_t n, const double* bias, double* z, double* a);
+
+// delta = 0 wherever z <= 0 (ReLU derivative)
+void relu_mask(size_t n, const double* z, double* delta);
+
+// w -= learning_rate * grad
+void sgd_update(size_t n, double learning_rate, const double* grad, double* w);
+
+// next[k] = W[k] . delta for W stored [m x n], or 0 where z[k] <= 0: the delta
+// of a layer's inputs with the ReLU derivative of the layer below fused in, so
+// masked rows are never read. A null z applies no mask.
+void backprop_delta(size_t m, size_t n, const double* w, const double* delta, const double* z, double* next);
+
+// W[k][j] -= learning_rate * clamp(x[k] * delta[j], -limit, limit) for W stored
+// [m x n]: a clipped outer-product SGD step without materializing the gradient.
+// Rows where x[k] == 0 (e.g. ReLU outputs) would not change and are skipped.
+void outer_sgd_update(size_t m, size_t n, double learning_rate, double limit, const double* x, const double* delta, double* w);
+
+// velocity = momentum * velocity + grad, then w -= learning_rate * velocity,
+// or w -= learning_rate * (grad + momentum * velocity) with Nesterov momentum
+void momentum_update(size_t n, double learning_rate, double momentum, bool nesterov, const double* grad, double* w, double* velocity);
+
+// One Adam step over the moments m and v, then
+// w = (1 - decay) * w - rate * m / (sqrt(v) + epsilon).
+// The bias corrections are expected folded into rate and epsilon; decay is the
+// decoupled weight decay of AdamW (0 for Adam).
+void adam_update(size_t n, double rate, double beta1, double beta2, double epsilon, double decay, const double* grad, double* w, double* m, double* v);
+
+void gemm_nn(size_t m, size_t n, size_t k, const float* a, const float* b, float* c);
+void gemm_tn(size_t m, size_t n, size_t k, const float* a, const float* b, float* c);
+void gemm_nt(size_t m, size_t n, size_t k, const float* a, const float* b, float* c);
+void axpy(size_t n, float alpha, const float* x, float* y);
+float dot(size_t n, const float* x, const float* y);
+void bias_relu(size_t n, const float* bias, float* z, float* a);
+void relu_mask(size_t n, const float* z, float* delta);
+void sgd_update(size_t n, double learning_rate, const float* grad, float* w);
+void backprop_delta(size_t m, size_t n, const float* w, const float* delta, const float* z, float* next);
+void outer_sgd_update(size_t m, size_t n, double learning_rate, double limit, const float* x, const float* delta, float* w);
+void momentum_update(size_t n, double learning_rate, double momentum, bool nesterov, const float* grad, float* w, float* velocity);
+void adam_update(size_t n, double rate, double beta1, double beta2, double epsilon, double decay, const float* grad, float* w, float* m, float* v);
+
+// Sum of a[i] * b[i] in 32-bit integers. The a values must be at most 127, so
+// that the SIMD versions can add pairs of products in 16 bits without saturating.
+int32_t dot_u8_i8(size_t n, const uint8_t* a, const int8_t* b);
+
+// acc += x, widening to 32 bits
+void accumulate_i8(size_t n, const int8_t* x, int32_t* acc);
+
+const char* kernel_isa();
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// One implementation of every kernel for a given instruction set and scalar type
+template <typename Real>
+struct KernelSet {
+    void (*gemm_nn)(size_t m, size_t n, size_t k, const Real* a, const Real* b, Real* c);
+    void (*gemm_tn)(size_t m, size_t n, size_t k, const Real* a, const Real* b, Real* c);
+    void (*gemm_nt)(size_t m, size_t n, size_t k, const Real* a, const Real* b, Real* c);
+    void (*axpy)(size_t n, Real alpha, const Real* x, Real* y);
+    Real (*dot)(size_t n, const Real* x, const Real* y);
+    void (*bias_relu)(size_t n, const Real* bias, Real* z, Real* a);
+    void (*relu_mask)(size_t n, const Real* z, Real* delta);
+    void (*backprop_delta)(size_t m, size_t n, const Real* w, const Real* delta, const Real* z, Real* next);
+    void (*outer_sgd_update)(size_t m, size_t n, Real learning_rate, Real limit, const Real* x, const Real* delta, Real* w);
+    void (*momentum_update)(size_t n, Real learning_rate, Real momentum, bool nesterov, const Real* grad, Real* w, Real* velocity);
+    void (*adam_update)(size_t n, Real rate, Real beta1, Real beta2, Real epsilon, Real decay, const Real* grad, Real* w, Real* m, Real* v);
+};
+
+struct KernelTable {
+    const char* name;
+    KernelSet<double> f64;
+    KernelSet<float> f32;
+    // Integer kernels of the quantized inference path
+    int32_t (*dot_u8_i8)(size_t n, const uint8_t* a, const int8_t* b);
+    void (*accumulate_i8)(size_t n, const int8_t* x, int32_t* acc);
+};
+
+extern const KernelTable scalar_kernels;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MY_TORCH_X86_KERNELS 1
+extern const KernelTable sse2_kernels;
+extern const KernelTable avx2_kernels;
+extern const KernelTable avx512_kernels;
+#endif
@@ -0,0 +1,254 @@
+#include "kernels_dispatch.hpp"
+
+#ifdef MY_TORCH_X86_KERNELS
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <immintrin.h>
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace sse2 {
+namespace f64 {
+    typedef double real;
+    typedef __m128d vec;
+    static const size_t WIDTH = 2;
+    
+    static inline vec vload(const double* p) { return _mm_loadu_pd(p); }
+    static inline void vstore(double* p, vec v) { _mm_storeu_pd(p, v); }
+    static inline vec vset1(double x) { return _mm_set1_pd(x); }
+    static inline vec vzero() { return _mm_setzero_pd(); }
+    static inline vec vfmadd(vec a, vec b, vec c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static inline vec vadd(vec a, vec b) { return _mm_add_pd(a, b); }
+    static inline vec vmax(vec a, vec b) { return _mm_max_pd(a, b); }
+    static inline vec vmul(vec a, vec b) { return _mm_mul_pd(a, b); }
+    static inline vec vmin(vec a, vec b) { return _mm_min_pd(a, b); }
+    static inline vec vdiv(vec a, vec b) { return _mm_div_pd(a, b); }
+    static inline vec vsqrt(vec a) { return _mm_sqrt_pd(a); }
+    static inline vec vmask_positive(vec z, vec x) { return _mm_and_pd(_mm_cmpgt_pd(z, _mm_setzero_pd()), x); }
+    static inline double vsum(vec v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+    
+#include "kernels_simd.inc"
+}
+namespace f32 {
+    typedef float real;
+    typedef __m128 vec;
+    static const size_t WIDTH = 4;
+    
+    static inline vec vload(const float* p) { return _mm_loadu_ps(p); }
+    static inline void vstore(float* p, vec v) { _mm_storeu_ps(p, v); }
+    static inline vec vset1(float x) { return _mm_set1_ps(x); }
+    static inline vec vzero() { return _mm_setzero_ps(); }
+    static inline vec vfmadd(vec a, vec b, vec c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static inline vec vadd(vec a, vec b) { return _mm_add_ps(a, b); }
+    static inline vec vmax(vec a, vec b) { return _mm_max_ps(a, b); }
+    static inline vec vmul(vec a, vec b) { return _mm_mul_ps(a, b); }
+    static inline vec vmin(vec a, vec b) { return _mm_min_ps(a, b); }
+    static inline vec vdiv(vec a, vec b) { return _mm_div_ps(a, b); }
+    static inline vec vsqrt(vec a) { return _mm_sqrt_ps(a); }
+    static inline vec vmask_positive(vec z, vec x) { return _mm_and_ps(_mm_cmpgt_ps(z, _mm_setzero_ps()), x); }
+    static inline float vsum(vec v) {
+        __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+    }
+    
+#include "kernels_simd.inc"
+}
+
+static int32_t dot_u8_i8(size_t n, const uint8_t* a, const int8_t* b) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        // Zero-extend a and sign-extend b to 16 bits, then multiply-add pairs
+        __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+        __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), b_lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), b_hi));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    int32_t sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) {
+        sum += static_cast<int32_t>(a[i]) * b[i];
+    }
+    return sum;
+}
+
+static void accumulate_i8(size_t n, const int8_t* x, int32_t* acc) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i));
+        __m128i v16 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v16, v16), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v16, v16), 16);
+        __m128i* out = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), lo));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), hi));
+    }
+    for (; i < n; i++) {
+        acc[i] += x[i];
+    }
+}
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+namespace f64 {
+    typedef double real;
+    typedef __m256d vec;
+    static const size_t WIDTH = 4;
+    
+    static inline vec vload(const double* p) { return _mm256_loadu_pd(p); }
+    static inline void vstore(double* p, vec v) { _mm256_storeu_pd(p, v); }
+    static inline vec vset1(double x) { return _mm256_set1_pd(x); }
+    static inline vec vzero() { return _mm256_setzero_pd(); }
+    static inline vec vfmadd(vec a, vec b, vec c) { return _mm256_fmadd_pd(a, b, c); }
+    static inline vec vadd(vec a, vec b) { return _mm256_add_pd(a, b); }
+    static inline vec vmax(vec a, vec b) { return _mm256_max_pd(a, b); }
+    static inline vec vmul(vec a, vec b) { return _mm256_mul_pd(a, b); }
+    static inline vec vmin(vec a, vec b) { return _mm256_min_pd(a, b); }
+    static inline vec vdiv(vec a, vec b) { return _mm256_div_pd(a, b); }
+    static inline vec vsqrt(vec a) { return _mm256_sqrt_pd(a); }
+    static inline vec vmask_positive(vec z, vec x) { return _mm256_and_pd(_mm256_cmp_pd(z, _mm256_setzero_pd(), _CMP_GT_OQ), x); }
+    static inline double vsum(vec v) {
+        __m128d half = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    }
+    
+#include "kernels_simd.inc"
+}
+namespace f32 {
+    typedef float real;
+    typedef __m256 vec;
+    static const size_t WIDTH = 8;
+    
+    static inline vec vload(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void vstore(float* p, vec v) { _mm256_storeu_ps(p, v); }
+    static inline vec vset1(float x) { return _mm256_set1_ps(x); }
+    static inline vec vzero() { return _mm256_setzero_ps(); }
+    static inline vec vfmadd(vec a, vec b, vec c) { return _mm256_fmadd_ps(a, b, c); }
+    static inline vec vadd(vec a, vec b) { return _mm256_add_ps(a, b); }
+    static inline vec vmax(vec a, vec b) { return _mm256_max_ps(a, b); }
+    static inline vec vmul(vec a, vec b) { return _mm256_mul_ps(a, b); }
+    static inline vec vmin(vec a, vec b) { return _mm256_min_ps(a, b); }
+    static inline vec vdiv(vec a, vec b) { return _mm256_div_ps(a, b); }
+    static inline vec vsqrt(vec a) { return _mm256_sqrt_ps(a); }
+    static inline vec vmask_positive(vec z, vec x) { return _mm256_and_ps(_mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_GT_OQ), x); }
+    static inline float vsum(vec v) {
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        __m128 pairs = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+    }
+    
+#include "kernels_simd.inc"
+}
+
+static int32_t dot_u8_i8(size_t n, const uint8_t* a, const int8_t* b) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        // a <= 127 keeps each pair of products below the int16 saturation limit
+        __m256i pairs = _mm256_maddubs_epi16(va, vb);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi32(half, _mm_unpackhi_epi64(half, half));
+    int32_t sum = _mm_cvtsi128_si32(half) + _mm_extract_epi32(half, 1);
+    for (; i < n; i++) {
+        sum += static_cast<int32_t>(a[i]) * b[i];
+    }
+    return sum;
+}
+
+static void accumulate_i8(size_t n, const int8_t* x, int32_t* acc) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i)));
+        __m256i* out = reinterpret_cast<__m256i*>(acc + i);
+        _mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), v));
+    }
+    for (; i < n; i++) {
+        acc[i] += x[i];
+    }
+}
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+// With fma the scalar tails round like the vector bodies, as in the AVX2 set
+#pragma GCC target("avx512f,fma")
+namespace avx512 {
+namespace f64 {
+    typedef double real;
+    typedef __m512d vec;
+    static const size_t WIDTH = 8;
+    
+    static inline vec vload(const double* p) { return _mm512_loadu_pd(p); }
+    static inline void vstore(double* p, vec v) { _mm512_storeu_pd(p, v); }
+    static inline vec vset1(double x) { return _mm512_set1_pd(x); }
+    static inline vec vzero() { return _mm512_setzero_pd(); }
+    static inline vec vfmadd(vec a, vec b, vec c) { return _mm512_fmadd_pd(a, b, c); }
+    static inline vec vadd(vec a, vec b) { return _mm512_add_pd(a, b); }
+    // Masked forms avoid the _mm512_undefined_pd() operand that GCC 12 flags as uninitialized
+    static inline vec vmax(vec a, vec b) { return _mm512_mask_max_pd(a, 0xFF, a, b); }
+    static inline vec vmul(vec a, vec b) { return _mm512_mul_pd(a, b); }
+    static inline vec vmin(vec a, vec b) { return _mm512_mask_min_pd(a, 0xFF, a, b); }
+    static inline vec vdiv(vec a, vec b) { return _mm512_mask_div_pd(a, 0xFF, a, b); }
+    static inline vec vsqrt(vec a) { return _mm512_mask_sqrt_pd(a, 0xFF, a); }
+    static inline vec vmask_positive(vec z, vec x) { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(z, _mm512_setzero_pd(), _CMP_GT_OQ), x); }
+    static inline double vsum(vec v) {
+        double lanes[WIDTH];
+        _mm512_storeu_pd(lanes, v);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+    
+#include "kernels_simd.inc"
+}
+namespace f32 {
+    typedef float real;
+    typedef __m512 vec;
+    static const size_t WIDTH = 16;
+    
+    static inline vec vload(const float* p) { return _mm512_loadu_ps(p); }
+    static inline void vstore(float* p, vec v) { _mm512_storeu_ps(p, v); }
+    static inline vec vset1(float x) { return _mm512_set1_ps(x); }
+    static inline vec vzero() { return _mm512_setzero_ps(); }
+    static inline vec vfmadd(vec a, vec b, vec c) { return _mm512_fmadd_ps(a, b, c); }
+    static inline vec vadd(vec a, vec b) { return _mm512_add_ps(a, b); }
+    static inline vec vmax(vec a, vec b) { return _mm512_mask_max_ps(a, 0xFFFF, a, b); }
+    static inline vec vmul(vec a, vec b) { return _mm512_mul_ps(a, b); }
+    static inline vec vmin(vec a, vec b) { return _mm512_mask_min_ps(a, 0xFFFF, a, b); }
+    static inline vec vdiv(vec a, vec b) { return _mm512_mask_div_ps(a, 0xFFFF, a, b); }
+    static inline vec vsqrt(vec a) { return _mm512_mask_sqrt_ps(a, 0xFFFF, a); }
+    static inline vec vmask_positive(vec z, vec x) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(z, _mm512_setzero_ps(), _CMP_GT_OQ), x); }
+    static inline float vsum(vec v) {
+        float lanes[WIDTH];
+        _mm512_storeu_ps(lanes, v);
+        float sum = 0.0f;
+        for (size_t i = 0; i < WIDTH; i += 2) {
+            sum += lanes[i] + lanes[i + 1];
+        }
+        return sum;
+    }
+    
+#include "kernels_simd.inc"
+}
+}
+#pragma GCC pop_options
+
+#define KERNEL_SET(isa) { isa::gemm_nn, isa::gemm_tn, isa::gemm_nt, isa::axpy, isa::dot, isa::bias_relu, isa::relu_mask, isa::backprop_delta, isa::outer_sgd_update, isa::momentum_update, isa::adam_update }
+
+const KernelTable sse2_kernels = { "sse2", KERNEL_SET(sse2::f64), KERNEL_SET(sse2::f32), sse2::dot_u8_i8, sse2::accumulate_i8 };
+const KernelTable avx2_kernels = { "avx2", KERNEL_SET(avx2::f64), KERNEL_SET(avx2::f32), avx2::dot_u8_i8, avx2::accumulate_i8 };
+// The 512-bit integer instructions need AVX-512BW on top of AVX-512F; the AVX2 ones
+// are always available where AVX-512F is
+const KernelTable avx512_kernels = { "avx512", KERNEL_SET(avx512::f64), KERNEL_SET(avx512::f32), avx2::dot_u8_i8, avx2::accumulate_i8 };
+#endif
@@ -1,35 +1,68 @@
 #include "parsor.hpp"
 #include "train.hpp"
 #include "predict.hpp"
-#include "../include/json_parser.hpp"
+#include "serve.hpp"
+#include "model_io.hpp"
+#include "quantize.hpp"
+#include "profiler.hpp"
 #include <iostream>
-#include <fstream>
-#include <sstream>
+
+template <typename Real>
+static void run(const AnalyzerArgs& args, BasicNetwork<Real>& network) {
+    if (args.mode == "train") {
+        PROFILE_SCOPE("train");
+        train_model(args, network);
+    } else if (args.mode == "predict") {
+        PROFILE_SCOPE("predict");
+        predict_model(args, network);
+    } else if (args.mode == "serve") {
+        serve_model(args, network);
+    } else if (args.mode == "convert") {
+        own_parameters(network);
+        save_network(network, args.data_file);
+    } else {
+        throw std::runtime_error("Invalid mode specified. Use --train, --predict, --serve, --sweep, --convert or --quantize.");
+    }
+}
 
 int main(int argc, char* argv[]) {
     try {
         AnalyzerArgs args = parse_analyzer_arguments(argc, argv);
-        
-        // Load network
-        std::ifstream file(args.load_file);
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open network file: " + args.load_file);
+        if (args.profile) {
+            profile_start(args.trace_file);
         }
         
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        file.close();
-        
-        json::Value network = json::parse(buffer.str());
-        
-        if (args.mode == "train") {
-            train_model(args, network);
-        } else if (args.mode == "predict") {
-            predict_model(args, network);
+        // A sweep loads each of its networks itself
+        if (args.mode == "sweep") {
+            PROFILE_SCOPE("sweep");
+            sweep_models(args);
+        } else if (has_file_magic(args.load_file, NNQ_MAGIC, sizeof(NNQ_MAGIC))) {
+            // Quantized networks only predict
+            if (args.mode == "serve") {
+                serve_model(args, load_quantized_network(args.load_file));
+            } else if (args.mode == "predict") {
+                predict_model(args, load_quantized_network(args.load_file));
+            } else {
+                throw std::runtime_error("Quantized networks can only be used with --predict or --serve");
+            }
+        } else if (args.mode == "quantize") {
+            quantize_model(args, load_network<double>(args.load_file));
+        } else if (args.precision == "fp32") {
+            BasicNetwork<float> network = load_network<float>(args.load_file);
+            run(args, network);
         } else {
-            throw std::runtime_error("Invalid mode specified. Use --train or --predict.");
+            Network network = load_network<double>(args.load_file);
+            // Without --precision, networks stored in fp32 stay in fp32
+            if (args.precision.empty() && network.precision == Precision::Fp32) {
+                BasicNetwork<float> single = network_cast<float>(network);
+                run(args, single);
+            } else {
+                run(args, network);
+            }
         }
-        
+        // On stderr, where it cannot mix with predictions
+        profile_finish(std::cerr);
+    
     } catch (const std::exception& e) {
         std::cerr << "error: " << e.what() << std::endl;
         return 84;
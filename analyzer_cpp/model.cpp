@@ -0,0 +1,295 @@
+#include "model.hpp"
+#include <stdexcept>
+
+Activation activation_from_string(const std::string& name) {
+    if (name == "relu") return Activation::Relu;
+    if (name == "softmax") return Activation::Softmax;
+    if (name == "linear") return Activation::Linear;
+    throw std::runtime_error("Unknown activation: " + name);
+}
+
+std::string activation_to_string(Activation activation) {
+    switch (activation) {
+        case Activation::Relu: return "relu";
+        case Activation::Softmax: return "softmax";
+        case Activation::Linear: break;
+    }
+    return "linear";
+}
+
+Precision precision_from_string(const std::string& name) {
+    if (name == "fp64") return Precision::Fp64;
+    if (name == "fp32") return Precision::Fp32;
+    throw std::runtime_error("Unknown precision: " + name);
+}
+
+std::string precision_to_string(Precision precision) {
+    return precision == Precision::Fp32 ? "fp32" : "fp64";
+}
+
+OptimizerKind optimizer_from_string(const std::string& name) {
+    if (name == "sgd") return OptimizerKind::Sgd;
+    if (name == "momentum") return OptimizerKind::Momentum;
+    if (name == "nesterov") return OptimizerKind::Nesterov;
+    if (name == "adam") return OptimizerKind::Adam;
+    if (name == "adamw") return OptimizerKind::AdamW;
+    throw std::runtime_error("Unknown optimizer: " + name);
+}
+
+std::string optimizer_to_string(OptimizerKind kind) {
+    switch (kind) {
+        case OptimizerKind::Momentum: return "momentum";
+        case OptimizerKind::Nesterov: return "nesterov";
+        case OptimizerKind::Adam: return "adam";
+        case OptimizerKind::AdamW: return "adamw";
+        case OptimizerKind::Sgd: break;
+    }
+    return "sgd";
+}
+
+// State matrices are stored like the weights, one row per output neuron; an
+// empty array means the optimizer keeps no such state
+template <typename Real>
+static void read_state_matrix(const json::Value& value, const BasicLayer<Real>& layer, BasicParamBuffer<Real>& buffer) {
+    const auto& rows = value.as_array();
+    if (rows.empty()) return;
+    if (rows.size() != layer.outputs) {
+        throw std::runtime_error("Optimizer state does not match the weights");
+    }
+    buffer.assign(layer.inputs * layer.outputs, 0.0);
+    for (size_t j = 0; j < layer.outputs; j++) {
+        const auto& row = rows[j].as_array();
+        if (row.size() != layer.inputs) {
+            throw std::runtime_error("Optimizer state does not match the weights");
+        }
+        for (size_t k = 0; k < layer.inputs; k++) {
+            buffer[k * layer.outputs + j] = row[k].as_number();
+        }
+    }
+}
+
+template <typename Real>
+static void read_state_vector(const json::Value& value, const BasicLayer<Real>& layer, BasicParamBuffer<Real>& buffer) {
+    const auto& values = value.as_array();
+    if (values.empty()) return;
+    if (values.size() != layer.outputs) {
+        throw std::runtime_error("Optimizer state does not match the biases");
+    }
+    buffer.assign(layer.outputs, 0.0);
+    for (size_t j = 0; j < layer.outputs; j++) {
+        buffer[j] = values[j].as_number();
+    }
+}
+
+template <typename Real>
+static void read_optimizer(const json::Value& value, BasicNetwork<Real>& network) {
+    OptimizerConfig& config = network.optimizer;
+    config.kind = optimizer_from_string(value["kind"].as_string());
+    config.momentum = value["momentum"].as_number();
+    config.beta1 = value["beta1"].as_number();
+    config.beta2 = value["beta2"].as_number();
+    config.epsilon = value["epsilon"].as_number();
+    config.weight_decay = value["weight_decay"].as_number();
+    network.optimizer_step = static_cast<uint64_t>(value["step"].as_number());
+    
+    const auto& state = value["state"].as_array();
+    if (state.size() != network.layers.size()) {
+        throw std::runtime_error("Optimizer state does not match the layers");
+    }
+    for (size_t i = 0; i < state.size(); i++) {
+        BasicLayer<Real>& layer = network.layers[i];
+        read_state_matrix(state[i]["weight_m"], layer, layer.weight_m);
+        read_state_matrix(state[i]["weight_v"], layer, layer.weight_v);
+        read_state_vector(state[i]["bias_m"], layer, layer.bias_m);
+        read_state_vector(state[i]["bias_v"], layer, layer.bias_v);
+    }
+}
+
+template <typename Real>
+static void write_state_matrix(json::Writer& writer, const BasicLayer<Real>& layer, const BasicParamBuffer<Real>& buffer) {
+    // Transposed back into one row per output neuron, like the weights
+    size_t rows = buffer.size() > 0 ? layer.outputs : 0;
+    writer.begin_array();
+    for (size_t j = 0; j < rows; j++) {
+        writer.begin_array();
+        for (size_t k = 0; k < layer.inputs; k++) {
+            writer.number(buffer[k * layer.outputs + j]);
+        }
+        writer.end_array();
+    }
+    writer.end_array();
+}
+
+template <typename Real>
+static void write_state_vector(json::Writer& writer, const BasicParamBuffer<Real>& buffer) {
+    writer.begin_array();
+    for (Real val : buffer) {
+        writer.number(val);
+    }
+    writer.end_array();
+}
+
+template <typename Real>
+static void write_optimizer(json::Writer& writer, const BasicNetwork<Real>& network) {
+    const OptimizerConfig& config = network.optimizer;
+    writer.begin_object();
+    writer.key("beta1");
+    writer.number(config.beta1);
+    writer.key("beta2");
+    writer.number(config.beta2);
+    writer.key("epsilon");
+    writer.number(config.epsilon);
+    writer.key("kind");
+    writer.string(optimizer_to_string(config.kind));
+    writer.key("momentum");
+    writer.number(config.momentum);
+    
+    writer.key("state");
+    writer.begin_array();
+    for (const auto& layer : network.layers) {
+        writer.begin_object();
+        writer.key("bias_m");
+        write_state_vector(writer, layer.bias_m);
+        writer.key("bias_v");
+        write_state_vector(writer, layer.bias_v);
+        writer.key("weight_m");
+        write_state_matrix(writer, layer, layer.weight_m);
+        writer.key("weight_v");
+        write_state_matrix(writer, layer, layer.weight_v);
+        writer.end_object();
+    }
+    writer.end_array();
+    
+    writer.key("step");
+    writer.number(static_cast<double>(network.optimizer_step));
+    writer.key("weight_decay");
+    writer.number(config.weight_decay);
+    writer.end_object();
+}
+
+template <typename Real>
+BasicNetwork<Real> network_from_json(const json::Value& value) {
+    const auto& layers = value["layers"].as_array();
+    const auto& weights_arr = value["weights"].as_array();
+    const auto& biases_arr = value["biases"].as_array();
+
+    if (weights_arr.size() != layers.size() || biases_arr.size() != layers.size()) {
+        throw std::runtime_error("Network has mismatched layers, weights and biases");
+    }
+
+    BasicNetwork<Real> network;
+    network.learning_rate = value["meta"]["learning_rate"].as_number();
+    // Files written before precision was recorded are fp64
+    const json::Value& precision = value["meta"]["precision"];
+    network.precision = precision.get_type() == json::Value::NULL_TYPE ? Precision::Fp64 : precision_from_string(precision.as_string());
+
+    for (size_t i = 0; i < layers.size(); i++) {
+        const auto& w_layer = weights_arr[i].as_array();
+        const auto& b_layer = biases_arr[i].as_array();
+
+        BasicLayer<Real> layer;
+        layer.activation = activation_from_string(layers[i]["activation"].as_string());
+        layer.outputs = w_layer.size();
+        layer.inputs = w_layer.empty() ? 0 : w_layer[0].size();
+
+        if (layer.outputs == 0 || layer.inputs == 0 || b_layer.size() != layer.outputs) {
+            throw std::runtime_error("Invalid shape for layer " + std::to_string(i));
+        }
+        if (i > 0 && layer.inputs != network.layers.back().outputs) {
+            throw std::runtime_error("Layer " + std::to_string(i) + " input size does not match previous layer");
+        }
+
+        // JSON stores one row per output neuron; transpose into [inputs][outputs]
+        layer.weights.assign(layer.inputs * layer.outputs, 0.0);
+        for (size_t j = 0; j < layer.outputs; j++) {
+            const auto& row = w_layer[j].as_array();
+            if (row.size() != layer.inputs) {
+                throw std::runtime_error("Ragged weight matrix in layer " + std::to_string(i));
+            }
+            for (size_t k = 0; k < layer.inputs; k++) {
+                layer.weights[k * layer.outputs + j] = row[k].as_number();
+            }
+        }
+
+        layer.biases.assign(layer.outputs, 0.0);
+        for (size_t j = 0; j < layer.outputs; j++) {
+            layer.biases[j] = b_layer[j].as_number();
+        }
+
+        network.layers.push_back(std::move(layer));
+    }
+
+    // Networks trained with plain SGD carry no optimizer section
+    if (value.has("optimizer")) {
+        read_optimizer(value["optimizer"], network);
+    }
+
+    return network;
+}
+
+template <typename Real>
+void write_network_json(const BasicNetwork<Real>& network, std::ostream& out) {
+    // Keys in sorted order, as json::Value writes objects
+    json::Writer writer(out);
+    writer.begin_object();
+    
+    writer.key("biases");
+    writer.begin_array();
+    for (const auto& layer : network.layers) {
+        writer.begin_array();
+        for (Real val : layer.biases) {
+            writer.number(val);
+        }
+        writer.end_array();
+    }
+    writer.end_array();
+    
+    writer.key("layers");
+    writer.begin_array();
+    for (const auto& layer : network.layers) {
+        writer.begin_object();
+        writer.key("activation");
+        writer.string(activation_to_string(layer.activation));
+        writer.key("inputs");
+        writer.number(static_cast<double>(layer.inputs));
+        writer.key("outputs");
+        writer.number(static_cast<double>(layer.outputs));
+        writer.end_object();
+    }
+    writer.end_array();
+    
+    writer.key("meta");
+    writer.begin_object();
+    writer.key("learning_rate");
+    writer.number(network.learning_rate);
+    writer.key("precision");
+    writer.string(precision_to_string(precision_of<Real>()));
+    writer.end_object();
+    
+    if (network.optimizer.kind != OptimizerKind::Sgd) {
+        writer.key("optimizer");
+        write_optimizer(writer, network);
+    }
+    
+    writer.key("weights");
+    writer.begin_array();
+    for (const auto& layer : network.layers) {
+        writer.begin_array();
+        for (size_t j = 0; j < layer.outputs; j++) {
+            writer.begin_array();
+            for (size_t k = 0; k < layer.inputs; k++) {
+                writer.number(layer.weights[k * layer.outputs + j]);
+            }
+            writer.end_array();
+        }
+        writer.end_array();
+    }
+    writer.end_array();
+    
+    writer.end_object();
+}
+
+template Network network_from_json<double>(const json::Value& value);
+template BasicNetwork<float> network_from_json<float>(const json::Value& value);
+template void write_network_json<double>(const Network& network, std::ostream& out);
+template void write_network_json<float>(const BasicNetwork<float>& network, std::ostream& out);
@@ -0,0 +1,162 @@
+#pragma once
+#include "../include/json_parser.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include <string>
+
+// Stored as integers in .nnb files: do not reorder
+enum class Activation { Linear, Relu, Softmax };
+
+// Scalar type of the weights and of the math run on them
+enum class Precision { Fp64, Fp32 };
+
+// Stored as integers in .nnb files: do not reorder
+enum class OptimizerKind { Sgd, Momentum, Nesterov, Adam, AdamW };
+
+struct OptimizerConfig {
+    OptimizerKind kind = OptimizerKind::Sgd;
+    // Momentum and Nesterov
+    double momentum = 0.9;
+    // Adam and AdamW
+    double beta1 = 0.9;
+    double beta2 = 0.999;
+    double epsilon = 1e-8;
+    // Decoupled weight decay, AdamW only
+    double weight_decay = 0.01;
+};
+
+template <typename Real>
+constexpr Precision precision_of() {
+    return sizeof(Real) == sizeof(float) ? Precision::Fp32 : Precision::Fp64;
+}
+
+// Contiguous array of parameters that either owns its storage or points into a
+// memory-mapped network file. Copies always own their storage.
+template <typename Real>
+class BasicParamBuffer {
+public:
+    BasicParamBuffer() = default;
+    BasicParamBuffer(const BasicParamBuffer& other) : owned(other.begin(), other.end()), ptr(owned.data()), count(owned.size()) {}
+    BasicParamBuffer(BasicParamBuffer&& other) noexcept = default;
+    BasicParamBuffer& operator=(const BasicParamBuffer& other) {
+        if (this != &other) {
+            owned.assign(other.begin(), other.end());
+            ptr = owned.data();
+            count = owned.size();
+        }
+        return *this;
+    }
+    BasicParamBuffer& operator=(BasicParamBuffer&& other) noexcept = default;
+    
+    void assign(size_t n, Real value) {
+        owned.assign(n, value);
+        ptr = owned.data();
+        count = n;
+    }
+    // Uses external memory, which must outlive the buffer
+    void borrow(Real* data, size_t n) {
+        owned = std::vector<Real>();
+        ptr = data;
+        count = n;
+    }
+    // Copies borrowed memory into owned storage
+    void own() {
+        if (ptr != owned.data()) {
+            owned.assign(begin(), end());
+            ptr = owned.data();
+        }
+    }
+    
+    size_t size() const { return count; }
+    Real* data() { return ptr; }
+    const Real* data() const { return ptr; }
+    Real& operator[](size_t i) { return ptr[i]; }
+    const Real& operator[](size_t i) const { return ptr[i]; }
+    Real* begin() { return ptr; }
+    Real* end() { return ptr + count; }
+    const Real* begin() const { return ptr; }
+    const Real* end() const { return ptr + count; }
+    
+private:
+    std::vector<Real> owned;
+    Real* ptr = nullptr;
+    size_t count = 0;
+};
+
+template <typename Real>
+struct BasicLayer {
+    size_t inputs;
+    size_t outputs;
+    Activation activation;
+    // Row-major [inputs][outputs]: the fan-out of each input neuron is contiguous
+    BasicParamBuffer<Real> weights;
+    BasicParamBuffer<Real> biases;
+    // Optimizer state in the same layouts: the velocity of Momentum and
+    // Nesterov in *_m, the moments of Adam in *_m and *_v. Empty under SGD.
+    BasicParamBuffer<Real> weight_m;
+    BasicParamBuffer<Real> weight_v;
+    BasicParamBuffer<Real> bias_m;
+    BasicParamBuffer<Real> bias_v;
+};
+
+template <typename Real>
+struct BasicNetwork {
+    double learning_rate;
+    // Precision recorded in the file the network was loaded from
+    Precision precision = precision_of<Real>();
+    std::vector<BasicLayer<Real>> layers;
+    OptimizerConfig optimizer;
+    // Updates applied by the optimizer so far, for Adam's bias correction
+    uint64_t optimizer_step = 0;
+    // Keeps a memory-mapped file alive while layers point into it
+    std::shared_ptr<void> mapping;
+};
+
+using Layer = BasicLayer<double>;
+using Network = BasicNetwork<double>;
+
+Activation activation_from_string(const std::string& name);
+std::string activation_to_string(Activation activation);
+Precision precision_from_string(const std::string& name);
+std::string precision_to_string(Precision precision);
+OptimizerKind optimizer_from_string(const std::string& name);
+std::string optimizer_to_string(OptimizerKind kind);
+
+template <typename To, typename From>
+void convert_params(const BasicParamBuffer<From>& from, BasicParamBuffer<To>& to) {
+    to.assign(from.size(), 0);
+    std::copy(from.begin(), from.end(), to.begin());
+}
+
+// Copies a network into another scalar type
+template <typename To, typename From>
+BasicNetwork<To> network_cast(const BasicNetwork<From>& network) {
+    BasicNetwork<To> result;
+    result.learning_rate = network.learning_rate;
+    result.optimizer = network.optimizer;
+    result.optimizer_step = network.optimizer_step;
+    for (const auto& layer : network.layers) {
+        BasicLayer<To> converted;
+        converted.inputs = layer.inputs;
+        converted.outputs = layer.outputs;
+        converted.activation = layer.activation;
+        convert_params(layer.weights, converted.weights);
+        convert_params(layer.biases, converted.biases);
+        convert_params(layer.weight_m, converted.weight_m);
+        convert_params(layer.weight_v, converted.weight_v);
+        convert_params(layer.bias_m, converted.bias_m);
+        convert_params(layer.bias_v, converted.bias_v);
+        result.layers.push_back(std::move(converted));
+    }
+    return result;
+}
+
+template <typename Real>
+BasicNetwork<Real> network_from_json(const json::Value& value);
+// Streams the JSON document directly, without building a json::Value tree.
+// The metadata records the precision of Real.
+template <typename Real>
+void write_network_json(const BasicNetwork<Real>& network, std::ostream& out);
@@ -0,0 +1,343 @@
+#include "model_io.hpp"
+#include "profiler.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t fnv1a(const unsigned char* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + NNB_ALIGNMENT - 1) / NNB_ALIGNMENT * NNB_ALIGNMENT;
+}
+
+static void check_block(const std::string& path, uint64_t offset, uint64_t count, uint64_t scalar_size, uint64_t file_size) {
+    if (offset % NNB_ALIGNMENT != 0 || offset > file_size || count > (file_size - offset) / scalar_size) {
+        throw std::runtime_error("Corrupted network file: " + path);
+    }
+}
+
+// Points the buffer at a block of the mapping, or widens/narrows it into owned
+// storage when the file was written in the other precision
+template <typename Real>
+static void load_block(BasicParamBuffer<Real>& buffer, unsigned char* block, size_t count, uint32_t scalar_size) {
+    if (scalar_size == sizeof(Real)) {
+        buffer.borrow(reinterpret_cast<Real*>(block), count);
+    } else if (scalar_size == sizeof(float)) {
+        const float* values = reinterpret_cast<const float*>(block);
+        buffer.assign(count, 0);
+        std::copy(values, values + count, buffer.begin());
+    } else {
+        const double* values = reinterpret_cast<const double*>(block);
+        buffer.assign(count, 0);
+        std::copy(values, values + count, buffer.begin());
+    }
+}
+
+// Optional block: offset 0 marks state the optimizer does not keep
+template <typename Real>
+static void load_state(const std::string& path, BasicParamBuffer<Real>& buffer, unsigned char* base, uint64_t file_size, uint64_t offset, size_t count, uint32_t scalar_size) {
+    if (offset == 0) return;
+    check_block(path, offset, count, scalar_size, file_size);
+    load_block(buffer, base + offset, count, scalar_size);
+}
+
+template <typename Real>
+BasicNetwork<Real> load_network_binary(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open network file: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(NnbHeader)) {
+        close(fd);
+        throw std::runtime_error("Invalid network file: " + path);
+    }
+    size_t size = st.st_size;
+    
+    // Private writable mapping: training updates weights in copy-on-write pages
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Cannot map network file: " + path);
+    }
+    std::shared_ptr<void> mapping(addr, [size](void* p) { munmap(p, size); });
+    
+    BasicNetwork<Real> network = network_from_binary<Real>(static_cast<unsigned char*>(addr), size, path);
+    network.mapping = mapping;
+    return network;
+}
+
+template <typename Real>
+BasicNetwork<Real> network_from_binary(unsigned char* base, size_t size, const std::string& path) {
+    if (size < sizeof(NnbHeader)) {
+        throw std::runtime_error("Invalid network file: " + path);
+    }
+    NnbHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, NNB_MAGIC, sizeof(NNB_MAGIC)) != 0) {
+        throw std::runtime_error("Not a binary network file: " + path);
+    }
+    // Version 1 files have no optimizer section and were trained with SGD
+    if (header.version != 1 && header.version != NNB_VERSION) {
+        throw std::runtime_error("Unsupported network file version " + std::to_string(header.version) + ": " + path);
+    }
+    if (header.byte_order != NNB_BYTE_ORDER || (header.scalar_size != sizeof(double) && header.scalar_size != sizeof(float))) {
+        throw std::runtime_error("Incompatible network file encoding: " + path);
+    }
+    const size_t entry_size = header.version == 1 ? sizeof(NnbLayer) : sizeof(NnbLayer) + sizeof(NnbLayerState);
+    const size_t fixed_size = sizeof(NnbHeader) + (header.version == 1 ? 0 : sizeof(NnbOptimizer));
+    if (header.file_size != size || size < fixed_size || header.num_layers == 0
+        || header.num_layers > (size - fixed_size) / entry_size) {
+        throw std::runtime_error("Corrupted network file: " + path);
+    }
+    if (fnv1a(base + sizeof(NnbHeader), size - sizeof(NnbHeader)) != header.checksum) {
+        throw std::runtime_error("Checksum mismatch in network file: " + path);
+    }
+    
+    BasicNetwork<Real> network;
+    network.learning_rate = header.learning_rate;
+    network.precision = header.scalar_size == sizeof(float) ? Precision::Fp32 : Precision::Fp64;
+    
+    const unsigned char* table = base + sizeof(NnbHeader);
+    for (uint32_t i = 0; i < header.num_layers; i++) {
+        NnbLayer entry;
+        std::memcpy(&entry, table + i * sizeof(NnbLayer), sizeof(entry));
+        
+        if (entry.inputs == 0 || entry.outputs == 0 || entry.activation > static_cast<uint32_t>(Activation::Softmax)) {
+            throw std::runtime_error("Invalid shape for layer " + std::to_string(i));
+        }
+        if (i > 0 && entry.inputs != network.layers.back().outputs) {
+            throw std::runtime_error("Layer " + std::to_string(i) + " input size does not match previous layer");
+        }
+        uint64_t weight_count = static_cast<uint64_t>(entry.inputs) * entry.outputs;
+        check_block(path, entry.weights_offset, weight_count, header.scalar_size, size);
+        check_block(path, entry.biases_offset, entry.outputs, header.scalar_size, size);
+        
+        BasicLayer<Real> layer;
+        layer.inputs = entry.inputs;
+        layer.outputs = entry.outputs;
+        layer.activation = static_cast<Activation>(entry.activation);
+        load_block(layer.weights, base + entry.weights_offset, weight_count, header.scalar_size);
+        load_block(layer.biases, base + entry.biases_offset, entry.outputs, header.scalar_size);
+        network.layers.push_back(std::move(layer));
+    }
+    
+    if (header.version > 1) {
+        NnbOptimizer optimizer;
+        const unsigned char* section = table + header.num_layers * sizeof(NnbLayer);
+        std::memcpy(&optimizer, section, sizeof(optimizer));
+        if (optimizer.kind > static_cast<uint32_t>(OptimizerKind::AdamW)) {
+            throw std::runtime_error("Unknown optimizer in network file: " + path);
+        }
+        network.optimizer.kind = static_cast<OptimizerKind>(optimizer.kind);
+        network.optimizer.momentum = optimizer.momentum;
+        network.optimizer.beta1 = optimizer.beta1;
+        network.optimizer.beta2 = optimizer.beta2;
+        network.optimizer.epsilon = optimizer.epsilon;
+        network.optimizer.weight_decay = optimizer.weight_decay;
+        network.optimizer_step = optimizer.step;
+        
+        const unsigned char* states = section + sizeof(NnbOptimizer);
+        for (uint32_t i = 0; i < header.num_layers; i++) {
+            NnbLayerState entry;
+            std::memcpy(&entry, states + i * sizeof(NnbLayerState), sizeof(entry));
+            BasicLayer<Real>& layer = network.layers[i];
+            load_state(path, layer.weight_m, base, size, entry.weight_m_offset, layer.weights.size(), header.scalar_size);
+            load_state(path, layer.weight_v, base, size, entry.weight_v_offset, layer.weights.size(), header.scalar_size);
+            load_state(path, layer.bias_m, base, size, entry.bias_m_offset, layer.biases.size(), header.scalar_size);
+            load_state(path, layer.bias_v, base, size, entry.bias_v_offset, layer.biases.size(), header.scalar_size);
+        }
+    }
+    
+    return network;
+}
+
+template <typename Real>
+std::vector<unsigned char> network_to_binary(const BasicNetwork<Real>& network) {
+    std::vector<NnbLayer> table(network.layers.size());
+    std::vector<NnbLayerState> states(network.layers.size());
+    uint64_t offset = align_up(sizeof(NnbHeader) + table.size() * sizeof(NnbLayer) + sizeof(NnbOptimizer) + states.size() * sizeof(NnbLayerState));
+    // Empty state buffers keep offset 0
+    auto place = [&](const BasicParamBuffer<Real>& buffer) {
+        if (buffer.size() == 0) return uint64_t(0);
+        uint64_t at = offset;
+        offset = align_up(offset + buffer.size() * sizeof(Real));
+        return at;
+    };
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        const BasicLayer<Real>& layer = network.layers[i];
+        NnbLayer& entry = table[i];
+        entry.inputs = static_cast<uint32_t>(layer.inputs);
+        entry.outputs = static_cast<uint32_t>(layer.outputs);
+        entry.activation = static_cast<uint32_t>(layer.activation);
+        entry.reserved = 0;
+        entry.weights_offset = offset;
+        offset = align_up(offset + layer.weights.size() * sizeof(Real));
+        entry.biases_offset = offset;
+        offset = align_up(offset + layer.biases.size() * sizeof(Real));
+        states[i].weight_m_offset = place(layer.weight_m);
+        states[i].weight_v_offset = place(layer.weight_v);
+        states[i].bias_m_offset = place(layer.bias_m);
+        states[i].bias_v_offset = place(layer.bias_v);
+    }
+    
+    NnbOptimizer optimizer;
+    std::memset(&optimizer, 0, sizeof(optimizer));
+    optimizer.kind = static_cast<uint32_t>(network.optimizer.kind);
+    optimizer.step = network.optimizer_step;
+    optimizer.momentum = network.optimizer.momentum;
+    optimizer.beta1 = network.optimizer.beta1;
+    optimizer.beta2 = network.optimizer.beta2;
+    optimizer.epsilon = network.optimizer.epsilon;
+    optimizer.weight_decay = network.optimizer.weight_decay;
+    
+    std::vector<unsigned char> bytes(offset, 0);
+    unsigned char* section = bytes.data() + sizeof(NnbHeader);
+    std::memcpy(section, table.data(), table.size() * sizeof(NnbLayer));
+    section += table.size() * sizeof(NnbLayer);
+    std::memcpy(section, &optimizer, sizeof(optimizer));
+    std::memcpy(section + sizeof(optimizer), states.data(), states.size() * sizeof(NnbLayerState));
+    auto store = [&](uint64_t at, const BasicParamBuffer<Real>& buffer) {
+        if (at != 0) std::memcpy(bytes.data() + at, buffer.data(), buffer.size() * sizeof(Real));
+    };
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        const BasicLayer<Real>& layer = network.layers[i];
+        std::memcpy(bytes.data() + table[i].weights_offset, layer.weights.data(), layer.weights.size() * sizeof(Real));
+        std::memcpy(bytes.data() + table[i].biases_offset, layer.biases.data(), layer.biases.size() * sizeof(Real));
+        store(states[i].weight_m_offset, layer.weight_m);
+        store(states[i].weight_v_offset, layer.weight_v);
+        store(states[i].bias_m_offset, layer.bias_m);
+        store(states[i].bias_v_offset, layer.bias_v);
+    }
+    
+    NnbHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, NNB_MAGIC, sizeof(NNB_MAGIC));
+    header.version = NNB_VERSION;
+    header.byte_order = NNB_BYTE_ORDER;
+    header.scalar_size = sizeof(Real);
+    header.num_layers = static_cast<uint32_t>(network.layers.size());
+    header.learning_rate = network.learning_rate;
+    header.file_size = bytes.size();
+    header.checksum = fnv1a(bytes.data() + sizeof(NnbHeader), bytes.size() - sizeof(NnbHeader));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    return bytes;
+}
+
+bool write_file_atomic(const std::string& path, const void* data, size_t size) {
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    const char* p = static_cast<const char*>(data);
+    size_t left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0) break;
+        p += n;
+        left -= n;
+    }
+    // Flushed before the rename, so a crash never leaves a truncated file under path
+    bool ok = left == 0 && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+template <typename Real>
+void save_network_binary(const BasicNetwork<Real>& network, const std::string& path) {
+    std::vector<unsigned char> bytes = network_to_binary(network);
+    // Replace the file rather than truncating it: it may still be mapped
+    if (!write_file_atomic(path, bytes.data(), bytes.size())) {
+        throw std::runtime_error("Cannot write network file: " + path);
+    }
+}
+
+bool has_file_magic(const std::string& path, const char* magic, size_t size) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open network file: " + path);
+    }
+    std::string head(size, '\0');
+    file.read(&head[0], size);
+    return static_cast<size_t>(file.gcount()) == size && std::memcmp(head.data(), magic, size) == 0;
+}
+
+template <typename Real>
+BasicNetwork<Real> load_network(const std::string& path) {
+    PROFILE_SCOPE("load network");
+    if (has_file_magic(path, NNB_MAGIC, sizeof(NNB_MAGIC))) {
+        return load_network_binary<Real>(path);
+    }
+    
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open network file: " + path);
+    }
+    std::string text(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    file.read(&text[0], text.size());
+    return network_from_json<Real>(json::parse(text));
+}
+
+template <typename Real>
+void save_network(const BasicNetwork<Real>& network, const std::string& path) {
+    PROFILE_SCOPE("save network");
+    const std::string ext = ".nnb";
+    if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0) {
+        save_network_binary(network, path);
+        return;
+    }
+    
+    // LOADFILE is detected by its magic, so a binary network may be mapped
+    // from a file without the .nnb extension: never truncate it in place
+    std::ostringstream out;
+    write_network_json(network, out);
+    const std::string text = out.str();
+    if (!write_file_atomic(path, text.data(), text.size())) {
+        throw std::runtime_error("Cannot write network file: " + path);
+    }
+}
+
+template <typename Real>
+void own_parameters(BasicNetwork<Real>& network) {
+    for (auto& layer : network.layers) {
+        layer.weights.own();
+        layer.biases.own();
+        layer.weight_m.own();
+        layer.weight_v.own();
+        layer.bias_m.own();
+        layer.bias_v.own();
+    }
+    network.mapping.reset();
+}
+
+template Network network_from_binary<double>(unsigned char* base, size_t size, const std::string& path);
+template BasicNetwork<float> network_from_binary<float>(unsigned char* base, size_t size, const std::string& path);
+template std::vector<unsigned char> network_to_binary<double>(const Network& network);
+template std::vector<unsigned char> network_to_binary<float>(const BasicNetwork<float>& network);
+template Network load_network_binary<double>(const std::string& path);
+template BasicNetwork<float> load_network_binary<float>(const std::string& path);
+template void save_network_binary<double>(const Network& network, const std::string& path);
+template void save_network_binary<float>(const BasicNetwork<float>& network, const std::string& path);
+template Network load_network<double>(const std::string& path);
+template BasicNetwork<float> load_network<float>(const std::string& path);
+template void save_network<double>(const Network& network, const std::string& path);
+template void save_network<float>(const BasicNetwork<float>& network, const std::string& path);
+template void own_parameters<double>(Network& network);
+template void own_parameters<float>(BasicNetwork<float>& network);
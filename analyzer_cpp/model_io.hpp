@@ -0,0 +1,97 @@
+#pragma once
+#include "model.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary network files (.nnb), little-endian on disk:
+//   NnbHeader, then num_layers NnbLayer entries, then (since version 2)
+//   NnbOptimizer and num_layers NnbLayerState entries, then the weight, bias
+//   and optimizer state blocks, each 64-byte aligned and stored in the
+//   in-memory layout ([inputs][outputs] for weights), as doubles or floats per
+//   scalar_size. State offsets are 0 for buffers the optimizer does not use.
+//   The checksum is FNV-1a 64 of every byte after the header.
+
+const char NNB_MAGIC[4] = {'N', 'N', 'B', '1'};
+const uint32_t NNB_VERSION = 2;
+const uint32_t NNB_BYTE_ORDER = 0x01020304;
+const size_t NNB_ALIGNMENT = 64;
+
+struct NnbHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t scalar_size;
+    uint32_t num_layers;
+    uint32_t reserved;
+    double learning_rate;
+    uint64_t file_size;
+    uint64_t checksum;
+};
+
+struct NnbLayer {
+    uint32_t inputs;
+    uint32_t outputs;
+    uint32_t activation;
+    uint32_t reserved;
+    uint64_t weights_offset;
+    uint64_t biases_offset;
+};
+
+struct NnbOptimizer {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t step;
+    double momentum;
+    double beta1;
+    double beta2;
+    double epsilon;
+    double weight_decay;
+};
+
+struct NnbLayerState {
+    uint64_t weight_m_offset;
+    uint64_t weight_v_offset;
+    uint64_t bias_m_offset;
+    uint64_t bias_v_offset;
+};
+
+const uint64_t FNV1A_BASIS = 14695981039346656037ULL;
+
+// FNV-1a 64-bit hash, used as the checksum of binary files. Pass the previous
+// result as hash to continue over data read in pieces.
+uint64_t fnv1a(const unsigned char* data, size_t size, uint64_t hash = FNV1A_BASIS);
+// Whether the file starts with the given bytes
+bool has_file_magic(const std::string& path, const char* magic, size_t size);
+
+// Decodes a .nnb image of size bytes, pointing the layers into it like
+// load_network_binary does; the caller keeps the memory alive. path is only
+// used in error messages.
+template <typename Real>
+BasicNetwork<Real> network_from_binary(unsigned char* base, size_t size, const std::string& path);
+// Encodes the network as a complete .nnb image
+template <typename Real>
+std::vector<unsigned char> network_to_binary(const BasicNetwork<Real>& network);
+// Writes to a temporary file synced to disk, then renames it over path, so
+// path always holds either the previous or the new contents
+bool write_file_atomic(const std::string& path, const void* data, size_t size);
+
+// Maps the file and points the layers into it, without copying the weights
+// unless the file holds the other precision
+template <typename Real>
+BasicNetwork<Real> load_network_binary(const std::string& path);
+// Stores the weights as Real (scalar_size 8 for fp64, 4 for fp32)
+template <typename Real>
+void save_network_binary(const BasicNetwork<Real>& network, const std::string& path);
+
+// Detects the format from the file magic; anything else is parsed as JSON
+template <typename Real>
+BasicNetwork<Real> load_network(const std::string& path);
+// Writes binary when the path ends in .nnb, JSON otherwise. Either way the
+// file is replaced by a rename, never truncated in place.
+template <typename Real>
+void save_network(const BasicNetwork<Real>& network, const std::string& path);
+// Copies weights and optimizer state still pointing into a mapped file into
+// owned storage and releases the mapping, so that the file can be saved over
+template <typename Real>
+void own_parameters(BasicNetwork<Real>& network);
@@ -1,119 +1,151 @@
 #include "network.hpp"
+#include "kernels.hpp"
+#include "optimizer.hpp"
+#include "profiler.hpp"
 #include <cmath>
+#include <cstdlib>
+#include <new>
 #include <algorithm>
 #include <stdexcept>
 
-static double relu(double x) {
-    return std::max(0.0, x);
-}
-
-static double relu_derivative(double x) {
-    return x > 0 ? 1.0 : 0.0;
-}
+// Bound of each per-sample gradient element in online training
+static const double GRAD_CLIP = 5.0;
 
-static std::vector<double> softmax(const std::vector<double>& vec) {
-    double max_val = *std::max_element(vec.begin(), vec.end());
-    std::vector<double> exps;
+// Evaluated in double whatever the storage type: the exponentials are recomputed
+// rather than rounded to Real before normalizing
+template <typename Real>
+static void softmax_row(Real* row, size_t width) {
+    double max_val = *std::max_element(row, row + width);
     double sum = 0.0;
     
-    for (double x : vec) {
-        double e = std::exp(std::min(x - max_val, 700.0));
-        exps.push_back(e);
-        sum += e;
+    for (size_t j = 0; j < width; j++) {
+        sum += std::exp(std::min(row[j] - max_val, 700.0));
     }
     
     if (sum < 1e-10) sum = 1e-10;
     
-    for (auto& e : exps) {
-        e /= sum;
+    for (size_t j = 0; j < width; j++) {
+        row[j] = static_cast<Real>(std::exp(std::min(row[j] - max_val, 700.0)) / sum);
     }
-    
-    return exps;
 }
 
-static std::vector<double> activate(const std::vector<double>& vec, const std::string& activation) {
-    if (activation == "relu") {
-        std::vector<double> result;
-        for (double x : vec) {
-            result.push_back(relu(x));
+// Adds the bias to each row of z and writes the activation into a.
+// ReLU layers use the fused bias+ReLU kernel.
+template <typename Real>
+static void bias_activate_rows(const BasicLayer<Real>& layer, size_t rows, Real* z, Real* a) {
+    const size_t width = layer.outputs;
+    for (size_t r = 0; r < rows; r++) {
+        Real* z_row = z + r * width;
+        Real* a_row = a + r * width;
+        if (layer.activation == Activation::Relu) {
+            bias_relu(width, layer.biases.data(), z_row, a_row);
+            continue;
+        }
+        axpy(width, Real(1), layer.biases.data(), z_row);
+        std::copy(z_row, z_row + width, a_row);
+        if (layer.activation == Activation::Softmax) {
+            softmax_row(a_row, width);
         }
-        return result;
-    } else if (activation == "softmax") {
-        return softmax(vec);
     }
-    return vec;
 }
 
-static std::vector<double> activate_derivative(const std::vector<double>& vec, const std::string& activation) {
-    if (activation == "relu") {
-        std::vector<double> result;
-        for (double x : vec) {
-            result.push_back(relu_derivative(x));
+template <typename Real>
+static void check_sparse_input(const BasicLayer<Real>& layer, const int* begin, const int* end) {
+    int prev = -1;
+    for (const int* f = begin; f != end; f++) {
+        if (*f <= prev || *f >= static_cast<int>(layer.inputs)) {
+            throw std::runtime_error("Sparse input must be increasing feature indices below the input size");
         }
-        return result;
+        prev = *f;
     }
-    return std::vector<double>(vec.size(), 1.0);
 }
 
-static std::vector<double> matrix_vector_mult(const std::vector<std::vector<double>>& matrix, const std::vector<double>& vec) {
-    std::vector<double> result(matrix.size(), 0.0);
-    for (size_t i = 0; i < matrix.size(); i++) {
-        double sum = 0.0;
-        for (size_t j = 0; j < vec.size(); j++) {
-            sum += matrix[i][j] * vec[j];
-        }
-        result[i] = sum;
+// z += W^T * x with W stored [inputs][outputs]
+template <typename Real>
+static void dense_layer_output(const BasicLayer<Real>& layer, const Real* x, Real* z) {
+    for (size_t k = 0; k < layer.inputs; k++) {
+        axpy(layer.outputs, x[k], &layer.weights[k * layer.outputs], z);
     }
-    return result;
 }
 
-static std::vector<double> vector_add(const std::vector<double>& v1, const std::vector<double>& v2) {
-    std::vector<double> result(v1.size());
-    for (size_t i = 0; i < v1.size(); i++) {
-        result[i] = v1[i] + v2[i];
+// Same for a binary input: sums the weight rows of the active features
+template <typename Real>
+static void sparse_layer_output(const BasicLayer<Real>& layer, const int* begin, const int* end, Real* z) {
+    for (const int* f = begin; f != end; f++) {
+        axpy(layer.outputs, Real(1), &layer.weights[*f * layer.outputs], z);
     }
-    return result;
 }
 
-std::vector<double> forward_pass(json::Value& network, const std::vector<double>& input, ForwardCache& cache) {
+template <typename Real>
+static void record_layer(const BasicLayer<Real>& layer, std::vector<Real>& z, std::vector<Real>& current, BasicForwardCache<Real>& cache) {
+    current.resize(layer.outputs);
+    bias_activate_rows(layer, 1, z.data(), current.data());
+    cache.z_values.push_back(z);
+    cache.activations.push_back(current);
+}
+
+template <typename Real>
+std::vector<Real> forward_pass(const BasicNetwork<Real>& network, const std::vector<Real>& input, BasicForwardCache<Real>& cache) {
     cache.activations.clear();
     cache.z_values.clear();
+    cache.features.clear();
+    cache.sparse = false;
     cache.activations.push_back(input);
     
-    std::vector<double> current = input;
+    std::vector<Real> current = input;
     
-    const auto& layers = network["layers"].as_array();
-    const auto& weights_arr = network["weights"].as_array();
-    const auto& biases_arr = network["biases"].as_array();
-    
-    for (size_t i = 0; i < layers.size(); i++) {
-        const auto& layer = layers[i];
-        std::string activation = layer["activation"].as_string();
-        
-        // Extract weights
-        std::vector<std::vector<double>> weights;
-        const auto& w_layer = weights_arr[i].as_array();
-        for (const auto& row : w_layer) {
-            std::vector<double> w_row;
-            for (const auto& val : row.as_array()) {
-                w_row.push_back(val.as_number());
-            }
-            weights.push_back(w_row);
-        }
-        
-        // Extract biases
-        std::vector<double> biases;
-        for (const auto& val : biases_arr[i].as_array()) {
-            biases.push_back(val.as_number());
+    for (const auto& layer : network.layers) {
+        if (current.size() != layer.inputs) {
+            throw std::runtime_error("Input size does not match network topology");
         }
         
         // Compute z = W*x + b
-        std::vector<double> z = vector_add(matrix_vector_mult(weights, current), biases);
-        cache.z_values.push_back(z);
-        
-        // Activation
-        current = activate(z, activation);
-        cache.activations.push_back(current);
+        std::vector<Real> z(layer.outputs, 0);
+        dense_layer_output(layer, current.data(), z.data());
+        record_layer(layer, z, current, cache);
+    }
+    
+    return current;
+}
+
+template <typename Real>
+std::vector<Real> forward_sparse(const BasicNetwork<Real>& network, const std::vector<int>& features, BasicForwardCache<Real>& cache) {
+    const BasicLayer<Real>& first = network.layers.front();
+    check_sparse_input(first, features.data(), features.data() + features.size());
+    
+    cache.activations.clear();
+    cache.z_values.clear();
+    cache.features = features;
+    cache.sparse = true;
+    cache.activations.emplace_back();
+    
+    std::vector<Real> current;
+    std::vector<Real> z(first.outputs, 0);
+    sparse_layer_output(first, features.data(), features.data() + features.size(), z.data());
+    record_layer(first, z, current, cache);
+    
+    for (size_t i = 1; i < network.layers.size(); i++) {
+        const BasicLayer<Real>& layer = network.layers[i];
+        z.assign(layer.outputs, 0.0);
+        dense_layer_output(layer, current.data(), z.data());
+        record_layer(layer, z, current, cache);
+    }
+    
+    return current;
+}
+
+template <typename Real>
+std::vector<Real> forward_from_first_layer(const BasicNetwork<Real>& network, const std::vector<Real>& first_layer_sum) {
+    std::vector<Real> z = first_layer_sum;
+    std::vector<Real> current(z.size());
+    bias_activate_rows(network.layers[0], 1, z.data(), current.data());
+    
+    for (size_t i = 1; i < network.layers.size(); i++) {
+        const BasicLayer<Real>& layer = network.layers[i];
+        z.assign(layer.outputs, 0.0);
+        dense_layer_output(layer, current.data(), z.data());
+        current.resize(layer.outputs);
+        bias_activate_rows(layer, 1, z.data(), current.data());
     }
     
     return current;
@@ -142,113 +174,464 @@ double cross_entropy_loss(const std::vector<double>& predicted, const std::vecto
     return loss;
 }
 
-Gradients backward_pass(json::Value& network, const ForwardCache& cache, const std::vector<double>& target, double learning_rate, bool apply_update) {
-    const auto& layers = network["layers"].as_array();
-    auto& weights_arr = network["weights"];
-    auto& biases_arr = network["biases"];
+template <typename Real>
+double cross_entropy_loss(const Real* predicted, size_t label, const std::vector<double>& class_weights) {
+    const double epsilon = 1e-15;
+    double weight = class_weights.empty() ? 1.0 : class_weights[label];
+    double p = std::max(epsilon, std::min(1.0 - epsilon, static_cast<double>(predicted[label])));
+    return -std::log(p) * weight;
+}
+
+// Clipped gradient of a layer from the delta of its outputs, applied right away
+// when update is set. A null input means the sparse first layer: its gradient
+// then holds one row per active feature, all equal to the clipped delta.
+template <typename Real>
+static void layer_gradient(BasicLayer<Real>& layer, const Real* input, const int* features, size_t num_features, const Real* delta, Real* w_grad, Real* b_grad, bool update, double learning_rate) {
+    const Real grad_clip = static_cast<Real>(GRAD_CLIP);
+    const size_t output_size = layer.outputs;
+    
+    if (!input) {
+        for (size_t r = 0; r < num_features; r++) {
+            Real* g_row = &w_grad[r * output_size];
+            for (size_t j = 0; j < output_size; j++) {
+                g_row[j] = std::max(-grad_clip, std::min(grad_clip, delta[j]));
+            }
+        }
+    } else {
+        for (size_t k = 0; k < layer.inputs; k++) {
+            Real* g_row = &w_grad[k * output_size];
+            for (size_t j = 0; j < output_size; j++) {
+                Real grad = delta[j] * input[k];
+                g_row[j] = std::max(-grad_clip, std::min(grad_clip, grad));
+            }
+        }
+    }
+    for (size_t j = 0; j < output_size; j++) {
+        b_grad[j] = std::max(-grad_clip, std::min(grad_clip, delta[j]));
+    }
     
+    if (update) {
+        if (!input) {
+            for (size_t r = 0; r < num_features; r++) {
+                sgd_update(output_size, learning_rate, &w_grad[r * output_size], &layer.weights[features[r] * output_size]);
+            }
+        } else {
+            sgd_update(layer.inputs * output_size, learning_rate, w_grad, layer.weights.data());
+        }
+        sgd_update(output_size, learning_rate, b_grad, layer.biases.data());
+    }
+}
+
+// Delta of a layer's inputs: W * delta, masked by the ReLU of the layer below
+template <typename Real>
+static void propagate_delta(const BasicLayer<Real>& layer, const BasicLayer<Real>& below, const Real* below_z, const Real* delta, Real* next_delta) {
+    const Real* mask = below.activation == Activation::Relu ? below_z : nullptr;
+    backprop_delta(layer.inputs, layer.outputs, layer.weights.data(), delta, mask, next_delta);
+}
+
+template <typename Real>
+BasicGradients<Real> backward_pass(BasicNetwork<Real>& network, const BasicForwardCache<Real>& cache, const std::vector<double>& target, double learning_rate, bool apply_update) {
     const auto& activations = cache.activations;
     const auto& z_values = cache.z_values;
     
-    size_t num_layers = layers.size();
+    size_t num_layers = network.layers.size();
     
     // Output gradient
-    std::vector<double> delta;
+    std::vector<Real> delta;
     const auto& output = activations.back();
     for (size_t i = 0; i < output.size(); i++) {
-        delta.push_back(output[i] - target[i]);
+        delta.push_back(static_cast<Real>(output[i] - target[i]));
     }
     
-    Gradients grads;
+    BasicGradients<Real> grads;
+    grads.weights.resize(num_layers);
+    grads.biases.resize(num_layers);
     
     // Backpropagate
     for (int i = num_layers - 1; i >= 0; i--) {
-        const auto& prev_activation = activations[i];
+        BasicLayer<Real>& layer = network.layers[i];
+        std::vector<Real>& w_grad = grads.weights[i];
+        std::vector<Real>& b_grad = grads.biases[i];
+        b_grad.resize(layer.outputs);
         
-        // Get weights/biases
-        auto& w_layer = weights_arr[i];
-        auto& b_layer = biases_arr[i];
-        size_t output_size = w_layer.size();
-        size_t input_size = w_layer[0].size();
-        
-        // Compute gradients
-        std::vector<std::vector<double>> w_grad(output_size, std::vector<double>(input_size));
-        std::vector<double> b_grad(output_size);
+        if (i == 0 && cache.sparse) {
+            // Only the rows of the active inputs (all equal to 1) get a gradient
+            grads.input_rows = cache.features;
+            grads.sparse_input = true;
+            w_grad.resize(cache.features.size() * layer.outputs);
+            layer_gradient(layer, static_cast<const Real*>(nullptr), cache.features.data(), cache.features.size(), delta.data(), w_grad.data(), b_grad.data(), apply_update, learning_rate);
+        } else {
+            w_grad.resize(layer.inputs * layer.outputs);
+            layer_gradient(layer, activations[i].data(), nullptr, 0, delta.data(), w_grad.data(), b_grad.data(), apply_update, learning_rate);
+        }
         
-        const double grad_clip = 5.0;
+        // Propagate error
+        if (i > 0) {
+            std::vector<Real> next_delta(layer.inputs);
+            propagate_delta(layer, network.layers[i-1], z_values[i-1].data(), delta.data(), next_delta.data());
+            delta = next_delta;
+        }
+    }
+    
+    return grads;
+}
+
+template <typename Real>
+BasicWorkspace<Real>::BasicWorkspace(const BasicNetwork<Real>& network) {
+    const size_t alignment = 64;
+    size_t total = 0;
+    auto carve = [&](size_t bytes) {
+        size_t offset = total;
+        total += (bytes + alignment - 1) / alignment * alignment;
+        return offset;
+    };
+    
+    // First pass: offsets into the arena
+    size_t widest = 0;
+    std::vector<size_t> offsets;
+    for (const auto& layer : network.layers) {
+        shape.push_back(layer.inputs);
+        shape.push_back(layer.outputs);
+        widest = std::max({widest, layer.inputs, layer.outputs});
+        offsets.push_back(carve(layer.outputs * sizeof(Real)));
+        offsets.push_back(carve(layer.outputs * sizeof(Real)));
+        offsets.push_back(carve(layer.outputs * sizeof(Real)));
+    }
+    size_t delta_offset = carve(widest * sizeof(Real));
+    size_t next_delta_offset = carve(widest * sizeof(Real));
+    size_t grad_row_offset = carve(widest * sizeof(Real));
+    size_t features_offset = carve((network.layers.empty() ? 0 : network.layers[0].inputs) * sizeof(int));
+    
+    arena = std::unique_ptr<void, void (*)(void*)>(std::aligned_alloc(alignment, std::max(total, alignment)), std::free);
+    if (!arena) {
+        throw std::bad_alloc();
+    }
+    unsigned char* base = static_cast<unsigned char*>(arena.get());
+    auto at = [&](size_t offset) { return reinterpret_cast<Real*>(base + offset); };
+    
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        layers.push_back({at(offsets[3 * i]), at(offsets[3 * i + 1]), at(offsets[3 * i + 2])});
+    }
+    delta = at(delta_offset);
+    next_delta = at(next_delta_offset);
+    grad_row = at(grad_row_offset);
+    features = reinterpret_cast<int*>(base + features_offset);
+}
+
+template <typename Real>
+bool BasicWorkspace<Real>::fits(const BasicNetwork<Real>& network) const {
+    if (shape.size() != 2 * network.layers.size()) return false;
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        if (shape[2 * i] != network.layers[i].inputs || shape[2 * i + 1] != network.layers[i].outputs) return false;
+    }
+    return true;
+}
+
+// Row of an optimizer state buffer, null when the optimizer keeps no such state
+template <typename Real>
+static Real* state_row(BasicParamBuffer<Real>& buffer, size_t offset) {
+    return buffer.size() > 0 ? buffer.data() + offset : nullptr;
+}
+
+template <typename Real>
+double train_step(BasicNetwork<Real>& network, const uint16_t* begin, const uint16_t* end, size_t label, const std::vector<double>& class_weights, double learning_rate, double max_loss, BasicWorkspace<Real>& workspace) {
+    const size_t num_layers = network.layers.size();
+    const BasicLayer<Real>& first = network.layers.front();
+    const size_t num_features = end - begin;
+    if (!workspace.fits(network)) {
+        throw std::runtime_error("Workspace does not match network topology");
+    }
+    if (num_features > first.inputs || label >= network.layers.back().outputs) {
+        throw std::runtime_error("Sparse input must be increasing feature indices below the input size");
+    }
+    int* features = workspace.features;
+    std::copy(begin, end, features);
+    check_sparse_input(first, features, features + num_features);
+    
+    // Forward
+    for (size_t i = 0; i < num_layers; i++) {
+        PROFILE_LAYER_SCOPE("forward", i);
+        const BasicLayer<Real>& layer = network.layers[i];
+        auto& buffers = workspace.layers[i];
+        std::fill(buffers.z, buffers.z + layer.outputs, Real(0));
+        if (i == 0) {
+            sparse_layer_output(layer, features, features + num_features, buffers.z);
+        } else {
+            dense_layer_output(layer, workspace.layers[i - 1].activation, buffers.z);
+        }
+        bias_activate_rows(layer, 1, buffers.z, buffers.activation);
+    }
+    
+    const Real* output = workspace.layers.back().activation;
+    double loss = cross_entropy_loss(output, label, class_weights);
+    if (loss > max_loss) return loss;
+    
+    // Backward, updating each layer before its delta is propagated
+    const OptimizerStep step = begin_optimizer_step(network, learning_rate);
+    const Real grad_clip = static_cast<Real>(GRAD_CLIP);
+    Real* delta = workspace.delta;
+    Real* next_delta = workspace.next_delta;
+    for (size_t j = 0; j < network.layers.back().outputs; j++) {
+        delta[j] = static_cast<Real>(output[j] - (j == label ? 1.0 : 0.0));
+    }
+    for (int i = num_layers - 1; i >= 0; i--) {
+        PROFILE_LAYER_SCOPE("backward", i);
+        BasicLayer<Real>& layer = network.layers[i];
+        Real* clipped = workspace.layers[i].bias_grad;
+        for (size_t j = 0; j < layer.outputs; j++) {
+            clipped[j] = std::max(-grad_clip, std::min(grad_clip, delta[j]));
+        }
         
-        for (size_t j = 0; j < output_size; j++) {
-            for (size_t k = 0; k < input_size; k++) {
-                double grad = delta[j] * prev_activation[k];
-                w_grad[j][k] = std::max(-grad_clip, std::min(grad_clip, grad));
+        // Same update as layer_gradient, fused into one pass over the weights
+        if (i == 0) {
+            for (size_t r = 0; r < num_features; r++) {
+                size_t row = features[r] * layer.outputs;
+                optimizer_update(step, layer.outputs, clipped, &layer.weights[row], state_row(layer.weight_m, row), state_row(layer.weight_v, row));
             }
-            b_grad[j] = std::max(-grad_clip, std::min(grad_clip, delta[j]));
+        } else if (step.kind == OptimizerKind::Sgd) {
+            outer_sgd_update(layer.inputs, layer.outputs, learning_rate, GRAD_CLIP, workspace.layers[i - 1].activation, delta, layer.weights.data());
+        } else {
+            // Stateful optimizers update every row, so the gradient is built one row at a time
+            const Real* input = workspace.layers[i - 1].activation;
+            Real* grad = workspace.grad_row;
+            for (size_t k = 0; k < layer.inputs; k++) {
+                for (size_t j = 0; j < layer.outputs; j++) {
+                    grad[j] = std::max(-grad_clip, std::min(grad_clip, delta[j] * input[k]));
+                }
+                size_t row = k * layer.outputs;
+                optimizer_update(step, layer.outputs, grad, &layer.weights[row], state_row(layer.weight_m, row), state_row(layer.weight_v, row));
+            }
+        }
+        optimizer_update(step, layer.outputs, clipped, layer.biases.data(), state_row(layer.bias_m, 0), state_row(layer.bias_v, 0));
+        
+        if (i > 0) {
+            propagate_delta(layer, network.layers[i-1], workspace.layers[i - 1].z, delta, next_delta);
+            std::swap(delta, next_delta);
         }
+    }
+    
+    return loss;
+}
+
+// Runs layers [first, end) on cache.activations[first]
+template <typename Real>
+static void forward_batch_from(const BasicNetwork<Real>& network, size_t first, BasicBatchCache<Real>& cache) {
+    size_t batch_size = cache.batch_size;
+    
+    for (size_t i = first; i < network.layers.size(); i++) {
+        PROFILE_LAYER_SCOPE("forward", i);
+        const BasicLayer<Real>& layer = network.layers[i];
         
-        grads.weights.insert(grads.weights.begin(), w_grad);
-        grads.biases.insert(grads.biases.begin(), b_grad);
+        // Z = X*W + b, one row per sample
+        auto& z = cache.z_values[i];
+        z.assign(batch_size * layer.outputs, 0);
+        gemm_nn(batch_size, layer.outputs, layer.inputs, cache.activations[i].data(), layer.weights.data(), z.data());
         
-        // Apply updates
-        if (apply_update) {
-            for (size_t j = 0; j < output_size; j++) {
-                for (size_t k = 0; k < input_size; k++) {
-                    double old_val = w_layer[j][k].as_number();
-                    w_layer[j][k] = json::Value(old_val - learning_rate * w_grad[j][k]);
+        auto& a = cache.activations[i + 1];
+        a.resize(z.size());
+        bias_activate_rows(layer, batch_size, z.data(), a.data());
+    }
+}
+
+template <typename Real>
+const std::vector<Real>& forward_batch(const BasicNetwork<Real>& network, const std::vector<Real>& inputs, size_t batch_size, BasicBatchCache<Real>& cache) {
+    size_t num_layers = network.layers.size();
+    if (inputs.size() != batch_size * network.layers[0].inputs) {
+        throw std::runtime_error("Input size does not match network topology");
+    }
+    
+    cache.batch_size = batch_size;
+    cache.sparse = false;
+    cache.activations.resize(num_layers + 1);
+    cache.z_values.resize(num_layers);
+    cache.activations[0] = inputs;
+    
+    forward_batch_from(network, 0, cache);
+    return cache.activations.back();
+}
+
+template <typename Real>
+const std::vector<Real>& forward_batch_sparse(const BasicNetwork<Real>& network, const SparseBatch& inputs, BasicBatchCache<Real>& cache) {
+    size_t num_layers = network.layers.size();
+    size_t batch_size = inputs.size();
+    const BasicLayer<Real>& first = network.layers.front();
+    
+    cache.batch_size = batch_size;
+    cache.sparse = true;
+    cache.sparse_input = inputs;
+    cache.activations.resize(num_layers + 1);
+    cache.z_values.resize(num_layers);
+    cache.activations[0].clear();
+    
+    // First layer: gather and sum the weight rows of each sample's active features
+    {
+        PROFILE_LAYER_SCOPE("forward", 0);
+        auto& z = cache.z_values[0];
+        z.assign(batch_size * first.outputs, 0);
+        for (size_t b = 0; b < batch_size; b++) {
+            const int* begin = inputs.indices.data() + inputs.offsets[b];
+            const int* end = inputs.indices.data() + inputs.offsets[b + 1];
+            check_sparse_input(first, begin, end);
+            sparse_layer_output(first, begin, end, &z[b * first.outputs]);
+        }
+        auto& a = cache.activations[1];
+        a.resize(z.size());
+        bias_activate_rows(first, batch_size, z.data(), a.data());
+    }
+    
+    forward_batch_from(network, 1, cache);
+    return cache.activations.back();
+}
+
+template <typename Real>
+void backward_batch(const BasicNetwork<Real>& network, BasicBatchCache<Real>& cache, const std::vector<double>& targets, const std::vector<double>& sample_weights, BasicGradients<Real>& grads) {
+    size_t num_layers = network.layers.size();
+    size_t batch_size = cache.batch_size;
+    
+    // Output gradient, scaled per sample (a weight of 0 drops the sample)
+    const auto& output = cache.activations.back();
+    size_t width = network.layers.back().outputs;
+    std::vector<Real>& delta = cache.delta;
+    delta.resize(output.size());
+    for (size_t b = 0; b < batch_size; b++) {
+        for (size_t j = 0; j < width; j++) {
+            size_t idx = b * width + j;
+            delta[idx] = static_cast<Real>((output[idx] - targets[idx]) * sample_weights[b]);
+        }
+    }
+    
+    grads.weights.resize(num_layers);
+    grads.biases.resize(num_layers);
+    grads.sparse_input = false;
+    grads.input_rows.clear();
+    std::vector<Real>& next_delta = cache.next_delta;
+    
+    for (int i = num_layers - 1; i >= 0; i--) {
+        PROFILE_LAYER_SCOPE("backward", i);
+        const BasicLayer<Real>& layer = network.layers[i];
+        auto& w_grad = grads.weights[i];
+        
+        if (i == 0 && cache.sparse) {
+            // dW only has rows for the features active somewhere in the batch:
+            // row k accumulates the delta of every sample where feature k is set
+            const SparseBatch& input = cache.sparse_input;
+            grads.input_rows.assign(input.indices.begin(), input.indices.end());
+            std::sort(grads.input_rows.begin(), grads.input_rows.end());
+            grads.input_rows.erase(std::unique(grads.input_rows.begin(), grads.input_rows.end()), grads.input_rows.end());
+            grads.sparse_input = true;
+            
+            std::vector<int>& packed_row = cache.packed_row;
+            packed_row.assign(layer.inputs, -1);
+            for (size_t r = 0; r < grads.input_rows.size(); r++) {
+                packed_row[grads.input_rows[r]] = r;
+            }
+            
+            w_grad.assign(grads.input_rows.size() * layer.outputs, 0);
+            for (size_t b = 0; b < batch_size; b++) {
+                for (size_t idx = input.offsets[b]; idx < input.offsets[b + 1]; idx++) {
+                    axpy(layer.outputs, Real(1), &delta[b * layer.outputs], &w_grad[packed_row[input.indices[idx]] * layer.outputs]);
                 }
-                double old_bias = b_layer[j].as_number();
-                b_layer[j] = json::Value(old_bias - learning_rate * b_grad[j]);
             }
+        } else {
+            // dW = X^T * delta
+            w_grad.assign(layer.inputs * layer.outputs, 0);
+            gemm_tn(layer.inputs, layer.outputs, batch_size, cache.activations[i].data(), delta.data(), w_grad.data());
         }
         
-        // Propagate error
+        // db = column sums of delta
+        auto& b_grad = grads.biases[i];
+        b_grad.assign(layer.outputs, 0);
+        for (size_t b = 0; b < batch_size; b++) {
+            axpy(layer.outputs, Real(1), &delta[b * layer.outputs], b_grad.data());
+        }
+        
+        // Propagate error: delta * W^T masked by the previous activation derivative
         if (i > 0) {
-            std::vector<double> next_delta(prev_activation.size(), 0.0);
+            next_delta.assign(batch_size * layer.inputs, 0);
+            gemm_nt(batch_size, layer.inputs, layer.outputs, delta.data(), layer.weights.data(), next_delta.data());
             
-            for (size_t j = 0; j < prev_activation.size(); j++) {
-                double error = 0.0;
-                for (size_t k = 0; k < delta.size(); k++) {
-                    error += w_layer[k][j].as_number() * delta[k];
-                }
-                
-                std::string prev_activation_fn = layers[i-1]["activation"].as_string();
-                auto deriv = activate_derivative(z_values[i-1], prev_activation_fn);
-                next_delta[j] = error * deriv[j];
+            if (network.layers[i-1].activation == Activation::Relu) {
+                relu_mask(next_delta.size(), cache.z_values[i-1].data(), next_delta.data());
             }
             
-            delta = next_delta;
+            delta.swap(next_delta);
+        }
+    }
+}
+
+// Adds the first-layer weight gradient of src into dst, merging the packed rows
+// when both are sparse and expanding dst when src is dense
+template <typename Real>
+static void accumulate_input_layer(BasicGradients<Real>& dst, const BasicGradients<Real>& src) {
+    size_t width = dst.biases[0].size();
+    std::vector<Real>& dw = dst.weights[0];
+    const std::vector<Real>& sw = src.weights[0];
+    
+    if (!src.sparse_input) {
+        if (dst.sparse_input) {
+            std::vector<Real>& dense = dst.merged_weights;
+            dense.assign(sw.begin(), sw.end());
+            for (size_t r = 0; r < dst.input_rows.size(); r++) {
+                axpy(width, Real(1), &dw[r * width], &dense[dst.input_rows[r] * width]);
+            }
+            dw.swap(dense);
+            dst.input_rows.clear();
+            dst.sparse_input = false;
+        } else {
+            axpy(dw.size(), Real(1), sw.data(), dw.data());
+        }
+        return;
+    }
+    
+    if (!dst.sparse_input) {
+        for (size_t r = 0; r < src.input_rows.size(); r++) {
+            axpy(width, Real(1), &sw[r * width], &dw[src.input_rows[r] * width]);
         }
+        return;
     }
     
-    return grads;
+    std::vector<int>& rows = dst.merged_rows;
+    std::vector<Real>& packed = dst.merged_weights;
+    rows.clear();
+    packed.clear();
+    size_t a = 0;
+    size_t b = 0;
+    while (a < dst.input_rows.size() || b < src.input_rows.size()) {
+        bool take_a = b >= src.input_rows.size() || (a < dst.input_rows.size() && dst.input_rows[a] <= src.input_rows[b]);
+        bool take_b = a >= dst.input_rows.size() || (b < src.input_rows.size() && src.input_rows[b] <= dst.input_rows[a]);
+        
+        rows.push_back(take_a ? dst.input_rows[a] : src.input_rows[b]);
+        size_t offset = packed.size();
+        packed.resize(offset + width, 0);
+        if (take_a) axpy(width, Real(1), &dw[a++ * width], &packed[offset]);
+        if (take_b) axpy(width, Real(1), &sw[b++ * width], &packed[offset]);
+    }
+    dst.input_rows.swap(rows);
+    dw.swap(packed);
 }
 
-void accumulate_gradients(Gradients& g1, const Gradients& g2) {
+template <typename Real>
+void accumulate_gradients(BasicGradients<Real>& g1, const BasicGradients<Real>& g2) {
     if (g1.weights.empty()) {
         g1 = g2;
         return;
     }
     
-    for (size_t i = 0; i < g1.weights.size(); i++) {
-        for (size_t j = 0; j < g1.weights[i].size(); j++) {
-            for (size_t k = 0; k < g1.weights[i][j].size(); k++) {
-                g1.weights[i][j][k] += g2.weights[i][j][k];
-            }
-        }
+    accumulate_input_layer(g1, g2);
+    for (size_t i = 1; i < g1.weights.size(); i++) {
+        axpy(g1.weights[i].size(), Real(1), g2.weights[i].data(), g1.weights[i].data());
     }
     
     for (size_t i = 0; i < g1.biases.size(); i++) {
-        for (size_t j = 0; j < g1.biases[i].size(); j++) {
-            g1.biases[i][j] += g2.biases[i][j];
-        }
+        axpy(g1.biases[i].size(), Real(1), g2.biases[i].data(), g1.biases[i].data());
     }
 }
 
-void scale_gradients(Gradients& grads, double scale) {
+template <typename Real>
+void scale_gradients(BasicGradients<Real>& grads, double scale) {
     for (auto& w_layer : grads.weights) {
-        for (auto& row : w_layer) {
-            for (auto& val : row) {
-                val *= scale;
-            }
+        for (auto& val : w_layer) {
+            val *= scale;
         }
     }
     
@@ -259,25 +642,60 @@ void scale_gradients(Gradients& grads, double scale) {
     }
 }
 
-void apply_gradients(json::Value& network, const Gradients& grads, double learning_rate) {
-    auto& weights_arr = network["weights"];
-    auto& biases_arr = network["biases"];
+template <typename Real>
+void clip_gradients(BasicGradients<Real>& grads, double limit) {
+    const Real bound = static_cast<Real>(limit);
+    for (auto& w_layer : grads.weights) {
+        for (auto& val : w_layer) {
+            val = std::max(-bound, std::min(bound, val));
+        }
+    }
     
+    for (auto& b_layer : grads.biases) {
+        for (auto& val : b_layer) {
+            val = std::max(-bound, std::min(bound, val));
+        }
+    }
+}
+
+template <typename Real>
+void apply_gradients(BasicNetwork<Real>& network, const BasicGradients<Real>& grads, double learning_rate) {
+    PROFILE_SCOPE("apply gradients");
+    const OptimizerStep step = begin_optimizer_step(network, learning_rate);
     for (size_t i = 0; i < grads.weights.size(); i++) {
-        auto& w_layer = weights_arr[i];
-        for (size_t j = 0; j < grads.weights[i].size(); j++) {
-            for (size_t k = 0; k < grads.weights[i][j].size(); k++) {
-                double old_val = w_layer[j][k].as_number();
-                w_layer[j][k] = json::Value(old_val - learning_rate * grads.weights[i][j][k]);
+        BasicLayer<Real>& layer = network.layers[i];
+        if (i == 0 && grads.sparse_input) {
+            size_t width = layer.outputs;
+            for (size_t r = 0; r < grads.input_rows.size(); r++) {
+                size_t row = grads.input_rows[r] * width;
+                optimizer_update(step, width, &grads.weights[0][r * width], &layer.weights[row], state_row(layer.weight_m, row), state_row(layer.weight_v, row));
             }
+            continue;
         }
+        optimizer_update(step, grads.weights[i].size(), grads.weights[i].data(), layer.weights.data(), state_row(layer.weight_m, 0), state_row(layer.weight_v, 0));
     }
     
     for (size_t i = 0; i < grads.biases.size(); i++) {
-        auto& b_layer = biases_arr[i];
-        for (size_t j = 0; j < grads.biases[i].size(); j++) {
-            double old_val = b_layer[j].as_number();
-            b_layer[j] = json::Value(old_val - learning_rate * grads.biases[i][j]);
-        }
+        BasicLayer<Real>& layer = network.layers[i];
+        optimizer_update(step, grads.biases[i].size(), grads.biases[i].data(), layer.biases.data(), state_row(layer.bias_m, 0), state_row(layer.bias_v, 0));
     }
 }
+
+#define INSTANTIATE_NETWORK(Real) \
+    template std::vector<Real> forward_pass(const BasicNetwork<Real>&, const std::vector<Real>&, BasicForwardCache<Real>&); \
+    template std::vector<Real> forward_sparse(const BasicNetwork<Real>&, const std::vector<int>&, BasicForwardCache<Real>&); \
+    template std::vector<Real> forward_from_first_layer(const BasicNetwork<Real>&, const std::vector<Real>&); \
+    template BasicGradients<Real> backward_pass(BasicNetwork<Real>&, const BasicForwardCache<Real>&, const std::vector<double>&, double, bool); \
+    template double cross_entropy_loss(const Real*, size_t, const std::vector<double>&); \
+    template class BasicWorkspace<Real>; \
+    template double train_step(BasicNetwork<Real>&, const uint16_t*, const uint16_t*, size_t, const std::vector<double>&, double, double, BasicWorkspace<Real>&); \
+    template const std::vector<Real>& forward_batch(const BasicNetwork<Real>&, const std::vector<Real>&, size_t, BasicBatchCache<Real>&); \
+    template const std::vector<Real>& forward_batch_sparse(const BasicNetwork<Real>&, const SparseBatch&, BasicBatchCache<Real>&); \
+    template void backward_batch(const BasicNetwork<Real>&, BasicBatchCache<Real>&, const std::vector<double>&, const std::vector<double>&, BasicGradients<Real>&); \
+    template void accumulate_gradients(BasicGradients<Real>&, const BasicGradients<Real>&); \
+    template void scale_gradients(BasicGradients<Real>&, double); \
+    template void clip_gradients(BasicGradients<Real>&, double); \
+    template void apply_gradients(BasicNetwork<Real>&, const BasicGradients<Real>&, double);
+
+INSTANTIATE_NETWORK(double)
+INSTANTIATE_NETWORK(float)
@@ -1,20 +1,143 @@
 #pragma once
-#include "../include/json_parser.hpp"
+#include "model.hpp"
+#include <cstdint>
+#include <memory>
 #include <vector>
 
-struct ForwardCache {
-    std::vector<std::vector<double>> activations;
-    std::vector<std::vector<double>> z_values;
+// Networks run in the precision of their weights (Real is double or float).
+// Softmax and the loss are computed in double either way.
+
+template <typename Real>
+struct BasicForwardCache {
+    std::vector<std::vector<Real>> activations;
+    std::vector<std::vector<Real>> z_values;
+    // Input of forward_sparse, in which case activations[0] stays empty
+    std::vector<int> features;
+    bool sparse = false;
+};
+
+// Binary inputs given as the indices of the features set to 1, strictly increasing.
+// Sample b owns indices[offsets[b] .. offsets[b + 1]).
+struct SparseBatch {
+    std::vector<int> indices;
+    std::vector<size_t> offsets = {0};
+    
+    size_t size() const { return offsets.size() - 1; }
+    void clear() { indices.clear(); offsets.assign(1, 0); }
+    void add(const std::vector<int>& features) {
+        add(features.begin(), features.end());
+    }
+    template <typename It>
+    void add(It begin, It end) {
+        indices.insert(indices.end(), begin, end);
+        offsets.push_back(indices.size());
+    }
+};
+
+// Row-major [batch_size][width] matrices, one per layer
+template <typename Real>
+struct BasicBatchCache {
+    size_t batch_size = 0;
+    std::vector<std::vector<Real>> activations;
+    std::vector<std::vector<Real>> z_values;
+    // Input of forward_batch_sparse, in which case activations[0] stays empty
+    SparseBatch sparse_input;
+    bool sparse = false;
+    // Scratch of backward_batch, kept so that later batches reuse its capacity
+    std::vector<Real> delta;
+    std::vector<Real> next_delta;
+    std::vector<int> packed_row;
 };
 
-struct Gradients {
-    std::vector<std::vector<std::vector<double>>> weights;
-    std::vector<std::vector<double>> biases;
+template <typename Real>
+struct BasicGradients {
+    // Same [inputs][outputs] layout as Layer::weights
+    std::vector<std::vector<Real>> weights;
+    std::vector<std::vector<Real>> biases;
+    // After a sparse pass weights[0] only holds the rows listed in input_rows
+    // (ascending), packed one after the other; all other rows are zero
+    std::vector<int> input_rows;
+    bool sparse_input = false;
+    // Scratch of accumulate_gradients when it merges packed rows
+    std::vector<int> merged_rows;
+    std::vector<Real> merged_weights;
 };
 
-std::vector<double> forward_pass(json::Value& network, const std::vector<double>& input, ForwardCache& cache);
+// Buffers of one online training thread: pre-activations, activations and
+// clipped deltas of every layer, the propagated deltas and the sparse input.
+// They are sized from the topology on creation and carved out of a single
+// 64-byte aligned arena, so train_step never touches the heap. Weight
+// gradients are applied as they are computed: SGD needs no buffer for them,
+// the other optimizers one row at a time.
+template <typename Real>
+class BasicWorkspace {
+public:
+    struct LayerBuffers {
+        Real* z;
+        Real* activation;
+        // Clipped output delta: the bias gradient, and the weight gradient
+        // row of every active input of a sparse layer
+        Real* bias_grad;
+    };
+    
+    explicit BasicWorkspace(const BasicNetwork<Real>& network);
+    
+    BasicWorkspace(const BasicWorkspace&) = delete;
+    BasicWorkspace& operator=(const BasicWorkspace&) = delete;
+    BasicWorkspace(BasicWorkspace&&) noexcept = default;
+    BasicWorkspace& operator=(BasicWorkspace&&) noexcept = default;
+    
+    bool fits(const BasicNetwork<Real>& network) const;
+    
+    std::vector<LayerBuffers> layers;
+    Real* delta = nullptr;
+    Real* next_delta = nullptr;
+    Real* grad_row = nullptr;
+    int* features = nullptr;
+
+private:
+    // inputs then outputs of each layer
+    std::vector<size_t> shape;
+    std::unique_ptr<void, void (*)(void*)> arena{nullptr, nullptr};
+};
+
+using ForwardCache = BasicForwardCache<double>;
+using BatchCache = BasicBatchCache<double>;
+using Gradients = BasicGradients<double>;
+using Workspace = BasicWorkspace<double>;
+
+template <typename Real>
+std::vector<Real> forward_pass(const BasicNetwork<Real>& network, const std::vector<Real>& input, BasicForwardCache<Real>& cache);
+template <typename Real>
+std::vector<Real> forward_sparse(const BasicNetwork<Real>& network, const std::vector<int>& features, BasicForwardCache<Real>& cache);
+// Runs the network from the first layer's W^T * x (bias not added), e.g. as kept by an Accumulator
+template <typename Real>
+std::vector<Real> forward_from_first_layer(const BasicNetwork<Real>& network, const std::vector<Real>& first_layer_sum);
 double cross_entropy_loss(const std::vector<double>& predicted, const std::vector<double>& target, const std::vector<double>& class_weights = {});
-Gradients backward_pass(json::Value& network, const ForwardCache& cache, const std::vector<double>& target, double learning_rate, bool apply_update);
-void accumulate_gradients(Gradients& g1, const Gradients& g2);
-void scale_gradients(Gradients& grads, double scale);
-void apply_gradients(json::Value& network, const Gradients& grads, double learning_rate);
+// Same loss for a one-hot target, read in place from one output row
+template <typename Real>
+double cross_entropy_loss(const Real* predicted, size_t label, const std::vector<double>& class_weights);
+template <typename Real>
+BasicGradients<Real> backward_pass(BasicNetwork<Real>& network, const BasicForwardCache<Real>& cache, const std::vector<double>& target, double learning_rate, bool apply_update);
+// Online training step on one sparse sample: the work of forward_sparse then
+// backward_pass with apply_update, done in the workspace and applied with the
+// network's optimizer. The update is skipped when the loss exceeds max_loss;
+// returns the loss.
+template <typename Real>
+double train_step(BasicNetwork<Real>& network, const uint16_t* begin, const uint16_t* end, size_t label, const std::vector<double>& class_weights, double learning_rate, double max_loss, BasicWorkspace<Real>& workspace);
+template <typename Real>
+const std::vector<Real>& forward_batch(const BasicNetwork<Real>& network, const std::vector<Real>& inputs, size_t batch_size, BasicBatchCache<Real>& cache);
+template <typename Real>
+const std::vector<Real>& forward_batch_sparse(const BasicNetwork<Real>& network, const SparseBatch& inputs, BasicBatchCache<Real>& cache);
+template <typename Real>
+void backward_batch(const BasicNetwork<Real>& network, BasicBatchCache<Real>& cache, const std::vector<double>& targets, const std::vector<double>& sample_weights, BasicGradients<Real>& grads);
+template <typename Real>
+void accumulate_gradients(BasicGradients<Real>& g1, const BasicGradients<Real>& g2);
+template <typename Real>
+void scale_gradients(BasicGradients<Real>& grads, double scale);
+template <typename Real>
+void clip_gradients(BasicGradients<Real>& grads, double limit);
+// One step of the network's optimizer. After a sparse pass only the rows of
+// the active inputs are updated, their state included.
+template <typename Real>
+void apply_gradients(BasicNetwork<Real>& network, const BasicGradients<Real>& grads, double learning_rate);
@@ -0,0 +1,87 @@
+#include "optimizer.hpp"
+#include "kernels.hpp"
+#include <cmath>
+
+template <typename Real>
+static void size_state(BasicParamBuffer<Real>& buffer, size_t count) {
+    if (buffer.size() != count) {
+        buffer.assign(count, 0);
+    }
+}
+
+template <typename Real>
+void init_optimizer_state(BasicNetwork<Real>& network) {
+    OptimizerKind kind = network.optimizer.kind;
+    bool first_moment = kind != OptimizerKind::Sgd;
+    bool second_moment = kind == OptimizerKind::Adam || kind == OptimizerKind::AdamW;
+    for (auto& layer : network.layers) {
+        size_state(layer.weight_m, first_moment ? layer.weights.size() : 0);
+        size_state(layer.bias_m, first_moment ? layer.biases.size() : 0);
+        size_state(layer.weight_v, second_moment ? layer.weights.size() : 0);
+        size_state(layer.bias_v, second_moment ? layer.biases.size() : 0);
+    }
+}
+
+template <typename Real>
+void reset_optimizer(BasicNetwork<Real>& network, OptimizerKind kind) {
+    network.optimizer.kind = kind;
+    network.optimizer_step = 0;
+    for (auto& layer : network.layers) {
+        layer.weight_m = BasicParamBuffer<Real>();
+        layer.weight_v = BasicParamBuffer<Real>();
+        layer.bias_m = BasicParamBuffer<Real>();
+        layer.bias_v = BasicParamBuffer<Real>();
+    }
+    init_optimizer_state(network);
+}
+
+template <typename Real>
+OptimizerStep begin_optimizer_step(BasicNetwork<Real>& network, double learning_rate) {
+    init_optimizer_state(network);
+    const OptimizerConfig& config = network.optimizer;
+    OptimizerStep step;
+    step.kind = config.kind;
+    step.learning_rate = learning_rate;
+    if (config.kind == OptimizerKind::Sgd) return step;
+    
+    network.optimizer_step++;
+    step.momentum = config.momentum;
+    step.beta1 = config.beta1;
+    step.beta2 = config.beta2;
+    // lr * m_hat / (sqrt(v_hat) + eps) == rate * m / (sqrt(v) + epsilon)
+    double t = static_cast<double>(network.optimizer_step);
+    double correction1 = 1.0 - std::pow(config.beta1, t);
+    double correction2 = std::sqrt(1.0 - std::pow(config.beta2, t));
+    step.rate = learning_rate * correction2 / correction1;
+    step.epsilon = config.epsilon * correction2;
+    if (config.kind == OptimizerKind::AdamW) {
+        step.decay = learning_rate * config.weight_decay;
+    }
+    return step;
+}
+
+template <typename Real>
+void optimizer_update(const OptimizerStep& step, size_t n, const Real* grad, Real* w, Real* m, Real* v) {
+    switch (step.kind) {
+        case OptimizerKind::Sgd:
+            sgd_update(n, step.learning_rate, grad, w);
+            break;
+        case OptimizerKind::Momentum:
+        case OptimizerKind::Nesterov:
+            momentum_update(n, step.learning_rate, step.momentum, step.kind == OptimizerKind::Nesterov, grad, w, m);
+            break;
+        case OptimizerKind::Adam:
+        case OptimizerKind::AdamW:
+            adam_update(n, step.rate, step.beta1, step.beta2, step.epsilon, step.decay, grad, w, m, v);
+            break;
+    }
+}
+
+#define INSTANTIATE_OPTIMIZER(Real) \
+    template void init_optimizer_state(BasicNetwork<Real>&); \
+    template void reset_optimizer(BasicNetwork<Real>&, OptimizerKind); \
+    template OptimizerStep begin_optimizer_step(BasicNetwork<Real>&, double); \
+    template void optimizer_update(const OptimizerStep&, size_t, const Real*, Real*, Real*, Real*);
+
+INSTANTIATE_OPTIMIZER(double)
+INSTANTIATE_OPTIMIZER(float)
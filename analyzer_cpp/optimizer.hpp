@@ -0,0 +1,33 @@
+#pragma once
+#include "model.hpp"
+#include <cstddef>
+
+// Constants of one optimizer step, shared by every parameter it updates
+struct OptimizerStep {
+    OptimizerKind kind = OptimizerKind::Sgd;
+    double learning_rate = 0.0;
+    double momentum = 0.0;
+    double beta1 = 0.0;
+    double beta2 = 0.0;
+    // Adam's bias corrections, folded into the step size and epsilon
+    double rate = 0.0;
+    double epsilon = 0.0;
+    // learning_rate * weight_decay under AdamW, 0 otherwise
+    double decay = 0.0;
+};
+
+// Sizes the state buffers the network's optimizer needs, zeroed, and drops
+// the others. State that already has the right size is kept for resuming.
+template <typename Real>
+void init_optimizer_state(BasicNetwork<Real>& network);
+// Switches to another optimizer, starting from fresh state
+template <typename Real>
+void reset_optimizer(BasicNetwork<Real>& network, OptimizerKind kind);
+// Counts one more update and computes its constants, sizing the state first
+// if it does not match the optimizer
+template <typename Real>
+OptimizerStep begin_optimizer_step(BasicNetwork<Real>& network, double learning_rate);
+// Applies grad to n parameters w with their state m and v in one fused pass.
+// m and v may be null when the optimizer does not use them.
+template <typename Real>
+void optimizer_update(const OptimizerStep& step, size_t n, const Real* grad, Real* w, Real* m, Real* v);
@@ -1,4 +1,5 @@
 #include "parsor.hpp"
+#include "profiler.hpp"
 #include <iostream>
 #include <stdexcept>
 #include <cstdlib>
@@ -6,13 +7,43 @@
 AnalyzerArgs parse_analyzer_arguments(int argc, char* argv[]) {
     if (argc >= 2 && (std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h")) {
         std::cout << "USAGE\n"
-                  << "    ./my_torch_analyzer [--predict | --train [--save SAVEFILE]] LOADFILE FILE\n\n"
+                  << "    ./my_torch_analyzer [--predict [--cache N] | --train [--save SAVEFILE] [--batch-size N] [--seed S] [--stream [--shuffle-buffer N]] [--optimizer O [--momentum M] [--weight-decay W]] [--checkpoint-every N] [--checkpoint-minutes M] [--checkpoint FILE] [--resume] [--validation VFILE | --val-split F] [--verify-cache]] [--threads N] [--precision P] [--profile] [--trace TFILE] LOADFILE FILE\n"
+                  << "    ./my_torch_analyzer --serve [--max-batch N] [--max-delay US] [--threads N] [--precision P] [--cache N] LOADFILE SOCKET\n"
+                  << "    ./my_torch_analyzer --sweep [--batch-size N] [--seed S] [--optimizer O] [--validation VFILE | --val-split F] [--threads N] [--precision P] LOADFILE... FILE\n"
+                  << "    ./my_torch_analyzer --convert [--precision P] LOADFILE OUTFILE\n"
+                  << "    ./my_torch_analyzer --quantize --save SAVEFILE [--validation VFILE] LOADFILE FILE\n\n"
                   << "DESCRIPTION\n"
-                  << "    --train     Launch in training mode. FILE contains FEN positions and labels.\n"
-                  << "    --predict   Launch in prediction mode. FILE contains FEN positions.\n"
-                  << "    --save      Save network to SAVEFILE (train mode only).\n"
-                  << "    LOADFILE    File containing the neural network.\n"
-                  << "    FILE        File containing chessboards in FEN notation.\n";
+                  << "    --train         Launch in training mode. FILE contains FEN positions and labels.\n"
+                  << "    --predict       Launch in prediction mode. FILE contains FEN positions.\n"
+                  << "    --convert       Rewrite LOADFILE as OUTFILE (binary if it ends in .nnb, JSON otherwise).\n"
+                  << "    --quantize      Write an int8 copy of LOADFILE to SAVEFILE, calibrated on FILE.\n"
+                  << "    --sweep         Train every LOADFILE on FILE, loaded once, and rank them by validation accuracy.\n"
+                  << "    --serve         Answer FEN lines sent to the Unix socket SOCKET (- for stdin/stdout).\n"
+                  << "    --save          Save network to SAVEFILE (train and quantize modes).\n"
+                  << "    --batch-size    Train on mini-batches of N samples (default: 1, online SGD).\n"
+                  << "    --threads       Worker threads for training and prediction (0: all cores, default: 1).\n"
+                  << "                    With --sweep, networks trained at the same time, one per thread.\n"
+                  << "    --seed          Seed the shuffling RNG so that runs are reproducible.\n"
+                  << "    --stream        Read training samples from disk in shards instead of loading them all.\n"
+                  << "    --shuffle-buffer Samples in the --stream shuffle window (default: 65536).\n"
+                  << "    --precision     Weights and math in fp32 or fp64 (default: as stored in LOADFILE).\n"
+                  << "    --optimizer     sgd, momentum, nesterov, adam or adamw (default: as stored in LOADFILE).\n"
+                  << "    --momentum      Momentum of the momentum and nesterov optimizers (default: 0.9).\n"
+                  << "    --weight-decay  Decoupled weight decay of adamw (default: 0.01).\n"
+                  << "    --checkpoint-every Save a checkpoint every N optimizer steps.\n"
+                  << "    --checkpoint-minutes Save a checkpoint every M minutes.\n"
+                  << "    --checkpoint    Checkpoint file (default: SAVEFILE.ckpt).\n"
+                  << "    --resume        Continue the training run saved in the checkpoint.\n"
+                  << "    --validation    Score the network on the labelled VFILE after every epoch (--quantize: report accuracy on VFILE instead of FILE).\n"
+                  << "    --val-split     Hold out a fraction F of FILE as the validation set (--sweep default: 0.1).\n"
+                  << "    --verify-cache  Rehash the .nnd cache of FILE (and VFILE) against its checksum before using it.\n"
+                  << "    --max-batch     Requests scored together by --serve (default: 64).\n"
+                  << "    --max-delay     Microseconds a --serve request waits for a fuller batch (default: 200).\n"
+                  << "    --cache         Remember the outputs of up to N positions (predict and serve).\n"
+                  << "    --profile       Print the time spent in each phase and layer (make PROFILE=1 builds).\n"
+                  << "    --trace         Also write a Chrome trace-event file TFILE (implies --profile).\n"
+                  << "    LOADFILE        File containing the neural network (JSON, binary .nnb or int8 .nnq).\n"
+                  << "    FILE            File containing chessboards in FEN notation.\n";
         std::exit(0);
     }
     
@@ -22,6 +53,28 @@ AnalyzerArgs parse_analyzer_arguments(int argc, char* argv[]) {
     args.data_file = "";
     args.save_file = "";
     args.debug_mode = false;
+    args.batch_size = 1;
+    args.threads = 1;
+    args.has_seed = false;
+    args.seed = 0;
+    args.stream = false;
+    args.shuffle_buffer = 0;
+    args.precision = "";
+    args.optimizer = "";
+    args.momentum = -1.0;
+    args.weight_decay = -1.0;
+    args.checkpoint_file = "";
+    args.checkpoint_every = 0;
+    args.checkpoint_minutes = 0.0;
+    args.resume = false;
+    args.validation_file = "";
+    args.val_split = 0.0;
+    args.max_batch = 0;
+    args.max_delay_us = -1;
+    args.cache_size = 0;
+    args.verify_cache = false;
+    args.profile = false;
+    args.trace_file = "";
     
     int i = 1;
     while (i < argc) {
@@ -31,18 +84,180 @@ AnalyzerArgs parse_analyzer_arguments(int argc, char* argv[]) {
             args.mode = "train";
         } else if (arg == "--predict") {
             args.mode = "predict";
+        } else if (arg == "--convert") {
+            args.mode = "convert";
+        } else if (arg == "--quantize") {
+            args.mode = "quantize";
+        } else if (arg == "--serve") {
+            args.mode = "serve";
+        } else if (arg == "--sweep") {
+            args.mode = "sweep";
         } else if (arg == "--save") {
             if (i + 1 >= argc) {
                 throw std::runtime_error("--save requires a filename");
             }
             args.save_file = argv[i + 1];
             i++;
+        } else if (arg == "--batch-size") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--batch-size requires a value");
+            }
+            args.batch_size = std::atoi(argv[i + 1]);
+            if (args.batch_size <= 0) {
+                throw std::runtime_error("--batch-size must be > 0");
+            }
+            i++;
+        } else if (arg == "--threads") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--threads requires a value");
+            }
+            args.threads = std::atoi(argv[i + 1]);
+            if (args.threads < 0) {
+                throw std::runtime_error("--threads must be >= 0");
+            }
+            i++;
+        } else if (arg == "--seed") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--seed requires a value");
+            }
+            args.seed = std::strtoul(argv[i + 1], nullptr, 10);
+            args.has_seed = true;
+            i++;
+        } else if (arg == "--stream") {
+            args.stream = true;
+        } else if (arg == "--shuffle-buffer") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--shuffle-buffer requires a value");
+            }
+            args.shuffle_buffer = std::atoi(argv[i + 1]);
+            if (args.shuffle_buffer <= 0) {
+                throw std::runtime_error("--shuffle-buffer must be > 0");
+            }
+            i++;
+        } else if (arg == "--precision") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--precision requires a value");
+            }
+            args.precision = argv[i + 1];
+            if (args.precision != "fp32" && args.precision != "fp64") {
+                throw std::runtime_error("--precision must be fp32 or fp64");
+            }
+            i++;
+        } else if (arg == "--optimizer") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--optimizer requires a value");
+            }
+            args.optimizer = argv[i + 1];
+            if (args.optimizer != "sgd" && args.optimizer != "momentum" && args.optimizer != "nesterov"
+                && args.optimizer != "adam" && args.optimizer != "adamw") {
+                throw std::runtime_error("--optimizer must be sgd, momentum, nesterov, adam or adamw");
+            }
+            i++;
+        } else if (arg == "--momentum") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--momentum requires a value");
+            }
+            args.momentum = std::atof(argv[i + 1]);
+            if (args.momentum < 0.0 || args.momentum >= 1.0) {
+                throw std::runtime_error("--momentum must be in [0, 1)");
+            }
+            i++;
+        } else if (arg == "--weight-decay") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--weight-decay requires a value");
+            }
+            args.weight_decay = std::atof(argv[i + 1]);
+            if (args.weight_decay < 0.0) {
+                throw std::runtime_error("--weight-decay must be >= 0");
+            }
+            i++;
+        } else if (arg == "--checkpoint") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--checkpoint requires a filename");
+            }
+            args.checkpoint_file = argv[i + 1];
+            i++;
+        } else if (arg == "--checkpoint-every") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--checkpoint-every requires a value");
+            }
+            args.checkpoint_every = std::atoi(argv[i + 1]);
+            if (args.checkpoint_every <= 0) {
+                throw std::runtime_error("--checkpoint-every must be > 0");
+            }
+            i++;
+        } else if (arg == "--checkpoint-minutes") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--checkpoint-minutes requires a value");
+            }
+            args.checkpoint_minutes = std::atof(argv[i + 1]);
+            if (args.checkpoint_minutes <= 0.0) {
+                throw std::runtime_error("--checkpoint-minutes must be > 0");
+            }
+            i++;
+        } else if (arg == "--resume") {
+            args.resume = true;
+        } else if (arg == "--validation") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--validation requires a filename");
+            }
+            args.validation_file = argv[i + 1];
+            i++;
+        } else if (arg == "--val-split") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--val-split requires a value");
+            }
+            args.val_split = std::atof(argv[i + 1]);
+            if (args.val_split <= 0.0 || args.val_split >= 1.0) {
+                throw std::runtime_error("--val-split must be in (0, 1)");
+            }
+            i++;
+        } else if (arg == "--max-batch") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--max-batch requires a value");
+            }
+            args.max_batch = std::atoi(argv[i + 1]);
+            if (args.max_batch <= 0) {
+                throw std::runtime_error("--max-batch must be > 0");
+            }
+            i++;
+        } else if (arg == "--max-delay") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--max-delay requires a value");
+            }
+            args.max_delay_us = std::atoi(argv[i + 1]);
+            if (args.max_delay_us < 0) {
+                throw std::runtime_error("--max-delay must be >= 0");
+            }
+            i++;
+        } else if (arg == "--cache") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--cache requires a value");
+            }
+            args.cache_size = std::atoi(argv[i + 1]);
+            if (args.cache_size <= 0) {
+                throw std::runtime_error("--cache must be > 0");
+            }
+            i++;
+        } else if (arg == "--verify-cache") {
+            args.verify_cache = true;
+        } else if (arg == "--profile") {
+            args.profile = true;
+        } else if (arg == "--trace") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--trace requires a value");
+            }
+            args.trace_file = argv[i + 1];
+            args.profile = true;
+            i++;
         } else if (args.load_file.empty()) {
             args.load_file = arg;
         } else if (args.data_file.empty()) {
             args.data_file = arg;
         } else if (arg == "--mode=debug") {
             args.debug_mode = true;
+        } else {
+            args.sweep_files.push_back(arg);
         }
         i++;
     }
@@ -51,9 +266,68 @@ AnalyzerArgs parse_analyzer_arguments(int argc, char* argv[]) {
         throw std::runtime_error("Missing required arguments");
     }
     
+    if (args.shuffle_buffer > 0 && !args.stream) {
+        throw std::runtime_error("--shuffle-buffer requires --stream");
+    }
+    if (args.shuffle_buffer == 0) {
+        args.shuffle_buffer = 65536;
+    }
+    
+    // The last file of a sweep is the data, every one before it a network
+    if (args.mode == "sweep") {
+        args.sweep_files.insert(args.sweep_files.begin(), {args.load_file, args.data_file});
+        args.data_file = args.sweep_files.back();
+        args.sweep_files.pop_back();
+        if (!args.save_file.empty()) {
+            throw std::runtime_error("--sweep saves each network over its own file, --save cannot be used");
+        }
+        if (args.stream || args.resume || args.checkpoint_every > 0 || args.checkpoint_minutes > 0) {
+            throw std::runtime_error("--sweep cannot be used with --stream, --resume or checkpoints");
+        }
+        if (args.validation_file.empty() && args.val_split == 0.0) {
+            args.val_split = 0.1;
+        }
+    } else {
+        args.sweep_files.clear();
+    }
+    
+    // Quantizing over LOADFILE would lose the floating-point weights
+    if (args.mode == "quantize" && args.save_file.empty()) {
+        throw std::runtime_error("--quantize requires --save");
+    }
+    
     if (args.save_file.empty()) {
         args.save_file = args.load_file;
     }
     
+    if (args.resume && args.mode != "train") {
+        throw std::runtime_error("--resume requires --train");
+    }
+    if (!args.validation_file.empty() && args.val_split > 0.0) {
+        throw std::runtime_error("--validation and --val-split cannot be combined");
+    }
+    // Streamed samples are never all in memory to be split
+    if (args.val_split > 0.0 && args.stream) {
+        throw std::runtime_error("--val-split cannot be used with --stream, use --validation");
+    }
+    if ((args.max_batch > 0 || args.max_delay_us >= 0) && args.mode != "serve") {
+        throw std::runtime_error("--max-batch and --max-delay require --serve");
+    }
+    if (args.cache_size > 0 && args.mode != "predict" && args.mode != "serve") {
+        throw std::runtime_error("--cache requires --predict or --serve");
+    }
+    if (args.profile && !profile_available()) {
+        throw std::runtime_error("--profile and --trace require a build with make PROFILE=1");
+    }
+    if (args.max_batch == 0) {
+        args.max_batch = 64;
+    }
+    if (args.max_delay_us < 0) {
+        args.max_delay_us = 200;
+    }
+    if (args.checkpoint_file.empty()) {
+        args.checkpoint_file = args.save_file + ".ckpt";
+    }
+    
     return args;
 }
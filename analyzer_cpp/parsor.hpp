@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <map>
+#include <vector>
 
 struct AnalyzerArgs {
     std::string mode;
@@ -8,6 +9,43 @@ struct AnalyzerArgs {
     std::string data_file;
     std::string save_file;
     bool debug_mode;
+    int batch_size;
+    int threads;
+    bool has_seed;
+    unsigned long seed;
+    // Train from disk through a shuffle window instead of loading every sample
+    bool stream;
+    int shuffle_buffer;
+    // "fp32" or "fp64", empty to keep the precision stored in the network file
+    std::string precision;
+    // Optimizer name, empty to keep the one stored in the network file
+    std::string optimizer;
+    // Negative to keep the stored hyperparameters
+    double momentum;
+    double weight_decay;
+    // SAVEFILE.ckpt unless given
+    std::string checkpoint_file;
+    // Checkpoint every N optimizer steps and/or M minutes, 0 for never
+    int checkpoint_every;
+    double checkpoint_minutes;
+    // Continue the run saved in checkpoint_file
+    bool resume;
+    // Held-out samples scored after every epoch: a labelled file, or a
+    // fraction of the training data (0 for none)
+    std::string validation_file;
+    double val_split;
+    // --serve: requests scored together, and how long the first may wait
+    int max_batch;
+    int max_delay_us;
+    // Positions remembered by --predict and --serve, 0 for no cache
+    int cache_size;
+    // Rehash .nnd dataset caches against their checksum before using them
+    bool verify_cache;
+    // Print per-phase timings (builds with make PROFILE=1), and write a trace when trace_file is set
+    bool profile;
+    std::string trace_file;
+    // --sweep: the networks trained against data_file
+    std::vector<std::string> sweep_files;
 };
 
 AnalyzerArgs parse_analyzer_arguments(int argc, char* argv[]);
@@ -0,0 +1,305 @@
+#pragma once
+#include "profiler.hpp"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Bounded multi-producer multi-consumer ring buffer. Each cell carries a
+// sequence number telling whether it is ready to be written or read, so
+// producers and consumers only compete on one atomic counter each.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells = std::vector<Cell>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+    
+    // Moves value in; false if the queue is full
+    bool try_push(T& value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    // Moves the oldest value out; false if the queue is empty
+    bool try_pop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos + 1) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos + 1) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    
+    std::vector<Cell> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<size_t> head{0};
+};
+
+// Backs off from busy polling to short sleeps when a queue stays full or empty
+inline void pipeline_wait(size_t& attempts) {
+    if (++attempts < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(attempts < 256 ? 50 : 1000));
+    }
+}
+
+// Calls fn on each line of text, like std::getline would split it
+template <typename Fn>
+void for_each_line(const std::string& text, Fn fn) {
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        fn(std::string_view(text.data() + start, end - start));
+        start = end + 1;
+    }
+}
+
+// Reads a text file in blocks of whole lines on a background thread and hands
+// them to parser threads; the parsed chunks come out of next() in file order.
+// Reading, parsing and whatever the caller does with a chunk all overlap.
+// Parsers stay less than 2 * num_parsers blocks ahead of next(), so a slow
+// block holds back the others instead of letting finished ones pile up.
+template <typename Chunk>
+class ParsePipeline {
+public:
+    using Parser = std::function<void(const std::string& text, Chunk& chunk)>;
+    
+    ParsePipeline(const std::string& path, size_t chunk_bytes, size_t num_parsers, Parser parse)
+        : file(path, std::ios::binary), chunk_bytes(chunk_bytes), num_parsers(num_parsers), max_ahead(2 * num_parsers), parse(std::move(parse)), raw(2 * num_parsers), parsed(2 * num_parsers) {
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open data file: " + path);
+        }
+        parsers_left = num_parsers;
+        reader = std::thread(&ParsePipeline::read_loop, this);
+        for (size_t i = 0; i < num_parsers; i++) {
+            parsers.emplace_back(&ParsePipeline::parse_loop, this);
+        }
+    }
+    
+    ~ParsePipeline() {
+        stopping = true;
+        reader.join();
+        for (auto& parser : parsers) {
+            parser.join();
+        }
+    }
+    
+    ParsePipeline(const ParsePipeline&) = delete;
+    ParsePipeline& operator=(const ParsePipeline&) = delete;
+    
+    // False once the whole file has been returned. Errors of the background
+    // threads are rethrown here.
+    bool next(Chunk& chunk) {
+        PROFILE_SCOPE("wait for chunk");
+        size_t attempts = 0;
+        while (true) {
+            auto it = pending.find(next_index.load(std::memory_order_relaxed));
+            if (it != pending.end()) {
+                chunk = std::move(it->second);
+                pending.erase(it);
+                next_index.fetch_add(1, std::memory_order_release);
+                return true;
+            }
+            
+            Parsed item;
+            if (parsed.try_pop(item)) {
+                pending.emplace(item.index, std::move(item.chunk));
+                attempts = 0;
+                continue;
+            }
+            // Parsers publish before leaving, so an empty queue afterwards is final
+            bool finished = parsers_left == 0;
+            if (finished && parsed.try_pop(item)) {
+                pending.emplace(item.index, std::move(item.chunk));
+                continue;
+            }
+            if (failed) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                std::rethrow_exception(error);
+            }
+            if (finished) return false;
+            pipeline_wait(attempts);
+        }
+    }
+
+private:
+    struct Lines {
+        size_t index = 0;
+        std::string text;
+        bool last = false;
+    };
+    struct Parsed {
+        size_t index = 0;
+        Chunk chunk;
+    };
+    
+    void fail() {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed) {
+            error = std::current_exception();
+            failed = true;
+        }
+    }
+    
+    template <typename T>
+    bool push(BoundedQueue<T>& queue, T& item) {
+        size_t attempts = 0;
+        while (!queue.try_push(item)) {
+            if (stopping || failed) return false;
+            pipeline_wait(attempts);
+        }
+        return true;
+    }
+    
+    // Waits until block index is less than max_ahead blocks past the next one
+    // to be returned. That block was taken from raw first, so it never waits.
+    bool wait_for_turn(size_t index) {
+        size_t attempts = 0;
+        while (index >= next_index.load(std::memory_order_acquire) + max_ahead) {
+            if (stopping || failed) return false;
+            pipeline_wait(attempts);
+        }
+        return true;
+    }
+    
+    void read_loop() {
+        try {
+            size_t index = 0;
+            std::string carry;
+            bool more = true;
+            while (more) {
+                Lines item;
+                item.text = std::move(carry);
+                carry.clear();
+                size_t used = item.text.size();
+                item.text.resize(used + chunk_bytes);
+                {
+                    PROFILE_SCOPE("read file");
+                    file.read(&item.text[used], chunk_bytes);
+                }
+                item.text.resize(used + file.gcount());
+                more = static_cast<size_t>(file.gcount()) == chunk_bytes;
+                
+                // The partial line at the end goes with the next block
+                if (more) {
+                    size_t cut = item.text.rfind('\n');
+                    if (cut == std::string::npos) {
+                        carry = std::move(item.text);
+                        continue;
+                    }
+                    carry.assign(item.text, cut + 1, std::string::npos);
+                    item.text.resize(cut + 1);
+                }
+                item.index = index++;
+                // One end marker per parser
+                item.last = !more;
+                if (!push(raw, item)) return;
+            }
+            for (size_t i = 1; i < num_parsers; i++) {
+                Lines end;
+                end.index = index;
+                end.last = true;
+                if (!push(raw, end)) return;
+            }
+        } catch (...) {
+            fail();
+        }
+    }
+    
+    void parse_loop() {
+        try {
+            size_t attempts = 0;
+            while (!stopping && !failed) {
+                Lines item;
+                if (!raw.try_pop(item)) {
+                    pipeline_wait(attempts);
+                    continue;
+                }
+                attempts = 0;
+                if (!item.text.empty()) {
+                    if (!wait_for_turn(item.index)) break;
+                    Parsed out;
+                    out.index = item.index;
+                    parse(item.text, out.chunk);
+                    if (!push(parsed, out)) break;
+                }
+                if (item.last) break;
+            }
+        } catch (...) {
+            fail();
+        }
+        parsers_left--;
+    }
+    
+    std::ifstream file;
+    size_t chunk_bytes;
+    size_t num_parsers;
+    size_t max_ahead;
+    Parser parse;
+    BoundedQueue<Lines> raw;
+    BoundedQueue<Parsed> parsed;
+    
+    std::thread reader;
+    std::vector<std::thread> parsers;
+    std::atomic<size_t> parsers_left{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    
+    // Consumer side: chunks finished ahead of their turn, at most max_ahead
+    std::map<size_t, Chunk> pending;
+    // Written by the consumer only; parsers read it to wait for their turn
+    std::atomic<size_t> next_index{0};
+};
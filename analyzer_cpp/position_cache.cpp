@@ -0,0 +1,77 @@
+#include "position_cache.hpp"
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+static uint64_t to_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double from_bits(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+PositionCache::PositionCache(size_t entries) {
+    size_t size = 1;
+    while (size < entries) size *= 2;
+    this->entries.reset(new Entry[size]);
+    mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        for (auto& value : this->entries[i].values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool PositionCache::find(uint64_t key, double* out, size_t size) const {
+    if (size > MAX_OUTPUTS) return false;
+    const Entry& entry = entries[key & mask];
+    uint64_t before = entry.sequence.load(std::memory_order_acquire);
+    if (before == 0 || (before & 1) != 0) return false;
+    if (entry.key.load(std::memory_order_relaxed) != key) return false;
+    
+    for (size_t i = 0; i < size; i++) {
+        out[i] = from_bits(entry.values[i].load(std::memory_order_relaxed));
+    }
+    // Nothing was overwritten while it was copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry.sequence.load(std::memory_order_relaxed) == before;
+}
+
+template <typename Real>
+void PositionCache::store(uint64_t key, const Real* values, size_t size) {
+    if (size > MAX_OUTPUTS) {
+        throw std::runtime_error("The position cache holds at most " + std::to_string(MAX_OUTPUTS) + " outputs");
+    }
+    Entry& entry = entries[key & mask];
+    uint64_t sequence = entry.sequence.load(std::memory_order_relaxed);
+    if ((sequence & 1) != 0 || !entry.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_relaxed)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    entry.key.store(key, std::memory_order_relaxed);
+    for (size_t i = 0; i < size; i++) {
+        entry.values[i].store(to_bits(static_cast<double>(values[i])), std::memory_order_relaxed);
+    }
+    entry.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void PositionCache::add_counts(uint64_t hits, uint64_t misses) {
+    hit_count.fetch_add(hits, std::memory_order_relaxed);
+    miss_count.fetch_add(misses, std::memory_order_relaxed);
+}
+
+void print_cache_stats(const PositionCache& cache, std::ostream& out) {
+    uint64_t total = cache.hits() + cache.misses();
+    double rate = total > 0 ? 100.0 * cache.hits() / total : 0.0;
+    out << "Cache: " << cache.hits() << " hits, " << cache.misses() << " misses ("
+        << std::fixed << std::setprecision(1) << rate << std::defaultfloat << "% hit rate)" << std::endl;
+}
+
+template void PositionCache::store<double>(uint64_t key, const double* values, size_t size);
+template void PositionCache::store<float>(uint64_t key, const float* values, size_t size);
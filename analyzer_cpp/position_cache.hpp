@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+// Output probabilities of positions already scored, keyed by hash_fen and
+// shared by any number of threads without locks. Direct-mapped: a new
+// position replaces whatever shared its slot. Each slot is one cache line
+// guarded by a sequence number, so a reader never sees half of a write.
+class PositionCache {
+public:
+    static const size_t MAX_OUTPUTS = 6;
+    
+    // entries is rounded up to a power of two
+    explicit PositionCache(size_t entries);
+    
+    PositionCache(const PositionCache&) = delete;
+    PositionCache& operator=(const PositionCache&) = delete;
+    
+    // Copies the size outputs stored for key into out; false on a miss
+    bool find(uint64_t key, double* out, size_t size) const;
+    // Skipped when another thread is writing the same slot
+    template <typename Real>
+    void store(uint64_t key, const Real* values, size_t size);
+    
+    // Callers count lookups locally and add them here once in a while
+    void add_counts(uint64_t hits, uint64_t misses);
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+    size_t size() const { return mask + 1; }
+
+private:
+    struct alignas(64) Entry {
+        // Odd while being written, 0 until first written
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> key{0};
+        // Bit patterns of the doubles
+        std::atomic<uint64_t> values[MAX_OUTPUTS];
+    };
+    
+    std::unique_ptr<Entry[]> entries;
+    size_t mask;
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> miss_count{0};
+};
+
+// "Cache: H hits, M misses (R% hit rate)"
+void print_cache_stats(const PositionCache& cache, std::ostream& out);
@@ -1,85 +1,249 @@
 #include "predict.hpp"
 #include "fen_parser.hpp"
 #include "network.hpp"
-#include <fstream>
-#include <sstream>
+#include "quantize.hpp"
+#include "thread_pool.hpp"
+#include "pipeline.hpp"
+#include "position_cache.hpp"
+#include "profiler.hpp"
+#include <algorithm>
 #include <iostream>
 
-void predict_model(const AnalyzerArgs& args, json::Value& network) {
-    std::ifstream file(args.data_file);
-    if (!file.is_open()) {
-        throw std::runtime_error("Cannot open data file: " + args.data_file);
+// Bytes of input parsed together by one parser thread, then evaluated across the workers
+static const size_t CHUNK_BYTES = 1 << 18;
+// Positions evaluated together by one forward_batch call
+static const size_t PREDICT_BATCH = 128;
+
+struct PredictionSlot {
+    // Side to move, all that is kept of the FEN once it is encoded
+    std::string turn;
+    std::string expected;
+    bool has_expected = false;
+    std::string prediction;
+    std::string error;
+};
+
+struct PredictChunk {
+    std::vector<PredictionSlot> slots;
+    // Features of the slots that parsed, listed in rows
+    SparseBatch inputs;
+    std::vector<size_t> rows;
+    // Cache keys of the rows, when caching
+    std::vector<uint64_t> keys;
+};
+
+// Per-worker buffers, reused for every batch
+template <typename Cache>
+struct PredictScratch {
+    Cache cache;
+    SparseBatch inputs;
+    std::vector<size_t> rows;
+    std::vector<uint64_t> keys;
+};
+
+// Words of text separated by single spaces
+static std::string join_fields(std::string_view text) {
+    std::string joined;
+    std::string_view word;
+    while (split_fields(text, &word, 1) > 0) {
+        if (!joined.empty()) joined += ' ';
+        joined += word;
+        text.remove_prefix(word.data() + word.size() - text.data());
     }
-    
-    int total = 0;
-    int correct = 0;
-    std::string line;
-    
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
+    return joined;
+}
+
+// Runs on the pipeline's parser threads. Positions found in the cache are
+// answered here and never encoded.
+static void parse_chunk(const std::string& text, PredictChunk& chunk, PositionCache* cache, size_t output_size) {
+    PROFILE_SCOPE("parse FEN");
+    size_t lines = std::count(text.begin(), text.end(), '\n') + 1;
+    chunk.slots.reserve(lines);
+    chunk.rows.reserve(lines);
+    uint64_t hits = 0;
+    double probabilities[PositionCache::MAX_OUTPUTS];
+    for_each_line(text, [&](std::string_view line) {
+        if (line.empty()) return;
+        chunk.slots.emplace_back();
+        PredictionSlot& slot = chunk.slots.back();
         
-        std::istringstream iss(line);
-        std::vector<std::string> parts;
-        std::string word;
-        while (iss >> word) {
-            parts.push_back(word);
+        // FEN (6 fields) + expected label
+        std::string_view parts[7];
+        int fields = split_fields(line, parts, 7);
+        if (fields > 1) {
+            slot.turn = parts[1];
+        }
+        if (fields >= 7) {
+            slot.expected = join_fields(line.substr(parts[6].data() - line.data()));
+            slot.has_expected = true;
         }
         
-        std::string fen;
-        std::string expected;
-        bool has_expected = false;
-        
-        if (parts.size() >= 7) {
-            fen = parts[0] + " " + parts[1] + " " + parts[2] + " " + 
-                  parts[3] + " " + parts[4] + " " + parts[5];
-            
-            for (size_t i = 6; i < parts.size(); i++) {
-                if (i > 6) expected += " ";
-                expected += parts[i];
-            }
-            has_expected = true;
+        // With a cache, the key comes from the same walk as the features
+        uint16_t active[FEN_MAX_FEATURES];
+        int count;
+        uint64_t key = 0;
+        bool valid = cache ? encode_fen_features(line, active, count, key) : encode_fen_features(line, active, count);
+        if (valid && cache && cache->find(key, probabilities, output_size)) {
+            slot.prediction = format_prediction(slot.turn, probabilities, output_size);
+            hits++;
+            return;
+        }
+        if (valid) {
+            chunk.inputs.add(active, active + count);
+            chunk.rows.push_back(chunk.slots.size() - 1);
+            if (cache) chunk.keys.push_back(key);
         } else {
-            fen = line;
+            std::string fen = fields >= 7 ? join_fields(line.substr(0, parts[5].data() + parts[5].size() - line.data())) : std::string(line);
+            slot.error = "Invalid FEN: " + fen;
+        }
+    });
+    if (cache) {
+        cache->add_counts(hits, chunk.rows.size());
+    }
+}
+
+std::unique_ptr<PositionCache> make_position_cache(const AnalyzerArgs& args, size_t output_size) {
+    if (args.cache_size == 0) return nullptr;
+    if (output_size > PositionCache::MAX_OUTPUTS) {
+        throw std::runtime_error("--cache needs a network with at most " + std::to_string(PositionCache::MAX_OUTPUTS) + " outputs");
+    }
+    return std::make_unique<PositionCache>(args.cache_size);
+}
+
+template <typename Real>
+std::string format_prediction(const std::string& turn, const Real* output, size_t size) {
+    std::string prediction = vector_to_label(std::vector<double>(output, output + size));
+    
+    // Add color for Check/Checkmate
+    if (prediction == "Check" || prediction == "Checkmate") {
+        if (!turn.empty()) {
+            std::string color = (turn == "W" || turn == "w") ? "White" : "Black";
+            prediction = prediction + " " + color;
         }
+    }
+    
+    return prediction;
+}
+
+template <typename Model, typename Cache>
+static void evaluate_batch(const Model& network, std::vector<PredictionSlot>& slots, PredictScratch<Cache>& scratch, PositionCache* cache) {
+    const size_t output_size = network.layers.back().outputs;
+    const size_t count = scratch.rows.size();
+    if (count == 0) return;
+    PROFILE_SCOPE("evaluate batch");
+    
+    const auto& output = forward_batch_sparse(network, scratch.inputs, scratch.cache);
+    for (size_t b = 0; b < count; b++) {
+        PredictionSlot& slot = slots[scratch.rows[b]];
+        slot.prediction = format_prediction(slot.turn, &output[b * output_size], output_size);
+        if (cache) {
+            cache->store(scratch.keys[b], &output[b * output_size], output_size);
+        }
+    }
+    
+    scratch.rows.clear();
+    scratch.keys.clear();
+    scratch.inputs.clear();
+}
+
+// Evaluates the parsed rows [begin, end) of a chunk
+template <typename Model, typename Cache>
+static void evaluate_rows(const Model& network, PredictChunk& chunk, size_t begin, size_t end, PredictScratch<Cache>& scratch, PositionCache* cache) {
+    scratch.rows.clear();
+    scratch.keys.clear();
+    scratch.inputs.clear();
+    
+    const auto& indices = chunk.inputs.indices;
+    const auto& offsets = chunk.inputs.offsets;
+    for (size_t r = begin; r < end; r++) {
+        scratch.inputs.add(indices.begin() + offsets[r], indices.begin() + offsets[r + 1]);
+        scratch.rows.push_back(chunk.rows[r]);
+        if (cache) scratch.keys.push_back(chunk.keys[r]);
         
-        try {
-            auto input = fen_to_vector(fen);
-            ForwardCache cache;
-            auto output = forward_pass(network, input, cache);
-            std::string prediction = vector_to_label(output);
-            
-            // Add color for Check/Checkmate
-            if (prediction == "Check" || prediction == "Checkmate") {
-                std::istringstream fen_iss(fen);
-                std::string board, turn;
-                fen_iss >> board >> turn;
-                if (!turn.empty()) {
-                    std::string color = (turn == "W" || turn == "w") ? "White" : "Black";
-                    prediction = prediction + " " + color;
-                }
+        if (scratch.rows.size() == PREDICT_BATCH) {
+            evaluate_batch(network, chunk.slots, scratch, cache);
+        }
+    }
+    evaluate_batch(network, chunk.slots, scratch, cache);
+}
+
+// Shared by the floating-point and quantized networks
+template <typename Cache, typename Model>
+static void run_predictions(const AnalyzerArgs& args, const Model& network) {
+    if (network.layers.front().inputs != FEN_INPUT_SIZE) {
+        throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+    }
+    
+    ThreadPool pool(resolve_thread_count(args.threads));
+    std::vector<PredictScratch<Cache>> scratch(pool.size());
+    const size_t output_size = network.layers.back().outputs;
+    std::unique_ptr<PositionCache> cache = make_position_cache(args, output_size);
+    
+    // A reader and parser threads prepare the next chunks while this one is evaluated
+    size_t parsers = std::max<size_t>(1, pool.size() / 2);
+    ParsePipeline<PredictChunk> pipeline(args.data_file, CHUNK_BYTES, parsers, [&](const std::string& text, PredictChunk& chunk) {
+        parse_chunk(text, chunk, cache.get(), output_size);
+    });
+    PredictChunk chunk;
+    
+    int total = 0;
+    int correct = 0;
+    
+    while (pipeline.next(chunk)) {
+        // One contiguous range per worker so each one keeps its own scratch
+        size_t count = chunk.rows.size();
+        size_t workers = std::min(pool.size(), count);
+        pool.run(workers, [&](size_t w) {
+            size_t begin = w * count / workers;
+            size_t end = (w + 1) * count / workers;
+            evaluate_rows(network, chunk, begin, end, scratch[w], cache.get());
+        });
+        
+        PROFILE_COUNT("positions", chunk.slots.size());
+        
+        // Results are written back in input order
+        PROFILE_SCOPE("write results");
+        for (const auto& slot : chunk.slots) {
+            if (!slot.error.empty()) {
+                std::cerr << "Error processing FEN: " << slot.error << std::endl;
+                continue;
             }
             
-            if (args.debug_mode && has_expected) {
+            if (args.debug_mode && slot.has_expected) {
                 total++;
-                bool is_correct = (prediction == expected);
+                bool is_correct = (slot.prediction == slot.expected);
                 if (is_correct) correct++;
                 
                 std::string status = is_correct ? "✓" : "✗";
-                std::cout << status << " " << prediction << " (expected: " << expected << ")" << std::endl;
+                std::cout << status << " " << slot.prediction << " (expected: " << slot.expected << ")\n";
             } else {
-                std::cout << prediction << std::endl;
+                std::cout << slot.prediction << "\n";
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error processing FEN: " << e.what() << std::endl;
         }
+        std::cout.flush();
     }
     
-    file.close();
-    
     if (args.debug_mode && total > 0) {
         double accuracy = (double)correct / total * 100.0;
         std::cout << "\n==================================================\n";
         std::cout << "Results: " << correct << "/" << total << " correct (" << accuracy << "%)\n";
         std::cout << "==================================================\n";
     }
+    if (cache) {
+        print_cache_stats(*cache, std::cerr);
+    }
+}
+
+template <typename Real>
+void predict_model(const AnalyzerArgs& args, BasicNetwork<Real>& network) {
+    run_predictions<BasicBatchCache<Real>>(args, network);
 }
+
+void predict_model(const AnalyzerArgs& args, const QuantizedNetwork& network) {
+    run_predictions<QuantizedCache>(args, network);
+}
+
+template void predict_model<double>(const AnalyzerArgs& args, Network& network);
+template void predict_model<float>(const AnalyzerArgs& args, BasicNetwork<float>& network);
+template std::string format_prediction<double>(const std::string& turn, const double* output, size_t size);
+template std::string format_prediction<float>(const std::string& turn, const float* output, size_t size);
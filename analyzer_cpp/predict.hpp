@@ -1,5 +1,17 @@
 #pragma once
 #include "parsor.hpp"
-#include "../include/json_parser.hpp"
+#include "model.hpp"
+#include "quantize.hpp"
+#include "position_cache.hpp"
+#include <memory>
+#include <string>
 
-void predict_model(const AnalyzerArgs& args, json::Value& network);
+// Label of an output row; turn is the FEN's side to move
+template <typename Real>
+std::string format_prediction(const std::string& turn, const Real* output, size_t size);
+// The --cache of predict and serve, null without one
+std::unique_ptr<PositionCache> make_position_cache(const AnalyzerArgs& args, size_t output_size);
+
+template <typename Real>
+void predict_model(const AnalyzerArgs& args, BasicNetwork<Real>& network);
+void predict_model(const AnalyzerArgs& args, const QuantizedNetwork& network);
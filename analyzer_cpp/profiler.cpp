@@ -0,0 +1,320 @@
+#include "profiler.hpp"
+#include "json_parser.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <sys/resource.h>
+
+// Events kept per thread for the trace; later ones are only counted
+static const size_t MAX_TRACE_EVENTS = 1 << 21;
+
+std::atomic<bool> profile_active{false};
+
+static std::atomic<uint64_t> allocation_count{0};
+static std::atomic<uint64_t> allocation_bytes{0};
+// Set while the profiler allocates for itself, which is not counted
+static thread_local bool profiler_allocating = false;
+
+class ProfilerAllocations {
+public:
+    ProfilerAllocations() : previous(profiler_allocating) { profiler_allocating = true; }
+    ~ProfilerAllocations() { profiler_allocating = previous; }
+
+private:
+    bool previous;
+};
+
+#ifdef MY_TORCH_PROFILE
+// Counts every operator new while profiling; new[] and delete[] forward here
+void* operator new(size_t size) {
+    if (profile_active.load(std::memory_order_relaxed) && !profiler_allocating) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+#endif
+
+struct ZoneTotals {
+    // Closed scopes of a timer, sum of a counter
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> nanoseconds{0};
+};
+
+struct TraceEvent {
+    int zone;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// Written by its own thread only; reports read the totals with relaxed loads
+// and the events once every worker is idle
+struct ThreadProfile {
+    int id = 0;
+    ZoneTotals zones[MAX_PROFILE_ZONES];
+    std::vector<TraceEvent> events;
+    uint64_t dropped = 0;
+};
+
+struct ProfileTotals {
+    uint64_t time = 0;
+    std::vector<uint64_t> calls;
+    std::vector<uint64_t> nanoseconds;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+};
+
+struct Profiler {
+    std::mutex mutex;
+    std::vector<std::string> names;
+    std::vector<bool> counters;
+    std::vector<std::unique_ptr<ThreadProfile>> threads;
+    bool tracing = false;
+    std::string trace_path;
+    ProfileTotals started;
+    ProfileTotals reported;
+};
+
+// Never destroyed: threads may still close scopes during exit
+static Profiler& profiler() {
+    static Profiler* instance = new Profiler;
+    return *instance;
+}
+
+static thread_local ThreadProfile* current_thread = nullptr;
+
+static ThreadProfile& thread_profile() {
+    if (!current_thread) {
+        Profiler& p = profiler();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        ProfilerAllocations own;
+        p.threads.push_back(std::make_unique<ThreadProfile>());
+        current_thread = p.threads.back().get();
+        current_thread->id = p.threads.size();
+    }
+    return *current_thread;
+}
+
+// Expects the lock to be held
+static int find_or_add_zone(Profiler& p, const std::string& name, bool counter) {
+    for (size_t i = 0; i < p.names.size(); i++) {
+        if (p.names[i] == name && p.counters[i] == counter) return i;
+    }
+    if (p.names.size() >= static_cast<size_t>(MAX_PROFILE_ZONES)) {
+        throw std::runtime_error("Too many profile zones");
+    }
+    p.names.push_back(name);
+    p.counters.push_back(counter);
+    return p.names.size() - 1;
+}
+
+int profile_zone(const char* name) {
+    Profiler& p = profiler();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    ProfilerAllocations own;
+    return find_or_add_zone(p, name, false);
+}
+
+int profile_counter(const char* name) {
+    Profiler& p = profiler();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    ProfilerAllocations own;
+    return find_or_add_zone(p, name, true);
+}
+
+int profile_layer_zones(const char* name) {
+    Profiler& p = profiler();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    ProfilerAllocations own;
+    // Added together, so the zones of one name are consecutive
+    int first = find_or_add_zone(p, std::string(name) + " L0", false);
+    for (size_t i = 1; i < MAX_PROFILE_LAYERS; i++) {
+        find_or_add_zone(p, std::string(name) + " L" + std::to_string(i), false);
+    }
+    return first;
+}
+
+void profile_record(int zone, uint64_t start, uint64_t end) {
+    ThreadProfile& thread = thread_profile();
+    ZoneTotals& totals = thread.zones[zone];
+    totals.calls.store(totals.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    totals.nanoseconds.store(totals.nanoseconds.load(std::memory_order_relaxed) + (end - start), std::memory_order_relaxed);
+    
+    if (!profiler().tracing) return;
+    if (thread.events.size() < MAX_TRACE_EVENTS) {
+        ProfilerAllocations own;
+        thread.events.push_back({zone, start, end - start});
+    } else {
+        thread.dropped++;
+    }
+}
+
+void profile_count(int counter, uint64_t amount) {
+    ZoneTotals& totals = thread_profile().zones[counter];
+    totals.calls.store(totals.calls.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static ProfileTotals current_totals() {
+    Profiler& p = profiler();
+    ProfileTotals totals;
+    std::lock_guard<std::mutex> lock(p.mutex);
+    totals.calls.assign(p.names.size(), 0);
+    totals.nanoseconds.assign(p.names.size(), 0);
+    for (const auto& thread : p.threads) {
+        for (size_t z = 0; z < p.names.size(); z++) {
+            totals.calls[z] += thread->zones[z].calls.load(std::memory_order_relaxed);
+            totals.nanoseconds[z] += thread->zones[z].nanoseconds.load(std::memory_order_relaxed);
+        }
+    }
+    totals.allocations = allocation_count.load(std::memory_order_relaxed);
+    totals.allocated_bytes = allocation_bytes.load(std::memory_order_relaxed);
+    totals.time = profile_now();
+    return totals;
+}
+
+static double peak_rss_mb() {
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    // Kilobytes on Linux
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Prints what happened between since and now, and returns now
+static ProfileTotals print_report(std::ostream& out, const std::string& title, const ProfileTotals& since) {
+    ProfileTotals now = current_totals();
+    Profiler& p = profiler();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    double seconds = (now.time - since.time) / 1e9;
+    
+    out << std::fixed << std::setprecision(3) << "Profile (" << title << "): " << seconds << " s";
+    std::vector<size_t> timers;
+    for (size_t z = 0; z < now.calls.size(); z++) {
+        uint64_t calls = now.calls[z] - (z < since.calls.size() ? since.calls[z] : 0);
+        if (calls == 0) continue;
+        if (p.counters[z]) {
+            out << std::setprecision(0) << ", " << calls << " " << p.names[z] << " (" << calls / seconds << "/s)";
+        } else {
+            timers.push_back(z);
+        }
+    }
+    out << std::setprecision(1) << ", " << (now.allocations - since.allocations) << " allocations ("
+        << (now.allocated_bytes - since.allocated_bytes) / 1048576.0 << " MB), peak RSS " << peak_rss_mb() << " MB" << std::endl;
+    
+    // Slowest zones first; nested zones are also part of their parents' time
+    auto elapsed = [&](size_t z) {
+        return now.nanoseconds[z] - (z < since.nanoseconds.size() ? since.nanoseconds[z] : 0);
+    };
+    std::sort(timers.begin(), timers.end(), [&](size_t a, size_t b) { return elapsed(a) > elapsed(b); });
+    for (size_t z : timers) {
+        uint64_t calls = now.calls[z] - (z < since.calls.size() ? since.calls[z] : 0);
+        out << "  " << std::left << std::setw(24) << p.names[z] << std::right << std::setprecision(3)
+            << std::setw(12) << elapsed(z) / 1e6 << " ms" << std::setw(12) << calls << " calls"
+            << std::setw(12) << elapsed(z) / 1e3 / calls << " us/call" << std::endl;
+    }
+    out << std::defaultfloat;
+    return now;
+}
+
+static void write_trace(std::ostream& out) {
+    Profiler& p = profiler();
+    std::ofstream file(p.trace_path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot write trace: " + p.trace_path);
+    }
+    
+    size_t written = 0;
+    uint64_t dropped = 0;
+    json::Writer writer(file);
+    writer.begin_object();
+    writer.key("traceEvents");
+    writer.begin_array();
+    for (const auto& thread : p.threads) {
+        for (const TraceEvent& event : thread->events) {
+            writer.begin_object();
+            writer.key("name");
+            writer.string(p.names[event.zone]);
+            writer.key("ph");
+            writer.string("X");
+            writer.key("ts");
+            writer.number((event.start - p.started.time) / 1e3);
+            writer.key("dur");
+            writer.number(event.duration / 1e3);
+            writer.key("pid");
+            writer.number(1.0);
+            writer.key("tid");
+            writer.number(static_cast<double>(thread->id));
+            writer.end_object();
+        }
+        written += thread->events.size();
+        dropped += thread->dropped;
+    }
+    writer.end_array();
+    writer.key("displayTimeUnit");
+    writer.string("ms");
+    writer.end_object();
+    writer.flush();
+    
+    out << "Trace: " << written << " events written to " << p.trace_path;
+    if (dropped > 0) {
+        out << " (" << dropped << " later events dropped)";
+    }
+    out << std::endl;
+}
+
+bool profile_available() {
+#ifdef MY_TORCH_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void profile_start(const std::string& trace_path) {
+    if (!profile_available()) {
+        throw std::runtime_error("Profiling requires a build with make PROFILE=1");
+    }
+    Profiler& p = profiler();
+    ProfilerAllocations own;
+    p.tracing = !trace_path.empty();
+    p.trace_path = trace_path;
+    p.started = current_totals();
+    p.reported = p.started;
+    profile_active.store(true, std::memory_order_release);
+}
+
+bool profile_enabled() {
+    return profile_active.load(std::memory_order_relaxed);
+}
+
+void profile_report(std::ostream& out, const std::string& title) {
+    if (!profile_enabled()) return;
+    ProfilerAllocations own;
+    Profiler& p = profiler();
+    p.reported = print_report(out, title, p.reported);
+}
+
+void profile_finish(std::ostream& out) {
+    if (!profile_enabled()) return;
+    ProfilerAllocations own;
+    Profiler& p = profiler();
+    print_report(out, "run", p.started);
+    profile_active.store(false, std::memory_order_relaxed);
+    if (p.tracing) {
+        write_trace(out);
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Scoped timers and counters on the hot paths. They are only built with
+// `make PROFILE=1`, which defines MY_TORCH_PROFILE; otherwise the PROFILE_*
+// macros expand to nothing. Once built they cost one relaxed load per scope
+// until profile_start() is called (--profile or --trace).
+
+// Zone ids available to the whole process
+static const int MAX_PROFILE_ZONES = 256;
+// Layers timed separately by a layer scope; deeper layers share the last zone
+static const size_t MAX_PROFILE_LAYERS = 8;
+
+// Registers a timer, or a counter, by name: call sites with the same name share it
+int profile_zone(const char* name);
+int profile_counter(const char* name);
+// First of MAX_PROFILE_LAYERS zones "name L0", "name L1", ...
+int profile_layer_zones(const char* name);
+
+extern std::atomic<bool> profile_active;
+
+inline uint64_t profile_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Adds [start, end) to the calling thread's total of zone, and to the trace
+void profile_record(int zone, uint64_t start, uint64_t end);
+void profile_count(int counter, uint64_t amount);
+
+class ProfileScope {
+public:
+    explicit ProfileScope(int zone) : zone(zone), start(profile_active.load(std::memory_order_relaxed) ? profile_now() : 0) {}
+    ~ProfileScope() {
+        if (start != 0) profile_record(zone, start, profile_now());
+    }
+    
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    int zone;
+    uint64_t start;
+};
+
+// False when built without MY_TORCH_PROFILE
+bool profile_available();
+// Starts timing; a non-empty trace_path receives a Chrome trace-event file
+// (chrome://tracing, Perfetto) at profile_finish
+void profile_start(const std::string& trace_path);
+bool profile_enabled();
+// Counter rates, allocations, peak RSS and the time of every zone, summed
+// over threads, since the previous report
+void profile_report(std::ostream& out, const std::string& title);
+// The same over the whole run, then the trace file
+void profile_finish(std::ostream& out);
+
+#ifdef MY_TORCH_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+    static const int PROFILE_CONCAT(profile_zone_, __LINE__) = profile_zone(name); \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_CONCAT(profile_zone_, __LINE__))
+#define PROFILE_LAYER_SCOPE(name, layer) \
+    static const int PROFILE_CONCAT(profile_zone_, __LINE__) = profile_layer_zones(name); \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_CONCAT(profile_zone_, __LINE__) \
+        + static_cast<int>(std::min<size_t>(layer, MAX_PROFILE_LAYERS - 1)))
+#define PROFILE_COUNT(name, amount) \
+    do { \
+        static const int profile_counter_id = profile_counter(name); \
+        if (profile_active.load(std::memory_order_relaxed)) profile_count(profile_counter_id, amount); \
+    } while (0)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_LAYER_SCOPE(name, layer)
+#define PROFILE_COUNT(name, amount) do {} while (0)
+#endif
@@ -0,0 +1,310 @@
+#include "quantize.hpp"
+#include "fen_parser.hpp"
+#include "kernels.hpp"
+#include "model_io.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+// Positions of the data file used to calibrate the activation ranges
+static const size_t CALIBRATION_SAMPLES = 4096;
+// Positions scored at a time when comparing both versions
+static const size_t EVALUATION_BATCH = 4096;
+static const int QUANT_MAX = 127;
+
+static int8_t quantize_weight(double w, double scale) {
+    long q = std::lround(w / scale);
+    return static_cast<int8_t>(std::max<long>(-QUANT_MAX, std::min<long>(QUANT_MAX, q)));
+}
+
+static size_t argmax(const double* values, size_t size) {
+    return std::max_element(values, values + size) - values;
+}
+
+QuantizedNetwork quantize_network(const Network& network, const SparseBatch& calibration) {
+    const size_t num_layers = network.layers.size();
+    for (size_t i = 0; i + 1 < num_layers; i++) {
+        if (network.layers[i].activation != Activation::Relu) {
+            throw std::runtime_error("Quantization needs ReLU hidden layers");
+        }
+    }
+    if (calibration.size() == 0) {
+        throw std::runtime_error("No calibration data");
+    }
+    
+    // Largest input seen by each layer over the calibration positions
+    std::vector<double> input_max(num_layers, 0.0);
+    BatchCache cache;
+    forward_batch_sparse(network, calibration, cache);
+    for (size_t i = 1; i < num_layers; i++) {
+        const auto& a = cache.activations[i];
+        input_max[i] = a.empty() ? 0.0 : *std::max_element(a.begin(), a.end());
+    }
+    
+    QuantizedNetwork quantized;
+    for (size_t i = 0; i < num_layers; i++) {
+        const Layer& layer = network.layers[i];
+        QuantizedLayer q;
+        q.inputs = layer.inputs;
+        q.outputs = layer.outputs;
+        q.activation = layer.activation;
+        q.input_scale = i == 0 || input_max[i] <= 0.0 ? 1.0f : static_cast<float>(input_max[i] / QUANT_MAX);
+        q.biases.assign(layer.biases.begin(), layer.biases.end());
+        q.weight_scales.resize(layer.outputs);
+        q.weights.resize(layer.inputs * layer.outputs);
+        
+        for (size_t j = 0; j < layer.outputs; j++) {
+            double max_abs = 0.0;
+            for (size_t k = 0; k < layer.inputs; k++) {
+                max_abs = std::max(max_abs, std::fabs(layer.weights[k * layer.outputs + j]));
+            }
+            double scale = max_abs > 0.0 ? max_abs / QUANT_MAX : 1.0;
+            q.weight_scales[j] = static_cast<float>(scale);
+            
+            for (size_t k = 0; k < layer.inputs; k++) {
+                size_t index = i == 0 ? k * layer.outputs + j : j * layer.inputs + k;
+                q.weights[index] = quantize_weight(layer.weights[k * layer.outputs + j], scale);
+            }
+        }
+        quantized.layers.push_back(std::move(q));
+    }
+    
+    return quantized;
+}
+
+// Rescales the int32 sums to float, adds the bias and applies the activation
+static void finish_layer(const QuantizedLayer& layer, const int32_t* acc, float* out) {
+    for (size_t j = 0; j < layer.outputs; j++) {
+        float z = acc[j] * (layer.input_scale * layer.weight_scales[j]) + layer.biases[j];
+        out[j] = layer.activation == Activation::Relu ? std::max(0.0f, z) : z;
+    }
+    
+    if (layer.activation == Activation::Softmax) {
+        double max_val = *std::max_element(out, out + layer.outputs);
+        double sum = 0.0;
+        for (size_t j = 0; j < layer.outputs; j++) {
+            sum += std::exp(out[j] - max_val);
+        }
+        for (size_t j = 0; j < layer.outputs; j++) {
+            out[j] = static_cast<float>(std::exp(out[j] - max_val) / sum);
+        }
+    }
+}
+
+const std::vector<float>& forward_batch_sparse(const QuantizedNetwork& network, const SparseBatch& inputs, QuantizedCache& cache) {
+    const QuantizedLayer& first = network.layers.front();
+    const size_t output_size = network.layers.back().outputs;
+    cache.outputs.resize(inputs.size() * output_size);
+    
+    for (size_t b = 0; b < inputs.size(); b++) {
+        // First layer: sum the int8 rows of the active features
+        cache.accumulators.assign(first.outputs, 0);
+        for (size_t idx = inputs.offsets[b]; idx < inputs.offsets[b + 1]; idx++) {
+            int f = inputs.indices[idx];
+            if (f < 0 || f >= static_cast<int>(first.inputs)) {
+                throw std::runtime_error("Sparse input must be feature indices below the input size");
+            }
+            accumulate_i8(first.outputs, &first.weights[f * first.outputs], cache.accumulators.data());
+        }
+        cache.activations.resize(first.outputs);
+        finish_layer(first, cache.accumulators.data(), cache.activations.data());
+        
+        for (size_t i = 1; i < network.layers.size(); i++) {
+            const QuantizedLayer& layer = network.layers[i];
+            
+            // Activations are non-negative after ReLU, so adding 0.5 rounds
+            const float inverse = 1.0f / layer.input_scale;
+            cache.inputs.resize(layer.inputs);
+            for (size_t k = 0; k < layer.inputs; k++) {
+                float q = std::min(cache.activations[k] * inverse + 0.5f, static_cast<float>(QUANT_MAX));
+                cache.inputs[k] = static_cast<uint8_t>(q);
+            }
+            
+            cache.accumulators.resize(layer.outputs);
+            for (size_t j = 0; j < layer.outputs; j++) {
+                cache.accumulators[j] = dot_u8_i8(layer.inputs, cache.inputs.data(), &layer.weights[j * layer.inputs]);
+            }
+            
+            float* out = i + 1 == network.layers.size() ? &cache.outputs[b * output_size] : nullptr;
+            if (out) {
+                finish_layer(layer, cache.accumulators.data(), out);
+            } else {
+                cache.activations.resize(layer.outputs);
+                finish_layer(layer, cache.accumulators.data(), cache.activations.data());
+            }
+        }
+    }
+    
+    return cache.outputs;
+}
+
+template <typename T>
+static void append(std::vector<unsigned char>& bytes, const T* values, size_t count) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(values);
+    bytes.insert(bytes.end(), p, p + count * sizeof(T));
+}
+
+template <typename T>
+static void read(const std::vector<unsigned char>& bytes, size_t& pos, T* values, size_t count, const std::string& path) {
+    if (count > (bytes.size() - pos) / sizeof(T)) {
+        throw std::runtime_error("Corrupted network file: " + path);
+    }
+    std::memcpy(values, bytes.data() + pos, count * sizeof(T));
+    pos += count * sizeof(T);
+}
+
+// Layout: magic, version, layer count, FNV-1a 64 of the rest, then per layer
+// inputs, outputs, activation, input_scale, weights, weight_scales and biases
+void save_quantized_network(const QuantizedNetwork& network, const std::string& path) {
+    std::vector<unsigned char> payload;
+    for (const auto& layer : network.layers) {
+        uint32_t shape[3] = {
+            static_cast<uint32_t>(layer.inputs),
+            static_cast<uint32_t>(layer.outputs),
+            static_cast<uint32_t>(layer.activation),
+        };
+        append(payload, shape, 3);
+        append(payload, &layer.input_scale, 1);
+        append(payload, layer.weights.data(), layer.weights.size());
+        append(payload, layer.weight_scales.data(), layer.weight_scales.size());
+        append(payload, layer.biases.data(), layer.biases.size());
+    }
+    
+    std::vector<unsigned char> bytes;
+    uint32_t header[2] = {NNQ_VERSION, static_cast<uint32_t>(network.layers.size())};
+    uint64_t checksum = fnv1a(payload.data(), payload.size());
+    append(bytes, NNQ_MAGIC, sizeof(NNQ_MAGIC));
+    append(bytes, header, 2);
+    append(bytes, &checksum, 1);
+    bytes.insert(bytes.end(), payload.begin(), payload.end());
+    
+    if (!write_file_atomic(path, bytes.data(), bytes.size())) {
+        throw std::runtime_error("Cannot write network file: " + path);
+    }
+}
+
+QuantizedNetwork load_quantized_network(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open network file: " + path);
+    }
+    std::vector<unsigned char> bytes(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    
+    size_t pos = 0;
+    char magic[sizeof(NNQ_MAGIC)];
+    uint32_t header[2];
+    uint64_t checksum;
+    read(bytes, pos, magic, sizeof(magic), path);
+    read(bytes, pos, header, 2, path);
+    read(bytes, pos, &checksum, 1, path);
+    if (std::memcmp(magic, NNQ_MAGIC, sizeof(NNQ_MAGIC)) != 0) {
+        throw std::runtime_error("Not a quantized network file: " + path);
+    }
+    if (header[0] != NNQ_VERSION) {
+        throw std::runtime_error("Unsupported network file version " + std::to_string(header[0]) + ": " + path);
+    }
+    if (fnv1a(bytes.data() + pos, bytes.size() - pos) != checksum) {
+        throw std::runtime_error("Checksum mismatch in network file: " + path);
+    }
+    
+    QuantizedNetwork network;
+    for (uint32_t i = 0; i < header[1]; i++) {
+        uint32_t shape[3];
+        read(bytes, pos, shape, 3, path);
+        if (shape[0] == 0 || shape[1] == 0 || shape[2] > static_cast<uint32_t>(Activation::Softmax)) {
+            throw std::runtime_error("Invalid shape for layer " + std::to_string(i));
+        }
+        if (i > 0 && shape[0] != network.layers.back().outputs) {
+            throw std::runtime_error("Layer " + std::to_string(i) + " input size does not match previous layer");
+        }
+        
+        QuantizedLayer layer;
+        layer.inputs = shape[0];
+        layer.outputs = shape[1];
+        layer.activation = static_cast<Activation>(shape[2]);
+        read(bytes, pos, &layer.input_scale, 1, path);
+        layer.weights.resize(layer.inputs * layer.outputs);
+        read(bytes, pos, layer.weights.data(), layer.weights.size(), path);
+        layer.weight_scales.resize(layer.outputs);
+        read(bytes, pos, layer.weight_scales.data(), layer.outputs, path);
+        layer.biases.resize(layer.outputs);
+        read(bytes, pos, layer.biases.data(), layer.outputs, path);
+        network.layers.push_back(std::move(layer));
+    }
+    if (network.layers.empty() || pos != bytes.size()) {
+        throw std::runtime_error("Corrupted network file: " + path);
+    }
+    
+    return network;
+}
+
+void quantize_model(const AnalyzerArgs& args, const Network& network) {
+    if (network.layers.front().inputs != FEN_INPUT_SIZE) {
+        throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+    }
+    
+    // Evenly spaced sample of the data file
+    Dataset dataset = load_dataset(args.data_file, args.verify_cache);
+    SparseBatch calibration;
+    size_t count = std::min(CALIBRATION_SAMPLES, dataset.size());
+    for (size_t i = 0; i < count; i++) {
+        size_t sample = i * dataset.size() / count;
+        calibration.add(dataset.features_begin(sample), dataset.features_end(sample));
+    }
+    
+    QuantizedNetwork quantized = quantize_network(network, calibration);
+    std::cout << "Calibrated on " << calibration.size() << " positions from " << args.data_file << std::endl;
+    for (size_t i = 1; i < quantized.layers.size(); i++) {
+        std::cout << "Layer " << (i + 1) << " input range: [0, " << quantized.layers[i].input_scale * QUANT_MAX << "]" << std::endl;
+    }
+    
+    // Accuracy of both versions on the whole data file, or on --validation,
+    // rather than on the sample the ranges were fitted to
+    Dataset validation;
+    const Dataset* scored = &dataset;
+    std::string scored_file = args.data_file;
+    if (!args.validation_file.empty()) {
+        validation = load_dataset(args.validation_file, args.verify_cache);
+        scored = &validation;
+        scored_file = args.validation_file;
+    }
+    if (scored->size() == 0) {
+        throw std::runtime_error("No valid positions in " + scored_file);
+    }
+    
+    BatchCache cache;
+    QuantizedCache q_cache;
+    SparseBatch batch;
+    const size_t width = network.layers.back().outputs;
+    size_t agree = 0, reference_correct = 0, quantized_correct = 0;
+    for (size_t begin = 0; begin < scored->size(); begin += EVALUATION_BATCH) {
+        size_t end = std::min(begin + EVALUATION_BATCH, scored->size());
+        batch.clear();
+        for (size_t sample = begin; sample < end; sample++) {
+            batch.add(scored->features_begin(sample), scored->features_end(sample));
+        }
+        const auto& reference = forward_batch_sparse(network, batch, cache);
+        const auto& approx = forward_batch_sparse(quantized, batch, q_cache);
+        for (size_t b = 0; b < batch.size(); b++) {
+            std::vector<double> q_row(approx.begin() + b * width, approx.begin() + (b + 1) * width);
+            size_t expected = scored->labels[begin + b];
+            size_t r = argmax(&reference[b * width], width);
+            size_t q = argmax(q_row.data(), width);
+            agree += r == q;
+            reference_correct += r == expected;
+            quantized_correct += q == expected;
+        }
+    }
+    double n = static_cast<double>(scored->size());
+    std::cout << "Accuracy on " << scored->size() << " positions of " << scored_file << ": fp64 "
+              << reference_correct / n * 100.0 << "%, int8 " << quantized_correct / n * 100.0
+              << "% (same prediction on " << agree / n * 100.0 << "%)" << std::endl;
+    
+    save_quantized_network(quantized, args.save_file);
+    std::cout << "Quantized network saved to " << args.save_file << std::endl;
+}
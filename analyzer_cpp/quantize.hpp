@@ -0,0 +1,52 @@
+#pragma once
+#include "parsor.hpp"
+#include "model.hpp"
+#include "network.hpp"
+#include "dataset.hpp"
+#include <cstdint>
+
+// Post-training int8 quantization for prediction-only use. Weights become int8
+// with one scale per output neuron; hidden activations become 0..127 with one
+// scale per layer, calibrated on sample positions. Products are accumulated in
+// int32 and rescaled to float before adding the bias.
+
+const char NNQ_MAGIC[4] = {'N', 'N', 'Q', '1'};
+const uint32_t NNQ_VERSION = 1;
+
+struct QuantizedLayer {
+    size_t inputs;
+    size_t outputs;
+    Activation activation;
+    // First layer: [inputs][outputs] like Layer::weights, so the rows of the active
+    // features are summed. Other layers: [outputs][inputs], one dot product per output.
+    std::vector<int8_t> weights;
+    std::vector<float> weight_scales;
+    std::vector<float> biases;
+    // Real value of one step of the quantized input (1 for the binary first layer)
+    float input_scale;
+};
+
+struct QuantizedNetwork {
+    std::vector<QuantizedLayer> layers;
+};
+
+// Per-worker buffers, reused across batches
+struct QuantizedCache {
+    std::vector<int32_t> accumulators;
+    std::vector<uint8_t> inputs;
+    std::vector<float> activations;
+    std::vector<float> outputs;
+};
+
+// Hidden layers must be ReLU so that every quantized layer input is non-negative
+QuantizedNetwork quantize_network(const Network& network, const SparseBatch& calibration);
+// Output probabilities, one row per sample, like the floating-point version
+const std::vector<float>& forward_batch_sparse(const QuantizedNetwork& network, const SparseBatch& inputs, QuantizedCache& cache);
+
+QuantizedNetwork load_quantized_network(const std::string& path);
+void save_quantized_network(const QuantizedNetwork& network, const std::string& path);
+
+// --quantize: calibrates on args.data_file, reports the agreement with the
+// original network on all of it (or on args.validation_file) and writes
+// args.save_file
+void quantize_model(const AnalyzerArgs& args, const Network& network);
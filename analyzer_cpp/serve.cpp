@@ -0,0 +1,579 @@
+#include "serve.hpp"
+#include "fen_parser.hpp"
+#include "network.hpp"
+#include "predict.hpp"
+#include "position_cache.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using ServeClock = std::chrono::steady_clock;
+
+// Milliseconds between two checks for a stop request
+static const int POLL_MS = 200;
+static const size_t READ_BYTES = 1 << 16;
+// Requests waiting for a batch, over all clients, before readers stop reading
+static const size_t MAX_PENDING = 1 << 14;
+// Replies a socket client may leave unread before it is disconnected
+static const size_t MAX_OUTBOX_BYTES = 1 << 22;
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+// One client: a socket, or stdin and stdout. The batcher appends replies to
+// the outbox and the client's own thread writes them out, so a client that
+// does not read only holds up itself.
+struct Connection {
+    int in_fd = -1;
+    int out_fd = -1;
+    bool socket = false;
+    // Written by the batcher to wake the client's thread
+    int wake[2] = {-1, -1};
+    std::mutex mutex;
+    std::string outbox;
+    // Taken from the outbox but not written yet
+    std::atomic<size_t> unsent{0};
+    // Queued requests not replied to yet
+    std::atomic<size_t> in_flight{0};
+    // Set once replies cannot be written, or too many are left unread
+    std::atomic<bool> broken{false};
+    
+    ~Connection() {
+        if (wake[0] >= 0) close(wake[0]);
+        if (wake[1] >= 0) close(wake[1]);
+        if (socket) close(in_fd);
+    }
+};
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static bool open_wake_pipe(Connection& client) {
+    return pipe(client.wake) == 0 && set_nonblocking(client.wake[0]) && set_nonblocking(client.wake[1]);
+}
+
+// A full pipe already wakes the reader, so a failed write is fine
+static void wake_client(Connection& client) {
+    char byte = 0;
+    ssize_t n = write(client.wake[1], &byte, 1);
+    (void)n;
+}
+
+struct ServeRequest {
+    std::shared_ptr<Connection> client;
+    // Side to move, kept to name the color of a check
+    std::string turn;
+    std::string error;
+    uint16_t features[FEN_MAX_FEATURES];
+    int count = 0;
+    ServeClock::time_point arrival;
+    uint64_t key = 0;
+    // Answered from the cache by the reader
+    bool cached = false;
+    std::string reply;
+};
+
+// Requests of every client, oldest first
+class RequestQueue {
+public:
+    explicit RequestQueue(size_t capacity) : capacity(capacity) {}
+    
+    // Waits while capacity requests are pending, so that a reader stops reading
+    // its client until the batcher catches up. Requests are dropped once the
+    // queue is abandoned.
+    void push(std::vector<ServeRequest>& requests) {
+        if (requests.empty()) return;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            room.wait(lock, [&] { return pending.size() < capacity || abandoned; });
+            if (!abandoned) {
+                for (auto& request : requests) {
+                    pending.push_back(std::move(request));
+                }
+            }
+        }
+        requests.clear();
+        ready.notify_one();
+    }
+    
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_one();
+    }
+    
+    // The batcher has stopped: readers give up instead of waiting for replies
+    void abandon() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            abandoned = true;
+        }
+        room.notify_all();
+    }
+    
+    bool is_abandoned() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return abandoned;
+    }
+    
+    // Moves up to max_batch requests into batch as soon as that many are
+    // waiting, or once the oldest one has waited max_delay. False once the
+    // queue is closed and empty.
+    bool take(std::vector<ServeRequest>& batch, size_t max_batch, ServeClock::duration max_delay) {
+        batch.clear();
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return !pending.empty() || closed; });
+        if (pending.empty()) return false;
+        
+        ServeClock::time_point deadline = pending.front().arrival + max_delay;
+        ready.wait_until(lock, deadline, [&] { return pending.size() >= max_batch || closed; });
+        size_t count = std::min(max_batch, pending.size());
+        for (size_t i = 0; i < count; i++) {
+            batch.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+        lock.unlock();
+        room.notify_all();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable room;
+    std::deque<ServeRequest> pending;
+    size_t capacity;
+    bool closed = false;
+    bool abandoned = false;
+};
+
+// What the readers need besides their connection
+struct ServeContext {
+    explicit ServeContext(size_t max_pending) : queue(max_pending) {}
+    
+    RequestQueue queue;
+    PositionCache* cache = nullptr;
+    size_t output_size = 0;
+    // Cache hits replied to without going through a batch
+    std::atomic<size_t> answered_by_readers{0};
+};
+
+static void add_request(const std::shared_ptr<Connection>& client, std::string_view line, ServeClock::time_point now, ServeContext& context, std::vector<ServeRequest>& out, uint64_t& hits) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty()) return;
+    
+    out.emplace_back();
+    ServeRequest& request = out.back();
+    request.client = client;
+    request.arrival = now;
+    std::string_view fields[2];
+    if (split_fields(line, fields, 2) > 1) {
+        request.turn = fields[1];
+    }
+    
+    // With a cache, the key comes from the same walk as the features, and a
+    // position scored before skips the network
+    double probabilities[PositionCache::MAX_OUTPUTS];
+    bool valid = context.cache ? encode_fen_features(line, request.features, request.count, request.key)
+                               : encode_fen_features(line, request.features, request.count);
+    if (valid && context.cache && context.cache->find(request.key, probabilities, context.output_size)) {
+        request.reply = format_prediction(request.turn, probabilities, context.output_size);
+        request.cached = true;
+        hits++;
+        return;
+    }
+    if (!valid) {
+        request.error = "Invalid FEN: " + std::string(line);
+    }
+}
+
+// Appends replies to the outbox. A socket with nothing left to send is
+// written right away, without blocking. A socket client leaving
+// MAX_OUTBOX_BYTES unread is dropped; stdout is written blocking, which holds
+// up reading stdin instead. Returns whether the client's thread has
+// replies to write.
+static bool add_replies(Connection& client, const std::string& text) {
+    if (client.broken) return false;
+    std::lock_guard<std::mutex> lock(client.mutex);
+    size_t unread = client.outbox.size() + client.unsent;
+    size_t done = 0;
+    if (client.socket && unread == 0) {
+        ssize_t n = write(client.out_fd, text.data(), text.size());
+        if (n > 0) done = n;
+    }
+    if (client.socket && unread + text.size() - done > MAX_OUTBOX_BYTES) {
+        client.broken = true;
+        std::cerr << "Dropping a client that left " << unread << " bytes of replies unread" << std::endl;
+        return false;
+    }
+    if (done == text.size()) return false;
+    client.outbox.append(text, done, std::string::npos);
+    return true;
+}
+
+// Hands the batcher's replies to a run of count requests to the client
+static void queue_replies(Connection& client, const std::string& text, size_t count) {
+    bool queued = add_replies(client, text);
+    // The thread also waits for its last replies once the input is over
+    if (client.in_flight.fetch_sub(count) == count || queued || client.broken) {
+        wake_client(client);
+    }
+}
+
+// Runs on a thread per client. FENs are encoded here, so that the batcher
+// only scores, and go to the queue a read at a time; the replies the batcher
+// leaves in the outbox are written from here too. Once the input ends, or the
+// server stops, the thread stays until every queued request is answered.
+static void serve_client(const std::shared_ptr<Connection>& client, ServeContext& context, const std::atomic<bool>& stopping) {
+    std::vector<char> chunk(READ_BYTES);
+    std::string buffer;
+    std::vector<ServeRequest> parsed;
+    std::string sending;
+    size_t sent = 0;
+    std::string cached;
+    bool eof = false;
+    
+    while (!client->broken && !context.queue.is_abandoned()) {
+        // Read before the outbox: replies are added before in_flight drops
+        bool answered = client->in_flight == 0;
+        if (sent == sending.size()) {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            sending.swap(client->outbox);
+            client->outbox.clear();
+            sent = 0;
+            client->unsent = sending.size();
+        }
+        bool reading = !eof && !stopping;
+        if (!reading && answered && sent == sending.size()) break;
+        
+        pollfd fds[3] = {
+            {reading ? client->in_fd : -1, POLLIN, 0},
+            {sent < sending.size() ? client->out_fd : -1, POLLOUT, 0},
+            {client->wake[0], POLLIN, 0},
+        };
+        int ready = poll(fds, 3, POLL_MS);
+        if (ready < 0 && errno != EINTR) break;
+        // A client that takes nothing for a whole poll does not hold up the stop
+        if (ready == 0 && stopping) break;
+        if (ready <= 0) continue;
+        
+        if (fds[2].revents) {
+            while (read(client->wake[0], chunk.data(), chunk.size()) > 0) {}
+        }
+        if (fds[1].revents) {
+            ssize_t n = write(client->out_fd, sending.data() + sent, sending.size() - sent);
+            if (n > 0) {
+                sent += n;
+                client->unsent = sending.size() - sent;
+            } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                client->broken = true;
+            }
+        }
+        if (!fds[0].revents) continue;
+        
+        ssize_t n = read(client->in_fd, chunk.data(), chunk.size());
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+        if (n <= 0) {
+            eof = true;
+        } else {
+            buffer.append(chunk.data(), n);
+        }
+        
+        ServeClock::time_point now = ServeClock::now();
+        uint64_t hits = 0;
+        size_t start = 0;
+        size_t end;
+        while ((end = buffer.find('\n', start)) != std::string::npos) {
+            add_request(client, std::string_view(buffer).substr(start, end - start), now, context, parsed, hits);
+            start = end + 1;
+        }
+        buffer.erase(0, start);
+        // The last line may end without a newline
+        if (eof) {
+            add_request(client, buffer, now, context, parsed, hits);
+        }
+        if (context.cache) {
+            context.cache->add_counts(hits, 0);
+        }
+        
+        // Cache hits are answered here while none of the client's requests
+        // wait ahead of them: in_flight only grows on this thread
+        size_t answered_here = 0;
+        if (client->in_flight == 0) {
+            cached.clear();
+            while (answered_here < parsed.size() && parsed[answered_here].cached) {
+                cached += parsed[answered_here].reply;
+                cached += '\n';
+                answered_here++;
+            }
+            if (answered_here > 0) {
+                add_replies(*client, cached);
+            }
+            parsed.erase(parsed.begin(), parsed.begin() + answered_here);
+            context.answered_by_readers += answered_here;
+        }
+        client->in_flight += parsed.size();
+        context.queue.push(parsed);
+    }
+    
+    // Lets a dropped client see the disconnect
+    if (client->broken && client->socket) {
+        shutdown(client->in_fd, SHUT_RDWR);
+    }
+}
+
+static int listen_unix(const std::string& path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    path.copy(addr.sun_path, path.size());
+    
+    // A socket left behind by an earlier server is replaced, any other file is kept
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create socket: " + path);
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot listen on socket: " + path);
+    }
+    return fd;
+}
+
+// Starts a reader per connection until SIGINT or SIGTERM
+static void accept_clients(int listener, ServeContext& context, std::atomic<bool>& stopping) {
+    struct Reader {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+    std::list<Reader> readers;
+    
+    while (!stop_requested) {
+        pollfd pfd = {listener, POLLIN, 0};
+        int ready = poll(&pfd, 1, POLL_MS);
+        
+        // Readers of closed connections are joined as we go
+        for (auto it = readers.begin(); it != readers.end();) {
+            if (*it->done) {
+                it->thread.join();
+                it = readers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (ready <= 0) continue;
+        
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) continue;
+        auto client = std::make_shared<Connection>();
+        client->in_fd = fd;
+        client->out_fd = fd;
+        client->socket = true;
+        // Out of descriptors: the client is dropped
+        if (!set_nonblocking(fd) || !open_wake_pipe(*client)) continue;
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        readers.push_back({std::thread([client, done, &context, &stopping] {
+            serve_client(client, context, stopping);
+            *done = true;
+        }), done});
+    }
+    
+    stopping = true;
+    for (auto& reader : readers) {
+        reader.thread.join();
+    }
+}
+
+// Per-worker buffers, reused for every batch
+template <typename Cache>
+struct ServeScratch {
+    Cache cache;
+    SparseBatch inputs;
+    std::vector<size_t> rows;
+};
+
+// Fills the replies of batch[begin, end)
+template <typename Model, typename Cache>
+static void score_range(const Model& network, std::vector<ServeRequest>& batch, size_t begin, size_t end, ServeScratch<Cache>& scratch, PositionCache* cache) {
+    const size_t output_size = network.layers.back().outputs;
+    scratch.inputs.clear();
+    scratch.rows.clear();
+    for (size_t i = begin; i < end; i++) {
+        ServeRequest& request = batch[i];
+        if (request.cached) continue;
+        if (!request.error.empty()) {
+            request.reply = "error: " + request.error;
+            continue;
+        }
+        scratch.inputs.add(request.features, request.features + request.count);
+        scratch.rows.push_back(i);
+    }
+    if (scratch.rows.empty()) return;
+    
+    const auto& output = forward_batch_sparse(network, scratch.inputs, scratch.cache);
+    for (size_t b = 0; b < scratch.rows.size(); b++) {
+        ServeRequest& request = batch[scratch.rows[b]];
+        request.reply = format_prediction(request.turn, &output[b * output_size], output_size);
+        if (cache) {
+            cache->store(request.key, &output[b * output_size], output_size);
+        }
+    }
+    if (cache) {
+        cache->add_counts(0, scratch.rows.size());
+    }
+}
+
+// Shared by the floating-point and quantized networks
+template <typename Cache, typename Model>
+static void run_server(const AnalyzerArgs& args, const Model& network) {
+    if (network.layers.front().inputs != FEN_INPUT_SIZE) {
+        throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+    }
+    
+    ThreadPool pool(resolve_thread_count(args.threads));
+    std::vector<ServeScratch<Cache>> scratch(pool.size());
+    std::unique_ptr<PositionCache> cache = make_position_cache(args, network.layers.back().outputs);
+    ServeContext context(std::max(MAX_PENDING, 2 * static_cast<size_t>(args.max_batch)));
+    context.cache = cache.get();
+    context.output_size = network.layers.back().outputs;
+    std::atomic<bool> stopping{false};
+    std::exception_ptr front_error;
+    
+    // Gone clients must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+    
+    // Clients are read on threads of their own while this one scores
+    std::thread front;
+    int listener = -1;
+    if (args.data_file == "-") {
+        auto client = std::make_shared<Connection>();
+        client->in_fd = STDIN_FILENO;
+        client->out_fd = STDOUT_FILENO;
+        if (!open_wake_pipe(*client)) {
+            throw std::runtime_error("Cannot create a pipe");
+        }
+        front = std::thread([client, &context, &stopping] {
+            serve_client(client, context, stopping);
+            context.queue.close();
+        });
+    } else {
+        listener = listen_unix(args.data_file);
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+        front = std::thread([listener, &context, &stopping, &front_error] {
+            try {
+                accept_clients(listener, context, stopping);
+            } catch (...) {
+                front_error = std::current_exception();
+            }
+            context.queue.close();
+        });
+        std::cerr << "Serving on " << args.data_file << " (batches of up to " << args.max_batch
+                  << ", max delay " << args.max_delay_us << " us, " << pool.size() << " threads)" << std::endl;
+    }
+    
+    size_t served = 0;
+    size_t batches = 0;
+    std::vector<ServeRequest> batch;
+    std::exception_ptr batch_error;
+    try {
+        while (context.queue.take(batch, args.max_batch, std::chrono::microseconds(args.max_delay_us))) {
+            // One contiguous range per worker so each one keeps its own scratch
+            size_t count = batch.size();
+            size_t workers = std::min(pool.size(), count);
+            pool.run(workers, [&](size_t w) {
+                size_t begin = w * count / workers;
+                size_t end = (w + 1) * count / workers;
+                score_range(network, batch, begin, end, scratch[w], cache.get());
+            });
+            
+            // One hand-off per run of requests from the same client
+            std::string out;
+            size_t run = 0;
+            for (size_t i = 0; i < count; i++) {
+                out += batch[i].reply;
+                out += '\n';
+                run++;
+                if (i + 1 == count || batch[i + 1].client != batch[i].client) {
+                    queue_replies(*batch[i].client, out, run);
+                    out.clear();
+                    run = 0;
+                }
+            }
+            served += count;
+            batches++;
+        }
+    } catch (...) {
+        // The clients are let go before the error is reported
+        batch_error = std::current_exception();
+        context.queue.abandon();
+        stop_requested = 1;
+        stopping = true;
+    }
+    front.join();
+    
+    if (listener >= 0) {
+        close(listener);
+        unlink(args.data_file.c_str());
+    }
+    if (batch_error) {
+        std::rethrow_exception(batch_error);
+    }
+    if (front_error) {
+        std::rethrow_exception(front_error);
+    }
+    std::cerr << "Served " << served + context.answered_by_readers << " requests in " << batches << " batches";
+    if (cache) {
+        std::cerr << ", " << context.answered_by_readers << " answered from the cache without one";
+    }
+    std::cerr << std::endl;
+    if (cache) {
+        print_cache_stats(*cache, std::cerr);
+    }
+}
+
+template <typename Real>
+void serve_model(const AnalyzerArgs& args, BasicNetwork<Real>& network) {
+    run_server<BasicBatchCache<Real>>(args, network);
+}
+
+void serve_model(const AnalyzerArgs& args, const QuantizedNetwork& network) {
+    run_server<QuantizedCache>(args, network);
+}
+
+template void serve_model<double>(const AnalyzerArgs& args, Network& network);
+template void serve_model<float>(const AnalyzerArgs& args, BasicNetwork<float>& network);
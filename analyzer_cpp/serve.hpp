@@ -0,0 +1,14 @@
+#pragma once
+#include "parsor.hpp"
+#include "model.hpp"
+#include "quantize.hpp"
+
+// Answers prediction requests with a network loaded once, until the clients
+// are gone (stdin) or SIGINT/SIGTERM (socket). Line protocol: one FEN per
+// request line, one label or "error: ..." per reply line, in request order.
+// Requests of all clients are scored together in batches of up to
+// args.max_batch, each batch waiting at most args.max_delay_us for more.
+// A client that does not read its replies is dropped, not waited for.
+template <typename Real>
+void serve_model(const AnalyzerArgs& args, BasicNetwork<Real>& network);
+void serve_model(const AnalyzerArgs& args, const QuantizedNetwork& network);
@@ -0,0 +1,91 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    for (size_t i = 1; i < num_threads; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& task) {
+    if (workers.empty() || count <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_task = &task;
+        task_count = count;
+        next_task = 0;
+        pending = count;
+        error = nullptr;
+        generation++;
+    }
+    work_ready.notify_all();
+    
+    drain();
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return pending == 0; });
+    current_task = nullptr;
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void ThreadPool::drain() {
+    while (true) {
+        size_t index;
+        const std::function<void(size_t)>* task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (next_task >= task_count) return;
+            index = next_task++;
+            task = current_task;
+        }
+        
+        try {
+            (*task)(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) work_done.notify_all();
+    }
+}
+
+void ThreadPool::worker_loop() {
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        drain();
+    }
+}
+
+size_t resolve_thread_count(int requested) {
+    if (requested > 0) return requested;
+    size_t hw = std::thread::hardware_concurrency();
+    return hw > 0 ? hw : 1;
+}
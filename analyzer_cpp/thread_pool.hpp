@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running parallel-for jobs.
+// The calling thread takes part in every job, so a pool of size 1 spawns no thread.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size() + 1; }
+
+    // Runs task(0) .. task(count - 1) and returns once all of them are done.
+    // The first exception thrown by a task is rethrown here.
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    void worker_loop();
+    void drain();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    const std::function<void(size_t)>* current_task = nullptr;
+    size_t task_count = 0;
+    size_t next_task = 0;
+    size_t pending = 0;
+    size_t generation = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};
+
+size_t resolve_thread_count(int requested);
@@ -1,66 +1,217 @@
 #include "train.hpp"
+#include "checkpoint.hpp"
 #include "fen_parser.hpp"
+#include "dataset.hpp"
+#include "dataset_stream.hpp"
+#include "evaluation.hpp"
 #include "network.hpp"
-#include <fstream>
-#include <sstream>
+#include "thread_pool.hpp"
+#include "kernels.hpp"
+#include "model_io.hpp"
+#include "optimizer.hpp"
+#include "profiler.hpp"
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <sstream>
+
+// Mini-batches handed to the trainer at a time in --stream mode
+static const size_t STREAM_BLOCK_BATCHES = 64;
+
+// One-hot target row of a class index
+static void set_target(double* target, size_t size, uint8_t label) {
+    std::fill(target, target + size, 0.0);
+    target[label] = 1.0;
+}
+
+// Updates with a higher loss are skipped to prevent divergence
+static const double MAX_SAMPLE_LOSS = 10.0;
 
-struct TrainingData {
-    std::vector<double> input;
-    std::vector<double> target;
+// Trains on order[begin .. end), adding the losses to total_loss
+template <typename Real>
+static void train_epoch(BasicNetwork<Real>& network, const Dataset& dataset, const std::vector<size_t>& order, size_t begin, size_t end, const std::vector<double>& class_weights, double learning_rate, BasicWorkspace<Real>& workspace, double& total_loss) {
+    for (size_t k = begin; k < end; k++) {
+        size_t i = order[k];
+        total_loss += train_step(network, dataset.features_begin(i), dataset.features_end(i), dataset.labels[i], class_weights, learning_rate, MAX_SAMPLE_LOSS, workspace);
+    }
+}
+
+// Private buffers of one slice of a mini-batch
+template <typename Real>
+struct Shard {
+    BasicBatchCache<Real> cache;
+    BasicGradients<Real> grads;
+    SparseBatch inputs;
+    std::vector<double> targets;
+    std::vector<double> sample_weights;
+    double loss = 0.0;
 };
 
-void train_model(const AnalyzerArgs& args, json::Value& network) {
-    std::ifstream file(args.data_file);
-    if (!file.is_open()) {
-        throw std::runtime_error("Cannot open data file: " + args.data_file);
+template <typename Real>
+static void run_shard(const BasicNetwork<Real>& network, const Dataset& dataset, const std::vector<size_t>& order, const std::vector<double>& class_weights, size_t begin, size_t end, Shard<Real>& shard) {
+    PROFILE_SCOPE("shard");
+    const size_t output_size = network.layers.back().outputs;
+    const size_t count = end - begin;
+    
+    shard.inputs.clear();
+    shard.targets.resize(count * output_size);
+    shard.sample_weights.resize(count);
+    for (size_t b = 0; b < count; b++) {
+        size_t i = order[begin + b];
+        shard.inputs.add(dataset.features_begin(i), dataset.features_end(i));
+        set_target(&shard.targets[b * output_size], output_size, dataset.labels[i]);
     }
     
-    std::vector<TrainingData> training_data;
-    std::string line;
+    const auto& output = forward_batch_sparse(network, shard.inputs, shard.cache);
     
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        
-        std::istringstream iss(line);
-        std::vector<std::string> parts;
-        std::string word;
-        while (iss >> word) {
-            parts.push_back(word);
-        }
+    shard.loss = 0.0;
+    for (size_t b = 0; b < count; b++) {
+        double loss = cross_entropy_loss(&output[b * output_size], dataset.labels[order[begin + b]], class_weights);
+        shard.loss += loss;
         
-        if (parts.size() < 7) continue;
-        
-        // FEN (6 parts) + label
-        std::string fen = parts[0] + " " + parts[1] + " " + parts[2] + " " + 
-                          parts[3] + " " + parts[4] + " " + parts[5];
+        // Drop samples with extreme loss to prevent divergence
+        shard.sample_weights[b] = loss > MAX_SAMPLE_LOSS ? 0.0 : 1.0;
+    }
+    
+    backward_batch(network, shard.cache, shard.targets, shard.sample_weights, shard.grads);
+}
+
+// Shards live as long as the training run, so their buffers are only grown once.
+// Batches start every batch_size samples from begin.
+template <typename Real>
+static void train_epoch_batched(BasicNetwork<Real>& network, const Dataset& dataset, const std::vector<size_t>& order, size_t begin, size_t end, const std::vector<double>& class_weights, double learning_rate, size_t batch_size, ThreadPool& pool, std::vector<Shard<Real>>& shards, double& total_loss) {
+    const double grad_clip = 5.0;
+    
+    size_t start = 0;
+    size_t count = 0;
+    size_t num_shards = 0;
+    size_t stride = 0;
+    
+    // Built once: a std::function holding these captures would allocate per call
+    const std::function<void(size_t)> shard_task = [&](size_t s) {
+        // Shard boundaries only depend on the batch, never on thread scheduling
+        size_t begin = start + s * count / num_shards;
+        size_t end = start + (s + 1) * count / num_shards;
+        run_shard(network, dataset, order, class_weights, begin, end, shards[s]);
+    };
+    const std::function<void(size_t)> reduce_task = [&](size_t p) {
+        size_t dst = p * 2 * stride;
+        accumulate_gradients(shards[dst].grads, shards[dst + stride].grads);
+    };
+    
+    for (start = begin; start < end; start += batch_size) {
+        count = std::min(batch_size, end - start);
+        num_shards = std::min(shards.size(), count);
+        pool.run(num_shards, shard_task);
         
-        std::string label;
-        for (size_t i = 6; i < parts.size(); i++) {
-            if (i > 6) label += " ";
-            label += parts[i];
+        // Pairwise tree reduction into shards[0], in a fixed order for reproducibility
+        for (stride = 1; stride < num_shards; stride *= 2) {
+            PROFILE_SCOPE("reduce gradients");
+            size_t pairs = (num_shards - stride + 2 * stride - 1) / (2 * stride);
+            pool.run(pairs, reduce_task);
         }
         
-        try {
-            TrainingData data;
-            data.input = fen_to_vector(fen);
-            data.target = label_to_vector(label);
-            training_data.push_back(data);
-        } catch (...) {
-            continue;
+        for (size_t s = 0; s < num_shards; s++) {
+            total_loss += shards[s].loss;
         }
+        
+        // One averaged update per batch
+        BasicGradients<Real>& grads = shards[0].grads;
+        scale_gradients(grads, 1.0 / count);
+        clip_gradients(grads, grad_clip);
+        apply_gradients(network, grads, learning_rate);
+    }
+}
+
+static std::string rng_to_string(const std::mt19937& gen) {
+    std::ostringstream out;
+    out << gen;
+    return out.str();
+}
+
+static void seed_generator(const AnalyzerArgs& args, std::mt19937& gen) {
+    if (args.has_seed) {
+        gen.seed(args.seed);
+    } else {
+        std::random_device rd;
+        gen.seed(rd());
+    }
+}
+
+// Moves a shuffled --val-split fraction of order to validation_rows, or
+// loads the --validation file; leaves both empty otherwise
+static void hold_out_validation(const AnalyzerArgs& args, const Dataset& dataset, std::mt19937& gen, std::vector<size_t>& order, Dataset& validation, std::vector<size_t>& validation_rows) {
+    if (args.val_split > 0.0) {
+        std::shuffle(order.begin(), order.end(), gen);
+        size_t held_out = static_cast<size_t>(order.size() * args.val_split);
+        validation = dataset;
+        validation_rows.assign(order.end() - held_out, order.end());
+        std::sort(validation_rows.begin(), validation_rows.end());
+        order.resize(order.size() - held_out);
+    } else if (!args.validation_file.empty()) {
+        PROFILE_SCOPE("load dataset");
+        validation = load_dataset(args.validation_file, args.verify_cache);
+        validation_rows.resize(validation.size());
+        std::iota(validation_rows.begin(), validation_rows.end(), 0);
     }
-    file.close();
+}
+
+// What a run trains and validates on. The datasets and validation rows are
+// only read, so several runs can share them.
+struct TrainingInput {
+    const Dataset* dataset = nullptr;
+    // Set in --stream mode, where dataset stays empty
+    DatasetStream* stream = nullptr;
+    // Training rows, reshuffled by gen every epoch
+    std::vector<size_t> order;
+    const Dataset* validation = nullptr;
+    const std::vector<size_t>* validation_rows = nullptr;
+    std::vector<double> class_counts;
+    std::mt19937 gen;
+    // Profile reports after setup and every epoch
+    bool profile_epochs = true;
+};
+
+// Trains network and saves the one to keep to save_path. Returns the
+// validation report of the saved network, empty without validation.
+template <typename Real>
+static EvaluationReport run_training(const AnalyzerArgs& args, BasicNetwork<Real>& network, TrainingInput& input, TrainingState& state, BasicNetwork<Real>& best_network, ThreadPool& pool, std::ostream& out, const std::string& save_path) {
+    DatasetStream* stream = input.stream;
+    const Dataset& dataset = *input.dataset;
+    std::vector<size_t>& order = input.order;
+    const Dataset& validation = *input.validation;
+    const std::vector<size_t>& validation_rows = *input.validation_rows;
+    const std::vector<double>& class_counts = input.class_counts;
+    std::mt19937& gen = input.gen;
+    const bool validating = !validation_rows.empty();
+    size_t dataset_size = stream ? stream->size() : order.size();
     
-    if (training_data.empty()) {
+    if (dataset_size == 0) {
         throw std::runtime_error("No valid training data found");
     }
+    if (args.resume && (state.dataset_size != dataset_size || state.batch_size != static_cast<uint32_t>(args.batch_size))) {
+        throw std::runtime_error("Checkpoint " + args.checkpoint_file + " was made with other data or another batch size");
+    }
+    state.dataset_size = dataset_size;
+    state.batch_size = args.batch_size;
     
-    double base_learning_rate = network["meta"]["learning_rate"].as_number();
+    // Another optimizer starts from fresh state, the stored one resumes from its own
+    if (!args.optimizer.empty() && optimizer_from_string(args.optimizer) != network.optimizer.kind) {
+        reset_optimizer(network, optimizer_from_string(args.optimizer));
+    }
+    if (args.momentum >= 0.0) network.optimizer.momentum = args.momentum;
+    if (args.weight_decay >= 0.0) network.optimizer.weight_decay = args.weight_decay;
+    init_optimizer_state(network);
     
-    size_t dataset_size = training_data.size();
+    double base_learning_rate = network.learning_rate;
     
     // Reduce learning rate for large datasets to prevent divergence
     double learning_rate = base_learning_rate;
@@ -81,16 +232,6 @@ void train_model(const AnalyzerArgs& args, json::Value& network) {
     else epochs = 100;
     
     // Calculate class weights
-    std::vector<double> class_counts(6, 0.0);
-    for (const auto& data : training_data) {
-        for (size_t i = 0; i < data.target.size(); i++) {
-            if (data.target[i] == 1.0) {
-                class_counts[i]++;
-                break;
-            }
-        }
-    }
-    
     std::vector<double> class_weights(6);
     double total_samples = static_cast<double>(dataset_size);
     for (size_t i = 0; i < 6; i++) {
@@ -101,72 +242,407 @@ void train_model(const AnalyzerArgs& args, json::Value& network) {
         }
     }
     
-    std::cout << "Training on " << dataset_size << " samples" << std::endl;
-    std::cout << "Learning rate: " << learning_rate << " (base: " << base_learning_rate << ")" << std::endl;
-    std::cout << "Class weights: [";
+    out << "Training on " << dataset_size << " samples" << std::endl;
+    out << "Learning rate: " << learning_rate << " (base: " << base_learning_rate << ")" << std::endl;
+    out << "Class weights: [";
     for (size_t i = 0; i < class_weights.size(); i++) {
-        std::cout << class_weights[i];
-        if (i < class_weights.size() - 1) std::cout << ", ";
+        out << class_weights[i];
+        if (i < class_weights.size() - 1) out << ", ";
+    }
+    out << "]" << std::endl;
+    out << "Epochs: " << epochs << std::endl;
+    out << "Batch size: " << args.batch_size << std::endl;
+    out << "Threads: " << pool.size() << " (kernels: " << kernel_isa() << ")" << std::endl;
+    out << "Precision: " << precision_to_string(precision_of<Real>()) << std::endl;
+    out << "Optimizer: " << optimizer_to_string(network.optimizer.kind);
+    if (network.optimizer_step > 0) {
+        out << " (resuming after " << network.optimizer_step << " steps)";
+    }
+    out << std::endl;
+    if (stream) {
+        out << "Streaming: shuffle window of " << args.shuffle_buffer << " samples" << std::endl;
+    }
+    if (validating) {
+        out << "Validation: " << validation_rows.size() << " samples";
+        if (args.val_split > 0.0) {
+            out << " held out";
+        } else {
+            out << " from " << args.validation_file;
+        }
+        out << std::endl;
+    }
+    if (args.resume) {
+        out << "Resuming from " << args.checkpoint_file << " at epoch " << (state.epoch + 1) << ", sample " << state.position << std::endl;
     }
-    std::cout << "]" << std::endl;
-    std::cout << "Epochs: " << epochs << std::endl;
     
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    DatasetBlock block;
+    if (args.resume && !stream) {
+        // Each epoch shuffles the previous order: replay them to rebuild it
+        for (uint32_t epoch = 0; epoch < state.epoch; epoch++) {
+            std::shuffle(order.begin(), order.end(), gen);
+        }
+        if (rng_to_string(gen) != state.rng_state) {
+            throw std::runtime_error("Corrupted checkpoint: " + args.checkpoint_file);
+        }
+    }
     
-    int no_improvement_count = 0;
-    double best_loss = 1e9;
+    // Per-thread buffers, allocated once for the whole run
+    BasicWorkspace<Real> workspace(network);
+    std::vector<Shard<Real>> shards(pool.size());
+    std::vector<EvaluationScratch<Real>> evaluation_scratch(pool.size());
+    auto train_on = [&](const Dataset& data, const std::vector<size_t>& data_order, size_t begin, size_t end, double lr, double& loss) {
+        if (args.batch_size > 1) {
+            train_epoch_batched(network, data, data_order, begin, end, class_weights, lr, args.batch_size, pool, shards, loss);
+        } else {
+            train_epoch(network, data, data_order, begin, end, class_weights, lr, workspace, loss);
+        }
+    };
+
+    // Checkpoints are written in the background between two segments of an epoch
+    std::unique_ptr<CheckpointWriter<Real>> checkpoints;
+    if (args.checkpoint_every > 0 || args.checkpoint_minutes > 0) {
+        checkpoints = std::make_unique<CheckpointWriter<Real>>(args.checkpoint_file);
+        out << "Checkpoints: " << args.checkpoint_file << std::endl;
+    }
+    size_t steps_since_checkpoint = 0;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    auto maybe_checkpoint = [&](size_t samples) {
+        if (!checkpoints) return;
+        steps_since_checkpoint += (samples + args.batch_size - 1) / args.batch_size;
+        auto now = std::chrono::steady_clock::now();
+        double minutes = std::chrono::duration<double>(now - last_checkpoint).count() / 60.0;
+        if ((args.checkpoint_every > 0 && steps_since_checkpoint >= static_cast<size_t>(args.checkpoint_every))
+            || (args.checkpoint_minutes > 0 && minutes >= args.checkpoint_minutes)) {
+            PROFILE_SCOPE("checkpoint");
+            checkpoints->write(network, best_network.layers.empty() ? nullptr : &best_network, state);
+            steps_since_checkpoint = 0;
+            last_checkpoint = now;
+        }
+    };
+    // With checkpoints, every mini-batch is followed by a check; otherwise
+    // epochs are not split
+    const size_t segment = checkpoints ? args.batch_size : dataset_size;
     
-    for (int epoch = 0; epoch < epochs; epoch++) {
-        double total_loss = 0.0;
-        
-        std::shuffle(training_data.begin(), training_data.end(), gen);
-        
+    int no_improvement_count = state.no_improvement_count;
+    double best_loss = state.best_loss;
+    double best_validation_loss = state.best_validation_loss;
+    // Report of best_network; a resumed run only knows it from its own epochs
+    EvaluationReport best_report;
+    
+    // Loading and setup get a report of their own, so that epochs only time training
+    if (input.profile_epochs && profile_enabled()) {
+        profile_report(std::cerr, "setup");
+    }
+    for (int epoch = state.epoch; epoch < epochs; epoch++) {
         // Adaptive learning rate: reduce by half each epoch after epoch 1 if loss is high
         double current_lr = learning_rate;
         if (epoch > 0 && best_loss > 5.0) {
             current_lr = learning_rate * std::pow(0.95, epoch);
         }
         
-        for (size_t i = 0; i < training_data.size(); i++) {
-            ForwardCache cache;
-            auto output = forward_pass(network, training_data[i].input, cache);
-            double loss = cross_entropy_loss(output, training_data[i].target, class_weights);
-            total_loss += loss;
-            
-            // Skip updates with extreme loss to prevent divergence
-            if (loss > 10.0) continue;
-            
-            backward_pass(network, cache, training_data[i].target, current_lr, true);
+        // The generator as it is now replays this epoch's shuffle on resume
+        state.epoch = epoch;
+        state.rng_state = rng_to_string(gen);
+        const uint64_t resume_at = state.position;
+        double total_loss = state.epoch_loss;
+        if (stream) {
+            stream->begin_epoch(gen);
+            uint64_t skipped = 0;
+            while (stream->next(STREAM_BLOCK_BATCHES * args.batch_size, gen, block)) {
+                // Samples trained before the checkpoint are read again but skipped
+                size_t first = 0;
+                if (skipped < resume_at) {
+                    if (skipped + block.size() <= resume_at) {
+                        skipped += block.size();
+                        continue;
+                    }
+                    first = resume_at - skipped;
+                    skipped = resume_at;
+                }
+                order.resize(block.size());
+                std::iota(order.begin(), order.end(), 0);
+                for (size_t begin = first; begin < block.size(); begin += segment) {
+                    size_t end = std::min(begin + segment, block.size());
+                    double block_loss = 0.0;
+                    train_on(block.view(), order, begin, end, current_lr, block_loss);
+                    total_loss += block_loss;
+                    state.position += end - begin;
+                    PROFILE_COUNT("samples", end - begin);
+                    state.epoch_loss = total_loss;
+                    maybe_checkpoint(end - begin);
+                }
+            }
+        } else {
+            std::shuffle(order.begin(), order.end(), gen);
+            for (size_t begin = resume_at; begin < dataset_size; begin += segment) {
+                size_t end = std::min(begin + segment, dataset_size);
+                train_on(dataset, order, begin, end, current_lr, total_loss);
+                state.position = end;
+                PROFILE_COUNT("samples", end - begin);
+                state.epoch_loss = total_loss;
+                maybe_checkpoint(end - begin);
+            }
         }
         
-        double avg_loss = total_loss / training_data.size();
+        double avg_loss = total_loss / dataset_size;
         
-        std::cout << "Epoch " << (epoch + 1) << "/" << epochs 
+        out << "Epoch " << (epoch + 1) << "/" << epochs 
                   << ", Loss: " << avg_loss << " (lr: " << current_lr << ")" << std::endl;
         
+        // Patience counts epochs without a better validation loss when there is
+        // a validation set, without a better training loss otherwise
+        bool improved = avg_loss < best_loss;
+        if (validating) {
+            PROFILE_SCOPE("validation");
+            EvaluationReport report = evaluate_network(network, validation, validation_rows, pool, evaluation_scratch);
+            print_evaluation(report, out);
+            improved = report.loss() < best_validation_loss;
+            if (improved) {
+                best_validation_loss = report.loss();
+                best_network = network;
+                best_report = report;
+                state.best_validation_loss = best_validation_loss;
+                state.best_epoch = epoch + 1;
+            }
+        }
+        if (input.profile_epochs && profile_enabled()) {
+            profile_report(std::cerr, "epoch " + std::to_string(epoch + 1));
+        }
+        
         // Early stopping
         if (avg_loss < early_stop_threshold) {
-            std::cout << "Loss below threshold (" << early_stop_threshold << "), stopping early!" << std::endl;
+            out << "Loss below threshold (" << early_stop_threshold << "), stopping early!" << std::endl;
             break;
         }
         
-        if (avg_loss < best_loss) {
-            best_loss = avg_loss;
+        best_loss = std::min(best_loss, avg_loss);
+        if (improved) {
             no_improvement_count = 0;
         } else {
             no_improvement_count++;
             if (no_improvement_count >= patience) {
-                std::cout << "No improvement for " << patience << " epochs, stopping early!" << std::endl;
+                out << "No improvement for " << patience << " epochs, stopping early!" << std::endl;
                 break;
             }
         }
+        state.position = 0;
+        state.epoch_loss = 0.0;
+        state.best_loss = best_loss;
+        state.no_improvement_count = no_improvement_count;
     }
     
     // Save
-    std::ofstream out(args.save_file);
-    out << json::stringify(network, false);
-    out.close();
+    if (checkpoints) {
+        checkpoints->flush();
+    }
+    if (!best_network.layers.empty()) {
+        out << "Best validation loss: " << best_validation_loss << " at epoch " << state.best_epoch << std::endl;
+    }
+    // The weights may still point into LOADFILE, which save_path may replace
+    own_parameters(network);
+    save_network(best_network.layers.empty() ? network : best_network, save_path);
+    // The finished run supersedes its checkpoint
+    if (checkpoints || args.resume) {
+        std::remove(args.checkpoint_file.c_str());
+    }
     
-    std::cout << "Training complete. Network saved to " << args.save_file << std::endl;
+    out << "Training complete. Network saved to " << save_path << std::endl;
+    return best_report;
 }
+
+template <typename Real>
+void train_model(const AnalyzerArgs& args, BasicNetwork<Real>& network) {
+    // Online training is sequential, only the validation set can use more threads
+    const bool validating = !args.validation_file.empty() || args.val_split > 0.0;
+    ThreadPool pool(resolve_thread_count(args.threads));
+    if (pool.size() > 1 && args.batch_size == 1 && !validating) {
+        throw std::runtime_error("--threads needs mini-batches, use --batch-size");
+    }
+    
+    // A resumed run takes its network, optimizer state and position from the checkpoint
+    TrainingState state;
+    // Network of the epoch with the best validation loss, empty until there is one
+    BasicNetwork<Real> best_network;
+    if (args.resume) {
+        network = load_checkpoint<Real>(args.checkpoint_file, state, best_network);
+    }
+    
+    if (network.layers.front().inputs != FEN_INPUT_SIZE) {
+        throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+    }
+    
+    // Either the whole mapped cache, or a bounded window over it
+    Dataset dataset;
+    std::unique_ptr<DatasetStream> stream;
+    std::vector<double> class_counts(6, 0.0);
+    if (args.stream) {
+        stream = std::make_unique<DatasetStream>(args.data_file, args.shuffle_buffer, args.verify_cache);
+        class_counts = stream->class_counts(class_counts.size());
+    } else {
+        PROFILE_SCOPE("load dataset");
+        dataset = load_dataset(args.data_file, args.verify_cache);
+    }
+    
+    std::mt19937 gen;
+    if (args.resume) {
+        std::istringstream in(stream ? state.rng_state : state.run_rng_state);
+        in >> gen;
+        if (!in) {
+            throw std::runtime_error("Corrupted checkpoint: " + args.checkpoint_file);
+        }
+    } else {
+        seed_generator(args, gen);
+        state.run_rng_state = rng_to_string(gen);
+    }
+    
+    // Samples are visited through a shuffled index, the mapped cache stays read-only
+    std::vector<size_t> order(stream ? 0 : dataset.size());
+    std::iota(order.begin(), order.end(), 0);
+    
+    // Held-out samples leave the order before anything is counted on it. The
+    // split is drawn from the run's generator, so a resumed run redraws it.
+    Dataset validation;
+    std::vector<size_t> validation_rows;
+    hold_out_validation(args, dataset, gen, order, validation, validation_rows);
+    if (validating && validation_rows.empty()) {
+        throw std::runtime_error("No validation samples");
+    }
+    if (!stream) {
+        for (size_t i : order) {
+            class_counts[dataset.labels[i]]++;
+        }
+    }
+    
+    TrainingInput input;
+    input.dataset = &dataset;
+    input.stream = stream.get();
+    input.order = std::move(order);
+    input.validation = &validation;
+    input.validation_rows = &validation_rows;
+    input.class_counts = class_counts;
+    input.gen = gen;
+    run_training(args, network, input, state, best_network, pool, std::cout, args.save_file);
+}
+
+// Outcome of one network of a sweep
+struct SweepResult {
+    std::string path;
+    EvaluationReport report;
+    double seconds = 0.0;
+    std::string error;
+};
+
+// One network of a sweep, trained on its own thread: it gets a copy of the
+// shuffled order and of the generator, and reads the shared datasets
+template <typename Real>
+static EvaluationReport train_sweep_network(const AnalyzerArgs& args, BasicNetwork<Real> network, const TrainingInput& shared, const std::string& path, std::ostream& out) {
+    if (network.layers.front().inputs != FEN_INPUT_SIZE) {
+        throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+    }
+    TrainingInput input = shared;
+    input.profile_epochs = false;
+    TrainingState state;
+    BasicNetwork<Real> best_network;
+    ThreadPool pool(1);
+    return run_training(args, network, input, state, best_network, pool, out, path);
+}
+
+void sweep_models(const AnalyzerArgs& args) {
+    // Loaded, split and counted once for every network
+    Dataset dataset;
+    {
+        PROFILE_SCOPE("load dataset");
+        dataset = load_dataset(args.data_file, args.verify_cache);
+    }
+    std::mt19937 gen;
+    seed_generator(args, gen);
+    std::vector<size_t> order(dataset.size());
+    std::iota(order.begin(), order.end(), 0);
+    Dataset validation;
+    std::vector<size_t> validation_rows;
+    hold_out_validation(args, dataset, gen, order, validation, validation_rows);
+    if (validation_rows.empty()) {
+        throw std::runtime_error("No validation samples");
+    }
+    
+    TrainingInput input;
+    input.dataset = &dataset;
+    input.order = std::move(order);
+    input.validation = &validation;
+    input.validation_rows = &validation_rows;
+    input.class_counts.assign(6, 0.0);
+    for (size_t i : input.order) {
+        input.class_counts[dataset.labels[i]]++;
+    }
+    input.gen = gen;
+    
+    const std::vector<std::string>& files = args.sweep_files;
+    ThreadPool pool(std::min(resolve_thread_count(args.threads), files.size()));
+    std::cout << "Sweep: " << files.size() << " networks on " << input.order.size() << " samples, "
+              << validation_rows.size() << " validation samples, " << pool.size() << " at a time" << std::endl;
+    
+    // Workers take the next network until none is left; each log is printed whole
+    std::vector<SweepResult> results(files.size());
+    std::atomic<size_t> next{0};
+    std::mutex output_mutex;
+    pool.run(pool.size(), [&](size_t) {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            SweepResult& result = results[i];
+            result.path = files[i];
+            std::ostringstream log;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                Network network = load_network<double>(files[i]);
+                // Without --precision, networks stored in fp32 stay in fp32
+                if (args.precision == "fp32" || (args.precision.empty() && network.precision == Precision::Fp32)) {
+                    result.report = train_sweep_network(args, network_cast<float>(network), input, files[i], log);
+                } else {
+                    result.report = train_sweep_network(args, std::move(network), input, files[i], log);
+                }
+            } catch (const std::exception& e) {
+                result.error = e.what();
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "=== " << files[i] << " ===" << std::endl << log.str();
+            if (!result.error.empty()) {
+                std::cout << "error: " << result.error << std::endl;
+            }
+        }
+    });
+    
+    // Best accuracy first, then lowest loss; failed networks last
+    std::vector<size_t> ranking(results.size());
+    std::iota(ranking.begin(), ranking.end(), 0);
+    std::stable_sort(ranking.begin(), ranking.end(), [&](size_t a, size_t b) {
+        const SweepResult& x = results[a];
+        const SweepResult& y = results[b];
+        if (x.error.empty() != y.error.empty()) return x.error.empty();
+        if (!x.error.empty()) return false;
+        if (x.report.accuracy() != y.report.accuracy()) return x.report.accuracy() > y.report.accuracy();
+        return x.report.loss() < y.report.loss();
+    });
+    
+    size_t failed = 0;
+    std::cout << std::endl << "Leaderboard (validation accuracy of the saved networks):" << std::endl;
+    for (size_t rank = 0; rank < ranking.size(); rank++) {
+        const SweepResult& result = results[ranking[rank]];
+        std::ostringstream line;
+        line << std::setw(4) << (rank + 1) << ". ";
+        if (result.error.empty()) {
+            line << std::fixed << std::setprecision(2) << std::setw(6) << result.report.accuracy() * 100.0 << "%  loss "
+                 << std::setprecision(4) << result.report.loss() << "  " << std::setprecision(1) << std::setw(6) << result.seconds << " s  " << result.path;
+        } else {
+            line << "failed  " << result.path << ": " << result.error;
+            failed++;
+        }
+        std::cout << line.str() << std::endl;
+    }
+    if (failed > 0) {
+        throw std::runtime_error(std::to_string(failed) + " of " + std::to_string(results.size()) + " networks failed to train");
+    }
+}
+
+template void train_model<double>(const AnalyzerArgs& args, Network& network);
+template void train_model<float>(const AnalyzerArgs& args, BasicNetwork<float>& network);
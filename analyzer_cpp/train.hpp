@@ -1,5 +1,11 @@
 #pragma once
 #include "parsor.hpp"
-#include "../include/json_parser.hpp"
+#include "model.hpp"
 
-void train_model(const AnalyzerArgs& args, json::Value& network);
+template <typename Real>
+void train_model(const AnalyzerArgs& args, BasicNetwork<Real>& network);
+
+// Trains every network of args.sweep_files, args.threads at a time, against
+// one dataset and validation split loaded once, saving each over its own
+// file; ends with a leaderboard of their validation accuracy
+void sweep_models(const AnalyzerArgs& args);
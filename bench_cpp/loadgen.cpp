@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Load generator for my_torch_analyzer --serve: clients send FEN lines over
+// the Unix socket, each keeping up to --depth requests in flight, and the
+// latency of every request is measured from its send to its reply.
+using Clock = std::chrono::steady_clock;
+
+struct LoadArgs {
+    std::string socket_path;
+    std::string data_file;
+    int clients = 4;
+    int requests = 10000;
+    int depth = 1;
+};
+
+struct ClientResult {
+    std::vector<double> latencies_us;
+    size_t errors = 0;
+    std::string failure;
+};
+
+static int connect_unix(const std::string& path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    path.copy(addr.sun_path, path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Cannot connect to " + path);
+    }
+    return fd;
+}
+
+static void write_all(int fd, const std::string& text) {
+    size_t done = 0;
+    while (done < text.size()) {
+        ssize_t n = send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+        if (n <= 0) {
+            throw std::runtime_error("Connection closed by the server");
+        }
+        done += n;
+    }
+}
+
+// Sends lines[first], lines[first + 1], ... (wrapping around) count times
+static void run_client(const LoadArgs& args, const std::vector<std::string>& lines, size_t first, size_t count, ClientResult& result) {
+    try {
+        int fd = connect_unix(args.socket_path);
+        std::deque<Clock::time_point> in_flight;
+        std::string buffer;
+        char chunk[4096];
+        size_t sent = 0;
+        size_t received = 0;
+        result.latencies_us.reserve(count);
+        
+        while (received < count) {
+            while (sent < count && in_flight.size() < static_cast<size_t>(args.depth)) {
+                in_flight.push_back(Clock::now());
+                write_all(fd, lines[(first + sent) % lines.size()] + "\n");
+                sent++;
+            }
+            
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) {
+                close(fd);
+                throw std::runtime_error("Connection closed by the server");
+            }
+            Clock::time_point now = Clock::now();
+            buffer.append(chunk, n);
+            size_t start = 0;
+            size_t end;
+            while ((end = buffer.find('\n', start)) != std::string::npos) {
+                if (buffer.compare(start, 6, "error:") == 0) result.errors++;
+                result.latencies_us.push_back(std::chrono::duration<double, std::micro>(now - in_flight.front()).count());
+                in_flight.pop_front();
+                received++;
+                start = end + 1;
+            }
+            buffer.erase(0, start);
+        }
+        close(fd);
+    } catch (const std::exception& e) {
+        result.failure = e.what();
+    }
+}
+
+// Value below which a fraction q of the sorted samples fall
+static double percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0.0;
+    size_t index = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static LoadArgs parse_arguments(int argc, char* argv[]) {
+    LoadArgs args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--clients" || arg == "--requests" || arg == "--depth") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " requires a value");
+            }
+            int value = std::atoi(argv[++i]);
+            if (value <= 0) {
+                throw std::runtime_error(arg + " must be > 0");
+            }
+            if (arg == "--clients") args.clients = value;
+            else if (arg == "--requests") args.requests = value;
+            else args.depth = value;
+        } else if (args.socket_path.empty()) {
+            args.socket_path = arg;
+        } else if (args.data_file.empty()) {
+            args.data_file = arg;
+        }
+    }
+    if (args.socket_path.empty() || args.data_file.empty()) {
+        throw std::runtime_error("USAGE: ./my_torch_loadgen [--clients N] [--requests N] [--depth D] SOCKET FILE");
+    }
+    return args;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        LoadArgs args = parse_arguments(argc, argv);
+        std::ifstream file(args.data_file);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open data file: " + args.data_file);
+        }
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty()) lines.push_back(line);
+        }
+        if (lines.empty()) {
+            throw std::runtime_error("No positions in " + args.data_file);
+        }
+        
+        // Requests are split evenly, each client starting at another line
+        std::vector<ClientResult> results(args.clients);
+        std::vector<std::thread> clients;
+        auto start = Clock::now();
+        for (int c = 0; c < args.clients; c++) {
+            size_t count = static_cast<size_t>(args.requests) * (c + 1) / args.clients - static_cast<size_t>(args.requests) * c / args.clients;
+            size_t first = lines.size() * c / args.clients;
+            clients.emplace_back(run_client, std::cref(args), std::cref(lines), first, count, std::ref(results[c]));
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        
+        std::vector<double> latencies;
+        size_t errors = 0;
+        for (const auto& result : results) {
+            if (!result.failure.empty()) {
+                throw std::runtime_error(result.failure);
+            }
+            latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+            errors += result.errors;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        
+        std::cout << std::fixed << std::setprecision(0);
+        std::cout << latencies.size() << " requests from " << args.clients << " clients (depth " << args.depth << ") in "
+                  << std::setprecision(3) << seconds << " s, " << errors << " errors" << std::endl;
+        std::cout << std::setprecision(0);
+        std::cout << "Throughput: " << latencies.size() / seconds << " requests/s" << std::endl;
+        std::cout << "Latency: p50 " << percentile(latencies, 0.50) << " us, p90 " << percentile(latencies, 0.90)
+                  << " us, p99 " << percentile(latencies, 0.99) << " us, max " << (latencies.empty() ? 0.0 : latencies.back()) << " us" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 84;
+    }
+    
+    return 0;
+}
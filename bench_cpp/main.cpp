@@ -0,0 +1,419 @@
+#include "fen_parser.hpp"
+#include "dataset.hpp"
+#include "kernels.hpp"
+#include "model_io.hpp"
+#include "network.hpp"
+#include "json_parser.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Benchmark suite: FEN encoders, network passes, training epochs and network
+// I/O. Each case runs its whole workload --warmup times untimed, then
+// --repetitions times timed; the median and p95 of the repetitions are reported.
+static const char* DEFAULT_FEN_FILE = "data/dataset/checkmate/10_pieces.txt";
+static const char* DEFAULT_DATA_FILE = "data/test/test_heavy.txt";
+static const char* DEFAULT_NETWORK_FILE = "my_torch_network.nn";
+// Samples per forward_batch_sparse / backward_batch call
+static const size_t BENCH_BATCH = 128;
+// Mini-batch of the batched training epoch
+static const size_t TRAIN_BATCH = 32;
+
+struct BenchOptions {
+    std::string fen_file = DEFAULT_FEN_FILE;
+    std::string data_file = DEFAULT_DATA_FILE;
+    std::string network_file = DEFAULT_NETWORK_FILE;
+    std::string json_file;
+    // Only the cases whose name contains it
+    std::string filter;
+    std::string precision = "fp64";
+    int warmup = 2;
+    int repetitions = 10;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string unit;
+    size_t items = 0;
+    // Sorted
+    std::vector<double> seconds;
+};
+
+// Nearest-rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double q) {
+    size_t rank = static_cast<size_t>(q * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+class BenchSuite {
+public:
+    explicit BenchSuite(const BenchOptions& options) : options(options) {}
+    
+    // fn runs one repetition over items units and returns a checksum, which
+    // keeps the compiler from dropping the work
+    template <typename Fn>
+    void run(const std::string& name, const std::string& unit, size_t items, Fn fn) {
+        using clock = std::chrono::steady_clock;
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+        
+        uint64_t checksum = 0;
+        for (int i = 0; i < options.warmup; i++) {
+            checksum += fn();
+        }
+        BenchResult result;
+        result.name = name;
+        result.unit = unit;
+        result.items = items;
+        for (int i = 0; i < options.repetitions; i++) {
+            auto start = clock::now();
+            checksum += fn();
+            result.seconds.push_back(std::chrono::duration<double>(clock::now() - start).count());
+        }
+        std::sort(result.seconds.begin(), result.seconds.end());
+        
+        double median = percentile(result.seconds, 0.5);
+        std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(11) << median * 1e3 << " ms" << std::setw(11) << percentile(result.seconds, 0.95) * 1e3 << " ms"
+                  << std::setprecision(0) << std::setw(14) << items / median << " " << unit << "/s"
+                  << "  (checksum " << checksum << ")" << std::endl;
+        results.push_back(std::move(result));
+    }
+    
+    void write_json(const std::string& path, const std::string& precision) const {
+        json::Value root;
+        root["kernels"] = kernel_isa();
+        root["precision"] = precision;
+        root["warmup"] = options.warmup;
+        root["repetitions"] = options.repetitions;
+        json::Array cases;
+        for (const auto& result : results) {
+            json::Value item;
+            double median = percentile(result.seconds, 0.5);
+            item["name"] = result.name;
+            item["unit"] = result.unit;
+            item["items"] = static_cast<double>(result.items);
+            item["median_seconds"] = median;
+            item["p95_seconds"] = percentile(result.seconds, 0.95);
+            item["min_seconds"] = result.seconds.front();
+            item["max_seconds"] = result.seconds.back();
+            item["items_per_second"] = result.items / median;
+            json::Array seconds(result.seconds.begin(), result.seconds.end());
+            item["seconds"] = json::Value(std::move(seconds));
+            cases.push_back(std::move(item));
+        }
+        root["benchmarks"] = json::Value(std::move(cases));
+        
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            throw std::runtime_error("Cannot write benchmark results: " + path);
+        }
+        json::write(out, root, false);
+        out << "\n";
+    }
+
+private:
+    const BenchOptions& options;
+    std::vector<BenchResult> results;
+};
+
+static std::vector<std::string> read_lines(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open data file: " + path);
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    return lines;
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file: " + path);
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+static void run_encoder_benches(BenchSuite& suite, const std::vector<std::string>& lines) {
+    auto each = [&](auto encode) {
+        return [&lines, encode]() {
+            uint64_t checksum = 0;
+            for (const auto& line : lines) {
+                checksum += encode(line);
+            }
+            return checksum;
+        };
+    };
+    
+    suite.run("fen_to_features", "positions", lines.size(), each([](const std::string& fen) {
+        return fen_to_features(fen).size();
+    }));
+    suite.run("fen_to_vector", "positions", lines.size(), each([](const std::string& fen) {
+        return static_cast<size_t>(fen_to_vector(fen)[FEN_INPUT_SIZE - 1] != 0.0);
+    }));
+    suite.run("encode_fen_features", "positions", lines.size(), each([](const std::string& fen) {
+        uint16_t active[FEN_MAX_FEATURES];
+        int count = 0;
+        encode_fen_features(fen, active, count);
+        return static_cast<size_t>(count);
+    }));
+    suite.run("encode_fen_features+key", "positions", lines.size(), each([](const std::string& fen) {
+        uint16_t active[FEN_MAX_FEATURES];
+        int count = 0;
+        uint64_t key = 0;
+        encode_fen_features(fen, active, count, key);
+        return static_cast<size_t>(key) + count;
+    }));
+    suite.run("hash_fen", "positions", lines.size(), each([](const std::string& fen) {
+        uint64_t key = 0;
+        hash_fen(fen, key);
+        return static_cast<size_t>(key);
+    }));
+    std::vector<float> dense(FEN_INPUT_SIZE);
+    suite.run("encode_fen_dense", "positions", lines.size(), each([&dense](const std::string& fen) {
+        encode_fen_dense(fen, dense.data());
+        return static_cast<size_t>(dense[FEN_INPUT_SIZE - 1]);
+    }));
+    suite.run("encode_fen_bitboards", "positions", lines.size(), each([](const std::string& fen) {
+        FenBitboards boards;
+        encode_fen_bitboards(fen, boards);
+        return static_cast<size_t>(boards.pieces[5] != 0);
+    }));
+}
+
+// Checksum of a floating-point result
+static uint64_t checksum_of(double value) {
+    return static_cast<uint64_t>(static_cast<int64_t>(value * 1e6));
+}
+
+template <typename Real>
+static void run_network_benches(BenchSuite& suite, const BasicNetwork<Real>& network, const Dataset& data) {
+    const size_t samples = data.size();
+    const size_t output_size = network.layers.back().outputs;
+    std::vector<std::vector<int>> features(samples);
+    std::vector<std::vector<double>> targets(samples, std::vector<double>(output_size, 0.0));
+    for (size_t i = 0; i < samples; i++) {
+        features[i].assign(data.features_begin(i), data.features_end(i));
+        targets[i][data.labels[i]] = 1.0;
+    }
+    
+    suite.run("forward_pass", "samples", samples, [&]() {
+        BasicForwardCache<Real> cache;
+        std::vector<Real> input(FEN_INPUT_SIZE);
+        double sum = 0.0;
+        for (size_t i = 0; i < samples; i++) {
+            std::fill(input.begin(), input.end(), Real(0));
+            for (int feature : features[i]) input[feature] = Real(1);
+            sum += forward_pass(network, input, cache)[0];
+        }
+        return checksum_of(sum);
+    });
+    suite.run("forward_sparse", "samples", samples, [&]() {
+        BasicForwardCache<Real> cache;
+        double sum = 0.0;
+        for (size_t i = 0; i < samples; i++) {
+            sum += forward_sparse(network, features[i], cache)[0];
+        }
+        return checksum_of(sum);
+    });
+    
+    // Batches are built once; the batched cases only time the network
+    std::vector<SparseBatch> batches;
+    for (size_t start = 0; start < samples; start += BENCH_BATCH) {
+        batches.emplace_back();
+        for (size_t i = start; i < std::min(start + BENCH_BATCH, samples); i++) {
+            batches.back().add(features[i]);
+        }
+    }
+    BasicBatchCache<Real> batch_cache;
+    suite.run("forward_batch_sparse", "samples", samples, [&]() {
+        double sum = 0.0;
+        for (const auto& batch : batches) {
+            sum += forward_batch_sparse(network, batch, batch_cache)[0];
+        }
+        return checksum_of(sum);
+    });
+    
+    // Backward passes read the caches of forward passes run beforehand
+    BasicNetwork<Real> scratch_network = network;
+    std::vector<BasicForwardCache<Real>> forward_caches(samples);
+    for (size_t i = 0; i < samples; i++) {
+        forward_sparse(network, features[i], forward_caches[i]);
+    }
+    suite.run("backward_pass", "samples", samples, [&]() {
+        double sum = 0.0;
+        for (size_t i = 0; i < samples; i++) {
+            sum += backward_pass(scratch_network, forward_caches[i], targets[i], 0.0, false).biases.back()[0];
+        }
+        return checksum_of(sum);
+    });
+    
+    std::vector<BasicBatchCache<Real>> batch_caches(batches.size());
+    std::vector<std::vector<double>> batch_targets(batches.size());
+    for (size_t b = 0; b < batches.size(); b++) {
+        forward_batch_sparse(network, batches[b], batch_caches[b]);
+        for (size_t i = b * BENCH_BATCH; i < std::min((b + 1) * BENCH_BATCH, samples); i++) {
+            batch_targets[b].insert(batch_targets[b].end(), targets[i].begin(), targets[i].end());
+        }
+    }
+    BasicGradients<Real> grads;
+    suite.run("backward_batch", "samples", samples, [&]() {
+        double sum = 0.0;
+        for (size_t b = 0; b < batches.size(); b++) {
+            std::vector<double> weights(batches[b].size(), 1.0);
+            backward_batch(network, batch_caches[b], batch_targets[b], weights, grads);
+            sum += grads.biases.back()[0];
+        }
+        return checksum_of(sum);
+    });
+    
+    // Full epochs in file order, each from a fresh copy of the network
+    const double learning_rate = network.learning_rate;
+    const std::vector<double> class_weights;
+    suite.run("train_epoch", "samples", samples, [&]() {
+        BasicNetwork<Real> trained = network;
+        BasicWorkspace<Real> workspace(trained);
+        double loss = 0.0;
+        for (size_t i = 0; i < samples; i++) {
+            loss += train_step(trained, data.features_begin(i), data.features_end(i), data.labels[i], class_weights, learning_rate, 10.0, workspace);
+        }
+        return checksum_of(loss);
+    });
+    suite.run("train_epoch_batch32", "samples", samples, [&]() {
+        BasicNetwork<Real> trained = network;
+        BasicBatchCache<Real> cache;
+        BasicGradients<Real> batch_grads;
+        SparseBatch inputs;
+        std::vector<double> batch_targets;
+        std::vector<double> weights;
+        double sum = 0.0;
+        for (size_t start = 0; start < samples; start += TRAIN_BATCH) {
+            size_t end = std::min(start + TRAIN_BATCH, samples);
+            inputs.clear();
+            batch_targets.clear();
+            for (size_t i = start; i < end; i++) {
+                inputs.add(features[i]);
+                batch_targets.insert(batch_targets.end(), targets[i].begin(), targets[i].end());
+            }
+            weights.assign(end - start, 1.0);
+            sum += forward_batch_sparse(trained, inputs, cache)[0];
+            backward_batch(trained, cache, batch_targets, weights, batch_grads);
+            scale_gradients(batch_grads, 1.0 / (end - start));
+            clip_gradients(batch_grads, 5.0);
+            apply_gradients(trained, batch_grads, learning_rate);
+        }
+        return checksum_of(sum);
+    });
+}
+
+static void run_io_benches(BenchSuite& suite, const std::string& network_file) {
+    std::string text = read_file(network_file);
+    json::Value parsed = json::parse(text);
+    Network network = network_from_json<double>(parsed);
+    
+    suite.run("json_parse", "bytes", text.size(), [&]() {
+        return static_cast<uint64_t>(json::parse(text).size());
+    });
+    suite.run("json_stringify", "bytes", text.size(), [&]() {
+        return static_cast<uint64_t>(json::stringify(parsed).size());
+    });
+    suite.run("json_load_network", "bytes", text.size(), [&]() {
+        return static_cast<uint64_t>(load_network<double>(network_file).layers.size());
+    });
+    suite.run("json_save_network", "bytes", text.size(), [&]() {
+        std::ostringstream out;
+        write_network_json(network, out);
+        return static_cast<uint64_t>(out.tellp());
+    });
+}
+
+static BenchOptions parse_arguments(int argc, char* argv[]) {
+    BenchOptions options;
+    bool has_fen_file = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool takes_value = arg == "--data" || arg == "--network" || arg == "--json" || arg == "--filter"
+            || arg == "--precision" || arg == "--warmup" || arg == "--repetitions";
+        if (takes_value && i + 1 >= argc) {
+            throw std::runtime_error(arg + " requires a value");
+        }
+        if (arg == "--data") {
+            options.data_file = argv[++i];
+        } else if (arg == "--network") {
+            options.network_file = argv[++i];
+        } else if (arg == "--json") {
+            options.json_file = argv[++i];
+        } else if (arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (arg == "--precision") {
+            options.precision = argv[++i];
+            if (options.precision != "fp32" && options.precision != "fp64") {
+                throw std::runtime_error("--precision must be fp32 or fp64");
+            }
+        } else if (arg == "--warmup") {
+            options.warmup = std::atoi(argv[++i]);
+            if (options.warmup < 0) {
+                throw std::runtime_error("--warmup must be >= 0");
+            }
+        } else if (arg == "--repetitions") {
+            options.repetitions = std::atoi(argv[++i]);
+            if (options.repetitions <= 0) {
+                throw std::runtime_error("--repetitions must be > 0");
+            }
+        } else if (!has_fen_file) {
+            options.fen_file = arg;
+            has_fen_file = true;
+        } else {
+            throw std::runtime_error("Unexpected argument: " + arg);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        BenchOptions options = parse_arguments(argc, argv);
+        BenchSuite suite(options);
+        
+        std::vector<std::string> lines = read_lines(options.fen_file);
+        Dataset data = load_dataset(options.data_file);
+        Network network = load_network<double>(options.network_file);
+        if (network.layers.front().inputs != FEN_INPUT_SIZE) {
+            throw std::runtime_error("Network input size must be " + std::to_string(FEN_INPUT_SIZE) + " to read FEN positions");
+        }
+        std::cout << lines.size() << " positions from " << options.fen_file << ", " << data.size() << " samples from " << options.data_file << std::endl;
+        std::cout << "Network: " << options.network_file << " (" << options.precision << ", kernels: " << kernel_isa() << ")" << std::endl;
+        std::cout << "Warmup: " << options.warmup << ", repetitions: " << options.repetitions << std::endl;
+        std::cout << std::left << std::setw(24) << "case" << std::right << std::setw(14) << "median" << std::setw(14) << "p95" << std::setw(20) << "throughput" << std::endl;
+        
+        run_encoder_benches(suite, lines);
+        if (options.precision == "fp32") {
+            run_network_benches(suite, network_cast<float>(network), data);
+        } else {
+            run_network_benches(suite, network, data);
+        }
+        run_io_benches(suite, options.network_file);
+        
+        if (!options.json_file.empty()) {
+            suite.write_json(options.json_file, options.precision);
+            std::cout << "Results written to " << options.json_file << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 84;
+    }
+    
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <random>
 #include <iostream>
+#include <stdexcept>
 
 static std::vector<std::vector<double>> init_weights(int input_size, int output_size) {
     static std::random_device rd;
@@ -25,6 +26,19 @@ static std::vector<double> init_biases(int output_size) {
     return std::vector<double>(output_size, 0.0);
 }
 
+// fp32 networks get float values, which also keeps their text short
+static void write_values(json::Writer& writer, const std::vector<double>& values, bool fp32) {
+    writer.begin_array();
+    for (double val : values) {
+        if (fp32) {
+            writer.number(static_cast<float>(val));
+        } else {
+            writer.number(val);
+        }
+    }
+    writer.end_array();
+}
+
 void generate_network(const std::string& config_file, const NetworkConfig& config, int n) {
     std::string base = config_file;
     size_t dot_pos = base.rfind(".conf");
@@ -32,77 +46,70 @@ void generate_network(const std::string& config_file, const NetworkConfig& confi
         base = base.substr(0, dot_pos);
     }
     
+    const bool fp32 = config.precision == "fp32";
+    
     for (int i = 1; i <= n; i++) {
         std::string filename = base + "_" + std::to_string(i) + ".nn";
         
-        json::Value network;
-        network.set_object({});
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot write network file: " + filename);
+        }
         
-        // Meta
-        json::Value meta;
-        meta.set_object({});
-        meta["learning_rate"] = json::Value(config.learning_rate);
-        network["meta"] = meta;
+        // Keys in sorted order, as the analyzer writes them
+        json::Writer writer(file);
+        writer.begin_object();
+        
+        // Biases
+        writer.key("biases");
+        writer.begin_array();
+        for (int size : config.layer_sizes) {
+            write_values(writer, init_biases(size), fp32);
+        }
+        writer.end_array();
         
         // Layers
-        json::Value layers;
-        std::vector<json::Value> layers_arr;
+        writer.key("layers");
+        writer.begin_array();
         int prev_size = config.input_size;
         for (size_t j = 0; j < config.layer_sizes.size(); j++) {
-            json::Value layer;
-            layer.set_object({});
-            layer["inputs"] = json::Value(prev_size);
-            layer["outputs"] = json::Value(config.layer_sizes[j]);
-            layer["activation"] = json::Value(config.activations[j]);
-            layers_arr.push_back(layer);
+            writer.begin_object();
+            writer.key("activation");
+            writer.string(config.activations[j]);
+            writer.key("inputs");
+            writer.number(static_cast<double>(prev_size));
+            writer.key("outputs");
+            writer.number(static_cast<double>(config.layer_sizes[j]));
+            writer.end_object();
             prev_size = config.layer_sizes[j];
         }
-        layers.set_array(layers_arr);
-        network["layers"] = layers;
+        writer.end_array();
+        
+        // Meta
+        writer.key("meta");
+        writer.begin_object();
+        writer.key("learning_rate");
+        writer.number(config.learning_rate);
+        writer.key("precision");
+        writer.string(config.precision);
+        writer.end_object();
         
         // Weights
-        json::Value weights;
-        std::vector<json::Value> weights_arr;
+        writer.key("weights");
+        writer.begin_array();
         prev_size = config.input_size;
         for (int size : config.layer_sizes) {
-            auto w = init_weights(prev_size, size);
-            std::vector<json::Value> w_layer;
-            for (const auto& row : w) {
-                std::vector<json::Value> w_row;
-                for (double val : row) {
-                    w_row.push_back(json::Value(val));
-                }
-                json::Value row_val;
-                row_val.set_array(w_row);
-                w_layer.push_back(row_val);
+            writer.begin_array();
+            for (const auto& row : init_weights(prev_size, size)) {
+                write_values(writer, row, fp32);
             }
-            json::Value layer_val;
-            layer_val.set_array(w_layer);
-            weights_arr.push_back(layer_val);
+            writer.end_array();
             prev_size = size;
         }
-        weights.set_array(weights_arr);
-        network["weights"] = weights;
-        
-        // Biases
-        json::Value biases;
-        std::vector<json::Value> biases_arr;
-        for (int size : config.layer_sizes) {
-            auto b = init_biases(size);
-            std::vector<json::Value> b_layer;
-            for (double val : b) {
-                b_layer.push_back(json::Value(val));
-            }
-            json::Value layer_val;
-            layer_val.set_array(b_layer);
-            biases_arr.push_back(layer_val);
-        }
-        biases.set_array(biases_arr);
-        network["biases"] = biases;
+        writer.end_array();
         
-        // Save to file
-        std::ofstream file(filename);
-        file << json::stringify(network, true);
+        writer.end_object();
+        writer.flush();
         file.close();
         
         std::cout << "Generated " << filename << std::endl;
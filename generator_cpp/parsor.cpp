@@ -77,6 +77,14 @@ NetworkConfig parse_config_file(const std::string& path) {
         config.learning_rate = 0.01;
     }
     
+    config.precision = "fp64";
+    if (raw_config.find("precision") != raw_config.end()) {
+        config.precision = raw_config["precision"];
+        if (config.precision != "fp32" && config.precision != "fp64") {
+            throw std::runtime_error("Invalid precision in config: " + config.precision);
+        }
+    }
+    
     return config;
 }
 
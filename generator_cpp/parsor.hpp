@@ -8,6 +8,8 @@ struct NetworkConfig {
     std::vector<int> layer_sizes;
     std::vector<std::string> activations;
     double learning_rate;
+    // "fp64" (default) or "fp32"
+    std::string precision;
 };
 
 NetworkConfig parse_config_file(const std::string& path);
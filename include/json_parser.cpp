@@ -1,183 +1,452 @@
 #include "json_parser.hpp"
+#include <algorithm>
+#include <charconv>
 #include <sstream>
-#include <cctype>
 #include <stdexcept>
 #include <cmath>
 
 namespace json {
 
-static void skip_whitespace(const std::string& s, size_t& pos) {
-    while (pos < s.size() && std::isspace(s[pos])) pos++;
+static const Value null_value;
+
+double Value::as_number() const {
+    if (const double* d = std::get_if<double>(&data)) return *d;
+    throw std::runtime_error("JSON value is not a number");
 }
 
-static std::string parse_string(const std::string& s, size_t& pos) {
-    if (s[pos] != '"') throw std::runtime_error("Expected '\"'");
-    pos++;
-    std::string result;
-    while (pos < s.size() && s[pos] != '"') {
-        if (s[pos] == '\\' && pos + 1 < s.size()) {
-            pos++;
-            if (s[pos] == 'n') result += '\n';
-            else if (s[pos] == 't') result += '\t';
-            else if (s[pos] == 'r') result += '\r';
-            else if (s[pos] == '\\') result += '\\';
-            else if (s[pos] == '"') result += '"';
-            else result += s[pos];
+const std::string& Value::as_string() const {
+    if (const std::string* s = std::get_if<std::string>(&data)) return *s;
+    throw std::runtime_error("JSON value is not a string");
+}
+
+bool Value::as_bool() const {
+    if (const bool* b = std::get_if<bool>(&data)) return *b;
+    throw std::runtime_error("JSON value is not a boolean");
+}
+
+const Array& Value::as_array() const {
+    if (const Array* a = std::get_if<Array>(&data)) return *a;
+    throw std::runtime_error("JSON value is not an array");
+}
+
+Array& Value::as_array() {
+    if (Array* a = std::get_if<Array>(&data)) return *a;
+    throw std::runtime_error("JSON value is not an array");
+}
+
+const Object& Value::as_object() const {
+    if (const Object* o = std::get_if<Object>(&data)) return *o;
+    throw std::runtime_error("JSON value is not an object");
+}
+
+static bool key_less(const std::pair<std::string, Value>& member, const std::string& key) {
+    return member.first < key;
+}
+
+void Value::set_object(Object o) {
+    std::stable_sort(o.begin(), o.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    // Keep the last duplicate, as repeated assignment would
+    Object unique;
+    unique.reserve(o.size());
+    for (auto& member : o) {
+        if (!unique.empty() && unique.back().first == member.first) {
+            unique.back().second = std::move(member.second);
         } else {
-            result += s[pos];
+            unique.push_back(std::move(member));
         }
-        pos++;
     }
-    if (pos >= s.size()) throw std::runtime_error("Unterminated string");
-    pos++;
-    return result;
+    data = std::move(unique);
+}
+
+void Value::push_back(Value v) {
+    if (std::holds_alternative<std::monostate>(data)) data = Array();
+    as_array().push_back(std::move(v));
+}
+
+Value& Value::operator[](const std::string& key) {
+    if (std::holds_alternative<std::monostate>(data)) data = Object();
+    Object* obj = std::get_if<Object>(&data);
+    if (!obj) throw std::runtime_error("JSON value is not an object");
+    
+    auto it = std::lower_bound(obj->begin(), obj->end(), key, key_less);
+    if (it == obj->end() || it->first != key) {
+        it = obj->emplace(it, key, Value());
+    }
+    return it->second;
 }
 
-static double parse_number(const std::string& s, size_t& pos) {
-    size_t start = pos;
-    if (s[pos] == '-') pos++;
-    while (pos < s.size() && std::isdigit(s[pos])) pos++;
-    if (pos < s.size() && s[pos] == '.') {
+const Value& Value::operator[](const std::string& key) const {
+    const Object* obj = std::get_if<Object>(&data);
+    if (!obj) return null_value;
+    auto it = std::lower_bound(obj->begin(), obj->end(), key, key_less);
+    return it != obj->end() && it->first == key ? it->second : null_value;
+}
+
+size_t Value::size() const {
+    if (const Array* a = std::get_if<Array>(&data)) return a->size();
+    if (const Object* o = std::get_if<Object>(&data)) return o->size();
+    return 0;
+}
+
+bool Value::has(const std::string& key) const {
+    const Object* obj = std::get_if<Object>(&data);
+    if (!obj) return false;
+    auto it = std::lower_bound(obj->begin(), obj->end(), key, key_less);
+    return it != obj->end() && it->first == key;
+}
+
+// Recursive descent over a character range, without copying the input
+class Parser {
+public:
+    explicit Parser(std::string_view s) : pos(s.data()), end(s.data() + s.size()) {}
+    
+    Value parse_document() {
+        Value result = parse_value();
+        skip_whitespace();
+        if (pos != end) throw std::runtime_error("Unexpected data after JSON value");
+        return result;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+    
+    void skip_whitespace() {
+        while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) pos++;
+    }
+    
+    char peek() {
+        if (pos >= end) throw std::runtime_error("Unexpected end of input");
+        return *pos;
+    }
+    
+    void expect(char c, const char* message) {
+        if (peek() != c) throw std::runtime_error(message);
+        pos++;
+    }
+    
+    bool consume_literal(std::string_view literal) {
+        if (static_cast<size_t>(end - pos) < literal.size() || std::string_view(pos, literal.size()) != literal) {
+            return false;
+        }
+        pos += literal.size();
+        return true;
+    }
+    
+    static void append_utf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+    
+    std::string parse_string() {
+        expect('"', "Expected '\"'");
+        std::string result;
+        while (true) {
+            // Copy the run of plain characters in one go
+            const char* run = pos;
+            while (pos < end && *pos != '"' && *pos != '\\') pos++;
+            result.append(run, pos);
+            if (pos >= end) throw std::runtime_error("Unterminated string");
+            if (*pos == '"') break;
+            
+            pos++;
+            char c = peek();
+            pos++;
+            switch (c) {
+                case 'n': result += '\n'; break;
+                case 't': result += '\t'; break;
+                case 'r': result += '\r'; break;
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'u': {
+                    unsigned code = 0;
+                    if (end - pos < 4) throw std::runtime_error("Invalid \\u escape");
+                    auto res = std::from_chars(pos, pos + 4, code, 16);
+                    if (res.ptr != pos + 4) throw std::runtime_error("Invalid \\u escape");
+                    pos += 4;
+                    append_utf8(result, code);
+                    break;
+                }
+                default: result += c; break;
+            }
+        }
+        pos++;
+        return result;
+    }
+    
+    double parse_number() {
+        const char* start = pos;
+        double val = 0.0;
+        auto res = std::from_chars(pos, end, val);
+        if (res.ec == std::errc::result_out_of_range) {
+            throw std::runtime_error("Invalid number (out of range): " + std::string(start, res.ptr));
+        }
+        if (res.ec != std::errc()) {
+            throw std::runtime_error("Invalid number");
+        }
+        pos = res.ptr;
+        if (std::isnan(val) || std::isinf(val)) {
+            throw std::runtime_error("Invalid number (NaN or Inf): " + std::string(start, pos));
+        }
+        return val;
+    }
+    
+    Value parse_array() {
+        expect('[', "Expected '['");
+        skip_whitespace();
+        
+        Array arr;
+        if (peek() != ']') {
+            while (true) {
+                arr.push_back(parse_value());
+                skip_whitespace();
+                if (peek() == ']') break;
+                expect(',', "Expected ',' or ']'");
+            }
+        }
         pos++;
-        while (pos < s.size() && std::isdigit(s[pos])) pos++;
+        return Value(std::move(arr));
     }
-    if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+    
+    Value parse_object() {
+        expect('{', "Expected '{'");
+        skip_whitespace();
+        
+        Object obj;
+        if (peek() != '}') {
+            while (true) {
+                skip_whitespace();
+                std::string key = parse_string();
+                skip_whitespace();
+                expect(':', "Expected ':'");
+                obj.emplace_back(std::move(key), parse_value());
+                skip_whitespace();
+                if (peek() == '}') break;
+                expect(',', "Expected ',' or '}'");
+            }
+        }
         pos++;
-        if (s[pos] == '+' || s[pos] == '-') pos++;
-        while (pos < s.size() && std::isdigit(s[pos])) pos++;
+        Value result;
+        result.set_object(std::move(obj));
+        return result;
     }
-    std::string num_str = s.substr(start, pos - start);
-    double val = std::stod(num_str);
-    if (std::isnan(val) || std::isinf(val)) {
-        throw std::runtime_error("Invalid number (NaN or Inf): " + num_str);
+    
+    Value parse_value() {
+        skip_whitespace();
+        char c = peek();
+        
+        if (c == '"') {
+            return Value(parse_string());
+        } else if (c == '[') {
+            return parse_array();
+        } else if (c == '{') {
+            return parse_object();
+        } else if (consume_literal("true")) {
+            return Value(true);
+        } else if (consume_literal("false")) {
+            return Value(false);
+        } else if (consume_literal("null")) {
+            return Value();
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            return Value(parse_number());
+        }
+        throw std::runtime_error("Invalid JSON value");
     }
-    return val;
+};
+
+Value parse(std::string_view json_str) {
+    return Parser(json_str).parse_document();
 }
 
-static Value parse_value(const std::string& s, size_t& pos);
+static const size_t WRITER_BUFFER_SIZE = 1 << 16;
 
-static Value parse_array(const std::string& s, size_t& pos) {
-    if (s[pos] != '[') throw std::runtime_error("Expected '['");
-    pos++;
-    skip_whitespace(s, pos);
-    
-    std::vector<Value> arr;
-    if (s[pos] != ']') {
-        while (true) {
-            arr.push_back(parse_value(s, pos));
-            skip_whitespace(s, pos);
-            if (s[pos] == ']') break;
-            if (s[pos] != ',') throw std::runtime_error("Expected ',' or ']'");
-            pos++;
-            skip_whitespace(s, pos);
+Writer::Writer(std::ostream& out, bool compact) : out(out), compact(compact), buffer(WRITER_BUFFER_SIZE) {}
+
+Writer::~Writer() {
+    flush();
+}
+
+void Writer::flush() {
+    if (used > 0) {
+        out.write(buffer.data(), used);
+        used = 0;
+    }
+}
+
+void Writer::put(char c) {
+    if (used == buffer.size()) flush();
+    buffer[used++] = c;
+}
+
+void Writer::write(const char* s, size_t n) {
+    if (buffer.size() - used < n) {
+        flush();
+        if (n > buffer.size()) {
+            out.write(s, n);
+            return;
         }
     }
-    pos++;
-    Value result;
-    result.set_array(arr);
-    return result;
+    std::copy(s, s + n, buffer.data() + used);
+    used += n;
 }
 
-static Value parse_object(const std::string& s, size_t& pos) {
-    if (s[pos] != '{') throw std::runtime_error("Expected '{'");
-    pos++;
-    skip_whitespace(s, pos);
-    
-    std::map<std::string, Value> obj;
-    if (s[pos] != '}') {
-        while (true) {
-            skip_whitespace(s, pos);
-            std::string key = parse_string(s, pos);
-            skip_whitespace(s, pos);
-            if (s[pos] != ':') throw std::runtime_error("Expected ':'");
-            pos++;
-            skip_whitespace(s, pos);
-            obj[key] = parse_value(s, pos);
-            skip_whitespace(s, pos);
-            if (s[pos] == '}') break;
-            if (s[pos] != ',') throw std::runtime_error("Expected ',' or '}'");
-            pos++;
+void Writer::newline() {
+    if (compact) return;
+    put('\n');
+    for (size_t i = 0; i < empty.size(); i++) {
+        write("  ", 2);
+    }
+}
+
+// Called before every value and key
+void Writer::separate() {
+    if (after_key) {
+        after_key = false;
+        return;
+    }
+    if (empty.empty()) return;
+    if (!empty.back()) put(',');
+    empty.back() = false;
+    newline();
+}
+
+void Writer::begin_object() {
+    separate();
+    put('{');
+    empty.push_back(true);
+}
+
+void Writer::end_object() {
+    bool was_empty = empty.back();
+    empty.pop_back();
+    if (!was_empty) newline();
+    put('}');
+}
+
+void Writer::begin_array() {
+    separate();
+    put('[');
+    empty.push_back(true);
+}
+
+void Writer::end_array() {
+    bool was_empty = empty.back();
+    empty.pop_back();
+    if (!was_empty) newline();
+    put(']');
+}
+
+void Writer::key(std::string_view name) {
+    string(name);
+    put(':');
+    if (!compact) put(' ');
+    after_key = true;
+}
+
+void Writer::null() {
+    separate();
+    write("null", 4);
+}
+
+void Writer::boolean(bool b) {
+    separate();
+    if (b) write("true", 4);
+    else write("false", 5);
+}
+
+void Writer::number(double d) {
+    if (std::isnan(d) || std::isinf(d)) {
+        throw std::runtime_error("Cannot write NaN or Inf as JSON");
+    }
+    separate();
+    char digits[32];
+    auto res = std::to_chars(digits, digits + sizeof(digits), d);
+    write(digits, res.ptr - digits);
+}
+
+// Float digits are shorter: a float converted to double would print every binary digit
+void Writer::number(float f) {
+    if (std::isnan(f) || std::isinf(f)) {
+        throw std::runtime_error("Cannot write NaN or Inf as JSON");
+    }
+    separate();
+    char digits[32];
+    auto res = std::to_chars(digits, digits + sizeof(digits), f);
+    write(digits, res.ptr - digits);
+}
+
+void Writer::string(std::string_view s) {
+    separate();
+    put('"');
+    for (char c : s) {
+        switch (c) {
+            case '"': write("\\\"", 2); break;
+            case '\\': write("\\\\", 2); break;
+            case '\n': write("\\n", 2); break;
+            case '\t': write("\\t", 2); break;
+            case '\r': write("\\r", 2); break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    const char* hex = "0123456789abcdef";
+                    char escape[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF]};
+                    write(escape, sizeof(escape));
+                } else {
+                    put(c);
+                }
+                break;
         }
     }
-    pos++;
-    Value result;
-    result.set_object(obj);
-    return result;
+    put('"');
 }
 
-static Value parse_value(const std::string& s, size_t& pos) {
-    skip_whitespace(s, pos);
-    if (pos >= s.size()) throw std::runtime_error("Unexpected end of input");
-    
-    if (s[pos] == '"') {
-        return Value(parse_string(s, pos));
-    } else if (s[pos] == '[') {
-        return parse_array(s, pos);
-    } else if (s[pos] == '{') {
-        return parse_object(s, pos);
-    } else if (s[pos] == 't' && s.substr(pos, 4) == "true") {
-        pos += 4;
-        return Value(true);
-    } else if (s[pos] == 'f' && s.substr(pos, 5) == "false") {
-        pos += 5;
-        return Value(false);
-    } else if (s[pos] == 'n' && s.substr(pos, 4) == "null") {
-        pos += 4;
-        return Value();
-    } else if (s[pos] == '-' || std::isdigit(s[pos])) {
-        return Value(parse_number(s, pos));
-    }
-    throw std::runtime_error("Invalid JSON value");
-}
-
-Value parse(const std::string& json_str) {
-    size_t pos = 0;
-    return parse_value(json_str, pos);
-}
-
-static void stringify_value(const Value& val, std::ostringstream& out, bool compact) {
+void Writer::value(const Value& val) {
     switch (val.get_type()) {
         case Value::NULL_TYPE:
-            out << "null";
+            null();
             break;
         case Value::BOOL:
-            out << (val.as_bool() ? "true" : "false");
+            boolean(val.as_bool());
             break;
         case Value::NUMBER:
-            out << val.as_number();
+            number(val.as_number());
             break;
         case Value::STRING:
-            out << '"' << val.as_string() << '"';
+            string(val.as_string());
             break;
-        case Value::ARRAY: {
-            out << '[';
-            const auto& arr = val.as_array();
-            for (size_t i = 0; i < arr.size(); i++) {
-                if (i > 0) out << ',';
-                stringify_value(arr[i], out, compact);
+        case Value::ARRAY:
+            begin_array();
+            for (const auto& item : val.as_array()) {
+                value(item);
             }
-            out << ']';
+            end_array();
             break;
-        }
-        case Value::OBJECT: {
-            out << '{';
-            const auto& obj = val.as_object();
-            bool first = true;
-            for (const auto& kv : obj) {
-                if (!first) out << ',';
-                first = false;
-                out << '"' << kv.first << "\":";
-                stringify_value(kv.second, out, compact);
+        case Value::OBJECT:
+            begin_object();
+            for (const auto& member : val.as_object()) {
+                key(member.first);
+                value(member.second);
             }
-            out << '}';
+            end_object();
             break;
-        }
     }
 }
 
+void write(std::ostream& out, const Value& val, bool compact) {
+    Writer writer(out, compact);
+    writer.value(val);
+}
+
 std::string stringify(const Value& val, bool compact) {
     std::ostringstream out;
-    stringify_value(val, out, compact);
+    write(out, val, compact);
     return out.str();
 }
 
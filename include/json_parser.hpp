@@ -1,51 +1,95 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
+#include <utility>
+#include <variant>
+#include <ostream>
 
 namespace json {
+    class Value;
+    
+    using Array = std::vector<Value>;
+    // Kept sorted by key, so objects are written in a stable order
+    using Object = std::vector<std::pair<std::string, Value>>;
+    
     class Value {
     public:
         enum Type { NULL_TYPE, BOOL, NUMBER, STRING, ARRAY, OBJECT };
         
-        Value() : type(NULL_TYPE) {}
-        Value(int i) : type(NUMBER), num(static_cast<double>(i)) {}
-        Value(double d) : type(NUMBER), num(d) {}
-        Value(const std::string& s) : type(STRING), str(s) {}
-        Value(bool b) : type(BOOL), boolean(b) {}
+        Value() = default;
+        Value(int i) : data(static_cast<double>(i)) {}
+        Value(double d) : data(d) {}
+        Value(const char* s) : data(std::string(s)) {}
+        Value(std::string s) : data(std::move(s)) {}
+        Value(bool b) : data(b) {}
+        Value(Array a) : data(std::move(a)) {}
         
-        Type get_type() const { return type; }
-        double as_number() const { return num; }
-        std::string as_string() const { return str; }
-        bool as_bool() const { return boolean; }
-        const std::vector<Value>& as_array() const { return arr; }
-        const std::map<std::string, Value>& as_object() const { return obj; }
+        // Variant alternatives are declared in Type order
+        Type get_type() const { return static_cast<Type>(data.index()); }
+        double as_number() const;
+        const std::string& as_string() const;
+        bool as_bool() const;
+        const Array& as_array() const;
+        Array& as_array();
+        const Object& as_object() const;
         
-        void set_array(const std::vector<Value>& a) { type = ARRAY; arr = a; }
-        void set_object(const std::map<std::string, Value>& o) { type = OBJECT; obj = o; }
+        void set_array(Array a) { data = std::move(a); }
+        void set_object(Object o);
+        void push_back(Value v);
         
-        Value& operator[](const std::string& key) { return obj[key]; }
-        const Value& operator[](const std::string& key) const { 
-            auto it = obj.find(key);
-            static Value null_val;
-            return it != obj.end() ? it->second : null_val;
-        }
+        // Inserts a null member when the key is missing
+        Value& operator[](const std::string& key);
+        // Returns null for missing keys and non-objects
+        const Value& operator[](const std::string& key) const;
         
-        Value& operator[](size_t idx) { return arr[idx]; }
-        const Value& operator[](size_t idx) const { return arr[idx]; }
+        Value& operator[](size_t idx) { return as_array()[idx]; }
+        const Value& operator[](size_t idx) const { return as_array()[idx]; }
         
-        size_t size() const { return type == ARRAY ? arr.size() : obj.size(); }
-        bool has(const std::string& key) const { return obj.find(key) != obj.end(); }
+        size_t size() const;
+        bool has(const std::string& key) const;
+    
+    private:
+        std::variant<std::monostate, bool, double, std::string, Array, Object> data;
+    };
+    
+    // Streams JSON straight to an output stream through a fixed buffer, without
+    // building a Value tree. Commas are inserted automatically.
+    class Writer {
+    public:
+        explicit Writer(std::ostream& out, bool compact = true);
+        ~Writer();
         
+        void begin_object();
+        void end_object();
+        void begin_array();
+        void end_array();
+        void key(std::string_view name);
+        void null();
+        void boolean(bool b);
+        // Shortest representation that reads back to the same value
+        void number(double d);
+        void number(float f);
+        void string(std::string_view s);
+        void value(const Value& val);
+        void flush();
+    
     private:
-        Type type;
-        double num = 0;
-        std::string str;
-        bool boolean = false;
-        std::vector<Value> arr;
-        std::map<std::string, Value> obj;
+        void separate();
+        void newline();
+        void put(char c);
+        void write(const char* s, size_t n);
+        
+        std::ostream& out;
+        bool compact;
+        std::vector<char> buffer;
+        size_t used = 0;
+        // One entry per open container: whether it is still empty
+        std::vector<bool> empty;
+        bool after_key = false;
     };
     
-    Value parse(const std::string& json_str);
+    Value parse(std::string_view json_str);
     std::string stringify(const Value& val, bool compact = true);
+    void write(std::ostream& out, const Value& val, bool compact = true);
 }
@@ -0,0 +1,80 @@
+#include "tests.hpp"
+#include "accumulator.hpp"
+#include "fen_parser.hpp"
+#include <cmath>
+#include <stdexcept>
+
+// After any run of updates, an accumulator must score like forward_pass on
+// the FEN of the position it now holds
+
+template <typename Real>
+static double largest_difference(const BasicNetwork<Real>& network, const BasicAccumulator<Real>& acc, const std::string& fen) {
+    std::vector<double> dense = fen_to_vector(fen);
+    BasicForwardCache<Real> cache;
+    std::vector<Real> expected = forward_pass(network, std::vector<Real>(dense.begin(), dense.end()), cache);
+    std::vector<Real> actual = accumulator_evaluate(network, acc);
+    double difference = 0.0;
+    for (size_t j = 0; j < expected.size(); j++) {
+        difference = std::max(difference, std::abs(static_cast<double>(actual[j]) - expected[j]));
+    }
+    return difference;
+}
+
+template <typename Update>
+static bool throws(Update update) {
+    try {
+        update();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+template <typename Real>
+static void test_updates(const BasicNetwork<Real>& network, double tolerance, const std::string& name) {
+    auto expect = [&](const BasicAccumulator<Real>& acc, const std::string& fen, const std::string& after) {
+        double difference = largest_difference(network, acc, fen);
+        check(difference <= tolerance, name + " after " + after + ": differs from forward_pass by " + std::to_string(difference));
+    };
+    
+    // A game: moves, a capture and the turn flipping after each
+    BasicAccumulator<Real> acc = accumulator_from_fen(network, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    expect(acc, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "the start");
+    accumulator_move(network, acc, square_from_name("e2"), square_from_name("e4"));
+    accumulator_set_turn(network, acc, false);
+    expect(acc, "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1", "e2e4");
+    accumulator_move(network, acc, square_from_name("d7"), square_from_name("d5"));
+    accumulator_set_turn(network, acc, true);
+    expect(acc, "rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2", "d7d5");
+    accumulator_move(network, acc, square_from_name("e4"), square_from_name("d5"));
+    accumulator_set_turn(network, acc, false);
+    expect(acc, "rnbqkbnr/ppp1pppp/8/3P4/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", "exd5");
+    
+    // A promotion, as a removal and an addition
+    BasicAccumulator<Real> promotion = accumulator_from_fen(network, "8/P6k/8/8/8/8/8/K7 w - - 0 1");
+    accumulator_remove(network, promotion, square_from_name("a7"));
+    accumulator_add(network, promotion, 'Q', square_from_name("a8"));
+    accumulator_set_turn(network, promotion, false);
+    expect(promotion, "Q7/7k/8/8/8/8/8/K7 b - - 0 1", "a8=Q");
+    
+    // Updates that do not match the board are refused
+    BasicAccumulator<Real> copy = promotion;
+    check(throws([&] { accumulator_remove(network, copy, square_from_name("a7")); }), name + ": removing from an empty square throws");
+    check(throws([&] { accumulator_move(network, copy, square_from_name("b2"), square_from_name("b3")); }), name + ": moving from an empty square throws");
+    check(throws([&] { accumulator_add(network, copy, 'N', square_from_name("a8")); }), name + ": adding on an occupied square throws");
+}
+
+template <typename Real>
+static void test_precision(std::mt19937& gen, double tolerance, const std::string& precision) {
+    const std::pair<Activation, const char*> outputs[] = {{Activation::Softmax, "softmax"}, {Activation::Linear, "linear"}};
+    for (const auto& output : outputs) {
+        BasicNetwork<Real> network = random_network<Real>({FEN_INPUT_SIZE, 32, 16, 6}, {Activation::Relu, Activation::Relu, output.first}, gen);
+        test_updates(network, tolerance, precision + " " + output.second);
+    }
+}
+
+void test_accumulators() {
+    std::mt19937 gen(99);
+    test_precision<double>(gen, 1e-12, "fp64");
+    test_precision<float>(gen, 1e-5, "fp32");
+}
@@ -0,0 +1,149 @@
+#include "tests.hpp"
+#include "network.hpp"
+#include "optimizer.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Once their buffers have grown, online and batched training steps must not
+// touch the heap. Every operator new of the test binary is counted while
+// counting is set; PROFILE=1 builds replace operator new themselves, so the
+// group is skipped there.
+
+#ifndef MY_TORCH_PROFILE
+static std::atomic<bool> counting{false};
+static std::atomic<size_t> allocation_count{0};
+
+void* operator new(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+static const size_t SAMPLES = 256;
+static const size_t BATCH = 32;
+static const size_t OUTPUTS = 6;
+
+struct Samples {
+    std::vector<std::vector<uint16_t>> features;
+    std::vector<size_t> labels;
+};
+
+static Samples random_samples(std::mt19937& gen) {
+    std::uniform_int_distribution<size_t> count(1, 32);
+    std::uniform_int_distribution<size_t> label(0, OUTPUTS - 1);
+    Samples samples;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        samples.features.push_back(random_features(gen, 769, count(gen)));
+        samples.labels.push_back(label(gen));
+    }
+    return samples;
+}
+
+// Allocations made by fn
+template <typename Fn>
+static size_t count_allocations(Fn fn) {
+    allocation_count = 0;
+    counting = true;
+    fn();
+    counting = false;
+    return allocation_count;
+}
+
+template <typename Real>
+static void test_train_step(BasicNetwork<Real> network, const Samples& samples, const std::string& name) {
+    const std::vector<double> class_weights(OUTPUTS, 1.0);
+    BasicWorkspace<Real> workspace(network);
+    auto epoch = [&] {
+        for (size_t i = 0; i < SAMPLES; i++) {
+            const std::vector<uint16_t>& f = samples.features[i];
+            train_step(network, f.data(), f.data() + f.size(), samples.labels[i], class_weights, 0.01, 10.0, workspace);
+        }
+    };
+    // The first epoch sizes the optimizer state
+    epoch();
+    size_t allocations = count_allocations(epoch);
+    check(allocations == 0, name + " train_step: " + std::to_string(allocations) + " allocations in " + std::to_string(SAMPLES) + " steps");
+}
+
+template <typename Real>
+static void test_batch_step(BasicNetwork<Real> network, const Samples& samples, const std::string& name) {
+    const std::vector<double> class_weights(OUTPUTS, 1.0);
+    SparseBatch inputs;
+    std::vector<double> targets(BATCH * OUTPUTS);
+    std::vector<double> sample_weights(BATCH, 1.0);
+    BasicBatchCache<Real> cache;
+    BasicGradients<Real> grads;
+    double loss = 0.0;
+    // The same work as one shard of a batched epoch, then the update
+    auto epoch = [&] {
+        for (size_t begin = 0; begin < SAMPLES; begin += BATCH) {
+            inputs.clear();
+            std::fill(targets.begin(), targets.end(), 0.0);
+            for (size_t b = 0; b < BATCH; b++) {
+                const std::vector<uint16_t>& f = samples.features[begin + b];
+                inputs.add(f.begin(), f.end());
+                targets[b * OUTPUTS + samples.labels[begin + b]] = 1.0;
+            }
+            const auto& output = forward_batch_sparse(network, inputs, cache);
+            for (size_t b = 0; b < BATCH; b++) {
+                loss += cross_entropy_loss(&output[b * OUTPUTS], samples.labels[begin + b], class_weights);
+            }
+            backward_batch(network, cache, targets, sample_weights, grads);
+            scale_gradients(grads, 1.0 / BATCH);
+            clip_gradients(grads, 5.0);
+            apply_gradients(network, grads, 0.01);
+        }
+    };
+    epoch();
+    size_t allocations = count_allocations(epoch);
+    check(allocations == 0, name + " batched step: " + std::to_string(allocations) + " allocations in " + std::to_string(SAMPLES / BATCH) + " steps");
+}
+
+template <typename Real>
+static void test_precision(const Samples& samples, std::mt19937& gen, const std::string& precision) {
+    const std::pair<OptimizerKind, const char*> optimizers[] = {
+        {OptimizerKind::Sgd, "sgd"},
+        {OptimizerKind::Momentum, "momentum"},
+        {OptimizerKind::Adam, "adam"},
+    };
+    for (const auto& optimizer : optimizers) {
+        BasicNetwork<Real> network = random_network<Real>({769, 32, 16, OUTPUTS}, {Activation::Relu, Activation::Relu, Activation::Softmax}, gen, 0.1);
+        reset_optimizer(network, optimizer.first);
+        const std::string name = precision + " " + optimizer.second;
+        test_train_step(network, samples, name);
+        test_batch_step(network, samples, name);
+    }
+}
+
+// Written so that the probe allocation cannot be optimized away
+static std::vector<int>* probe = nullptr;
+
+void test_allocations() {
+    // The replacement operator new must be the one linked in
+    size_t probed = count_allocations([] { probe = new std::vector<int>(16); });
+    delete probe;
+    check(probed == 2, "allocation counter: " + std::to_string(probed) + " allocations for a vector of 16 ints");
+    
+    std::mt19937 gen(2024);
+    Samples samples = random_samples(gen);
+    test_precision<double>(samples, gen, "fp64");
+    test_precision<float>(samples, gen, "fp32");
+}
+#else
+void test_allocations() {
+    std::cout << "allocations: skipped in PROFILE=1 builds" << std::endl;
+}
+#endif
@@ -0,0 +1,256 @@
+#include "tests.hpp"
+#include "network.hpp"
+#include "optimizer.hpp"
+#include <cmath>
+#include <type_traits>
+
+// Backpropagated gradients must match central differences of the loss, for
+// dense and sparse inputs, single samples and weighted batches. Softmax outputs
+// are scored with the cross-entropy and linear ones with half the squared
+// error: both have output - target as the delta backprop starts from.
+// The fused SGD update of train_step, which never stores the gradients, must
+// leave the same weights as forward_sparse then backward_pass with the update.
+
+static const size_t INPUTS = 10;
+static const size_t OUTPUTS = 4;
+static const size_t BATCH = 3;
+
+struct Sample {
+    std::vector<double> input;
+    // Active inputs when the sample is binary, empty for a dense one
+    std::vector<int> features;
+    size_t label;
+};
+
+template <typename Real>
+static double sample_loss(const BasicNetwork<Real>& network, const Sample& sample, std::vector<bool>& relu_signs) {
+    std::vector<Real> input(sample.input.begin(), sample.input.end());
+    BasicForwardCache<Real> cache;
+    std::vector<Real> output = forward_pass(network, input, cache);
+    for (size_t i = 0; i + 1 < network.layers.size(); i++) {
+        if (network.layers[i].activation != Activation::Relu) continue;
+        for (Real z : cache.z_values[i]) {
+            relu_signs.push_back(z > 0);
+        }
+    }
+    
+    if (network.layers.back().activation == Activation::Softmax) {
+        return cross_entropy_loss(output.data(), sample.label, {});
+    }
+    double loss = 0.0;
+    for (size_t j = 0; j < output.size(); j++) {
+        double diff = output[j] - (j == sample.label ? 1.0 : 0.0);
+        loss += 0.5 * diff * diff;
+    }
+    return loss;
+}
+
+// Weighted loss of the samples, and the side of every ReLU it went through
+template <typename Real>
+static double batch_loss(const BasicNetwork<Real>& network, const std::vector<Sample>& samples, const std::vector<double>& weights, std::vector<bool>& relu_signs) {
+    relu_signs.clear();
+    double loss = 0.0;
+    for (size_t b = 0; b < samples.size(); b++) {
+        loss += weights[b] * sample_loss(network, samples[b], relu_signs);
+    }
+    return loss;
+}
+
+// Backprop's gradient of weight (k, j) of a layer, read from the packed rows
+// after a sparse pass
+template <typename Real>
+static double weight_gradient(const BasicGradients<Real>& grads, size_t layer, size_t outputs, size_t k, size_t j) {
+    if (layer > 0 || !grads.sparse_input) {
+        return grads.weights[layer][k * outputs + j];
+    }
+    auto row = std::lower_bound(grads.input_rows.begin(), grads.input_rows.end(), static_cast<int>(k));
+    if (row == grads.input_rows.end() || *row != static_cast<int>(k)) return 0.0;
+    return grads.weights[0][(row - grads.input_rows.begin()) * outputs + j];
+}
+
+struct GradientCheck {
+    double max_error = 0.0;
+    size_t compared = 0;
+    size_t skipped = 0;
+};
+
+// Compares every parameter's gradient with (L(p + h) - L(p - h)) / 2h.
+// Parameters whose step moves a ReLU across its kink are skipped.
+template <typename Real>
+static GradientCheck compare_gradients(BasicNetwork<Real> network, const std::vector<Sample>& samples, const std::vector<double>& weights, const BasicGradients<Real>& grads) {
+    const double h = std::is_same_v<Real, float> ? 1e-2 : 1e-5;
+    GradientCheck result;
+    std::vector<bool> signs, plus_signs, minus_signs;
+    batch_loss(network, samples, weights, signs);
+    
+    auto compare = [&](Real& param, double gradient) {
+        const Real saved = param;
+        param = static_cast<Real>(saved + h);
+        const double plus_step = param;
+        double plus = batch_loss(network, samples, weights, plus_signs);
+        param = static_cast<Real>(saved - h);
+        const double minus_step = param;
+        double minus = batch_loss(network, samples, weights, minus_signs);
+        param = saved;
+        if (plus_signs != signs || minus_signs != signs) {
+            result.skipped++;
+            return;
+        }
+        double numeric = (plus - minus) / (plus_step - minus_step);
+        result.max_error = std::max(result.max_error, std::abs(gradient - numeric) / (1.0 + std::abs(numeric)));
+        result.compared++;
+    };
+    for (size_t i = 0; i < network.layers.size(); i++) {
+        BasicLayer<Real>& layer = network.layers[i];
+        for (size_t k = 0; k < layer.inputs; k++) {
+            for (size_t j = 0; j < layer.outputs; j++) {
+                compare(layer.weights[k * layer.outputs + j], weight_gradient(grads, i, layer.outputs, k, j));
+            }
+        }
+        for (size_t j = 0; j < layer.outputs; j++) {
+            compare(layer.biases[j], grads.biases[i][j]);
+        }
+    }
+    return result;
+}
+
+static void report(const GradientCheck& result, double tolerance, const std::string& name) {
+    // Kinks may hide a few parameters, not most of them
+    check(result.max_error <= tolerance && result.skipped <= result.compared / 10,
+          name + ": largest error " + std::to_string(result.max_error) + " over " + std::to_string(result.compared)
+          + " parameters, " + std::to_string(result.skipped) + " skipped at ReLU kinks");
+}
+
+template <typename Real>
+static void test_network(const BasicNetwork<Real>& network, const std::vector<Sample>& samples, bool sparse, double tolerance, const std::string& name) {
+    const std::string input = sparse ? " sparse" : " dense";
+    
+    // backward_pass, one sample at a time
+    GradientCheck single;
+    for (const Sample& sample : samples) {
+        BasicNetwork<Real> copy = network;
+        BasicForwardCache<Real> cache;
+        if (sparse) {
+            forward_sparse(copy, sample.features, cache);
+        } else {
+            forward_pass(copy, std::vector<Real>(sample.input.begin(), sample.input.end()), cache);
+        }
+        std::vector<double> target(OUTPUTS, 0.0);
+        target[sample.label] = 1.0;
+        BasicGradients<Real> grads = backward_pass(copy, cache, target, 0.0, false);
+        GradientCheck result = compare_gradients(network, {sample}, {1.0}, grads);
+        single.max_error = std::max(single.max_error, result.max_error);
+        single.compared += result.compared;
+        single.skipped += result.skipped;
+    }
+    report(single, tolerance, name + input + " backward_pass");
+    
+    // backward_batch, with the sample weights it scales the deltas by
+    const std::vector<double> weights = {1.0, 0.5, 2.0};
+    std::vector<double> targets(BATCH * OUTPUTS, 0.0);
+    BasicBatchCache<Real> cache;
+    if (sparse) {
+        SparseBatch inputs;
+        for (size_t b = 0; b < BATCH; b++) {
+            inputs.add(samples[b].features);
+            targets[b * OUTPUTS + samples[b].label] = 1.0;
+        }
+        forward_batch_sparse(network, inputs, cache);
+    } else {
+        std::vector<Real> inputs;
+        for (size_t b = 0; b < BATCH; b++) {
+            inputs.insert(inputs.end(), samples[b].input.begin(), samples[b].input.end());
+            targets[b * OUTPUTS + samples[b].label] = 1.0;
+        }
+        forward_batch(network, inputs, BATCH, cache);
+    }
+    BasicGradients<Real> grads;
+    backward_batch(network, cache, targets, weights, grads);
+    report(compare_gradients(network, samples, weights, grads), tolerance, name + input + " backward_batch");
+}
+
+static std::vector<Sample> random_samples(std::mt19937& gen, bool sparse) {
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+    std::uniform_int_distribution<size_t> count(1, INPUTS / 2);
+    std::uniform_int_distribution<size_t> label(0, OUTPUTS - 1);
+    std::vector<Sample> samples(BATCH);
+    for (Sample& sample : samples) {
+        sample.input.assign(INPUTS, 0.0);
+        if (sparse) {
+            for (uint16_t f : random_features(gen, INPUTS, count(gen))) {
+                sample.features.push_back(f);
+                sample.input[f] = 1.0;
+            }
+        } else {
+            for (double& x : sample.input) {
+                x = value(gen);
+            }
+        }
+        sample.label = label(gen);
+    }
+    return samples;
+}
+
+template <typename Real>
+static void test_precision(std::mt19937& gen, double tolerance, const std::string& precision) {
+    const std::pair<Activation, const char*> hidden[] = {{Activation::Linear, "linear"}, {Activation::Relu, "relu"}};
+    const std::pair<Activation, const char*> output[] = {{Activation::Softmax, "softmax"}, {Activation::Linear, "linear"}};
+    for (const auto& h : hidden) {
+        for (const auto& o : output) {
+            BasicNetwork<Real> network = random_network<Real>({INPUTS, 8, 7, OUTPUTS}, {h.first, h.first, o.first}, gen, 0.5);
+            const std::string name = precision + " " + h.second + "/" + o.second;
+            for (bool sparse : {false, true}) {
+                test_network(network, random_samples(gen, sparse), sparse, tolerance, name);
+            }
+        }
+    }
+}
+
+// Odd widths reach the vector tails of the fused update, and the larger
+// weights make some gradients hit the clip
+template <typename Real>
+static void test_fused_step(std::mt19937& gen, const std::string& precision) {
+    const double learning_rate = 0.05;
+    const std::pair<Activation, const char*> hidden[] = {{Activation::Linear, "linear"}, {Activation::Relu, "relu"}};
+    for (const auto& h : hidden) {
+        for (double scale : {0.5, 2.0}) {
+            BasicNetwork<Real> fused = random_network<Real>({INPUTS, 37, 19, OUTPUTS}, {h.first, h.first, Activation::Softmax}, gen, scale);
+            reset_optimizer(fused, OptimizerKind::Sgd);
+            BasicNetwork<Real> reference = fused;
+            BasicWorkspace<Real> workspace(fused);
+            const std::string name = precision + " " + h.second + " train_step, weights in +-" + std::to_string(scale).substr(0, 3);
+            
+            bool same = true;
+            size_t steps = 0;
+            for (size_t step = 0; step < 4 && same; step++) {
+                for (const Sample& sample : random_samples(gen, true)) {
+                    std::vector<uint16_t> features(sample.features.begin(), sample.features.end());
+                    train_step(fused, features.data(), features.data() + features.size(), sample.label, {}, learning_rate, 1e300, workspace);
+                    
+                    BasicForwardCache<Real> cache;
+                    forward_sparse(reference, sample.features, cache);
+                    std::vector<double> target(OUTPUTS, 0.0);
+                    target[sample.label] = 1.0;
+                    backward_pass(reference, cache, target, learning_rate, true);
+                    
+                    steps++;
+                    for (size_t i = 0; i < fused.layers.size() && same; i++) {
+                        const BasicLayer<Real>& a = fused.layers[i];
+                        const BasicLayer<Real>& b = reference.layers[i];
+                        same = std::equal(a.weights.begin(), a.weights.end(), b.weights.begin()) && std::equal(a.biases.begin(), a.biases.end(), b.biases.begin());
+                    }
+                    if (!same) break;
+                }
+            }
+            check(same, name + ": differs from backward_pass after " + std::to_string(steps) + " steps");
+        }
+    }
+}
+
+void test_gradients() {
+    std::mt19937 gen(7);
+    test_precision<double>(gen, 1e-7, "fp64");
+    test_precision<float>(gen, 1e-3, "fp32");
+    test_fused_step<double>(gen, "fp64");
+    test_fused_step<float>(gen, "fp32");
+}
@@ -0,0 +1,225 @@
+#include "tests.hpp"
+#include "kernels_dispatch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Every SIMD kernel table the CPU supports must agree with the scalar one, on
+// random inputs whose sizes hit every vector tail
+
+static const size_t LENGTHS[] = {0, 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 65, 127, 129, 1000};
+// m, n, k; the last ones cross the blocking of the GEMMs
+static const size_t SHAPES[][3] = {{1, 1, 1}, {3, 5, 7}, {17, 33, 9}, {8, 16, 32}, {65, 257, 129}, {70, 300, 140}};
+
+template <typename Real>
+static const KernelSet<Real>& kernel_set(const KernelTable& table) {
+    if constexpr (std::is_same_v<Real, float>) {
+        return table.f32;
+    } else {
+        return table.f64;
+    }
+}
+
+template <typename Real>
+static std::vector<Real> random_values(std::mt19937& gen, size_t n, double low = -1.0, double high = 1.0) {
+    std::uniform_real_distribution<double> dist(low, high);
+    std::vector<Real> values(n);
+    for (Real& value : values) {
+        value = static_cast<Real>(dist(gen));
+    }
+    return values;
+}
+
+// Allowed difference for results that sum up to terms products of values in
+// [-1, 1], relative to 1 + |expected|
+template <typename Real>
+static double tolerance(size_t terms) {
+    return 16.0 * (terms + 1) * std::numeric_limits<Real>::epsilon();
+}
+
+template <typename Real>
+static bool agree(const std::vector<Real>& expected, const std::vector<Real>& actual, double limit) {
+    for (size_t i = 0; i < expected.size(); i++) {
+        double e = expected[i];
+        if (!(std::abs(actual[i] - e) <= limit * (1.0 + std::abs(e)))) return false;
+    }
+    return true;
+}
+
+template <typename Real>
+static void test_gemms(const KernelSet<Real>& ref, const KernelSet<Real>& simd, const std::string& name, std::mt19937& gen) {
+    using Gemm = void (*)(size_t, size_t, size_t, const Real*, const Real*, Real*);
+    const struct {
+        const char* name;
+        Gemm ref;
+        Gemm simd;
+    } cases[] = {
+        {"gemm_nn", ref.gemm_nn, simd.gemm_nn},
+        {"gemm_tn", ref.gemm_tn, simd.gemm_tn},
+        {"gemm_nt", ref.gemm_nt, simd.gemm_nt},
+    };
+    for (const auto& shape : SHAPES) {
+        size_t m = shape[0], n = shape[1], k = shape[2];
+        std::vector<Real> a = random_values<Real>(gen, m * k);
+        std::vector<Real> b = random_values<Real>(gen, k * n);
+        std::vector<Real> c = random_values<Real>(gen, m * n);
+        for (const auto& gemm : cases) {
+            // C is accumulated into
+            std::vector<Real> expected = c, actual = c;
+            gemm.ref(m, n, k, a.data(), b.data(), expected.data());
+            gemm.simd(m, n, k, a.data(), b.data(), actual.data());
+            check(agree(expected, actual, tolerance<Real>(k)), name + " " + gemm.name + " " + std::to_string(m) + "x" + std::to_string(n) + "x" + std::to_string(k));
+        }
+    }
+}
+
+template <typename Real>
+static void test_vectors(const KernelSet<Real>& ref, const KernelSet<Real>& simd, const std::string& name, std::mt19937& gen) {
+    for (size_t n : LENGTHS) {
+        const std::string size = " n=" + std::to_string(n);
+        std::vector<Real> x = random_values<Real>(gen, n);
+        std::vector<Real> y = random_values<Real>(gen, n);
+        
+        std::vector<Real> expected = y, actual = y;
+        ref.axpy(n, Real(0.37), x.data(), expected.data());
+        simd.axpy(n, Real(0.37), x.data(), actual.data());
+        check(agree(expected, actual, tolerance<Real>(1)), name + " axpy" + size);
+        
+        std::vector<Real> dot_expected = {ref.dot(n, x.data(), y.data())};
+        std::vector<Real> dot_actual = {simd.dot(n, x.data(), y.data())};
+        check(agree(dot_expected, dot_actual, tolerance<Real>(n)), name + " dot" + size);
+        
+        std::vector<Real> z_expected = y, z_actual = y;
+        std::vector<Real> a_expected(n), a_actual(n);
+        ref.bias_relu(n, x.data(), z_expected.data(), a_expected.data());
+        simd.bias_relu(n, x.data(), z_actual.data(), a_actual.data());
+        check(agree(z_expected, z_actual, 0.0) && agree(a_expected, a_actual, 0.0), name + " bias_relu" + size);
+        
+        expected = y;
+        actual = y;
+        ref.relu_mask(n, x.data(), expected.data());
+        simd.relu_mask(n, x.data(), actual.data());
+        check(agree(expected, actual, 0.0), name + " relu_mask" + size);
+    }
+}
+
+template <typename Real>
+static void test_backward(const KernelSet<Real>& ref, const KernelSet<Real>& simd, const std::string& name, std::mt19937& gen) {
+    for (const auto& shape : SHAPES) {
+        size_t m = shape[0], n = shape[1];
+        const std::string size = " " + std::to_string(m) + "x" + std::to_string(n);
+        std::vector<Real> w = random_values<Real>(gen, m * n);
+        std::vector<Real> delta = random_values<Real>(gen, n);
+        std::vector<Real> z = random_values<Real>(gen, m);
+        
+        // Without z, every input passes the gradient back
+        for (const Real* mask : {static_cast<const Real*>(nullptr), static_cast<const Real*>(z.data())}) {
+            std::vector<Real> expected(m), actual(m);
+            ref.backprop_delta(m, n, w.data(), delta.data(), mask, expected.data());
+            simd.backprop_delta(m, n, w.data(), delta.data(), mask, actual.data());
+            check(agree(expected, actual, tolerance<Real>(n)), name + " backprop_delta" + size + (mask ? "" : " without z"));
+        }
+        
+        // Zero inputs are skipped, and a limit of 0.3 clips some products
+        std::vector<Real> x = random_values<Real>(gen, m);
+        for (size_t i = 0; i < m; i += 4) {
+            x[i] = 0;
+        }
+        std::vector<Real> expected = w, actual = w;
+        ref.outer_sgd_update(m, n, Real(0.1), Real(0.3), x.data(), delta.data(), expected.data());
+        simd.outer_sgd_update(m, n, Real(0.1), Real(0.3), x.data(), delta.data(), actual.data());
+        check(agree(expected, actual, tolerance<Real>(1)), name + " outer_sgd_update" + size);
+    }
+}
+
+template <typename Real>
+static void test_optimizers(const KernelSet<Real>& ref, const KernelSet<Real>& simd, const std::string& name, std::mt19937& gen) {
+    for (size_t n : LENGTHS) {
+        const std::string size = " n=" + std::to_string(n);
+        std::vector<Real> grad = random_values<Real>(gen, n);
+        std::vector<Real> w = random_values<Real>(gen, n);
+        std::vector<Real> m = random_values<Real>(gen, n);
+        std::vector<Real> v = random_values<Real>(gen, n, 0.0, 1.0);
+        
+        for (bool nesterov : {false, true}) {
+            std::vector<Real> w_expected = w, w_actual = w, m_expected = m, m_actual = m;
+            ref.momentum_update(n, Real(0.01), Real(0.9), nesterov, grad.data(), w_expected.data(), m_expected.data());
+            simd.momentum_update(n, Real(0.01), Real(0.9), nesterov, grad.data(), w_actual.data(), m_actual.data());
+            check(agree(w_expected, w_actual, tolerance<Real>(2)) && agree(m_expected, m_actual, tolerance<Real>(2)),
+                  name + (nesterov ? " nesterov_update" : " momentum_update") + size);
+        }
+        
+        std::vector<Real> w_expected = w, w_actual = w, m_expected = m, m_actual = m, v_expected = v, v_actual = v;
+        ref.adam_update(n, Real(0.001), Real(0.9), Real(0.999), Real(1e-8), Real(0.01), grad.data(), w_expected.data(), m_expected.data(), v_expected.data());
+        simd.adam_update(n, Real(0.001), Real(0.9), Real(0.999), Real(1e-8), Real(0.01), grad.data(), w_actual.data(), m_actual.data(), v_actual.data());
+        check(agree(w_expected, w_actual, tolerance<Real>(4)) && agree(m_expected, m_actual, tolerance<Real>(2))
+              && agree(v_expected, v_actual, tolerance<Real>(2)), name + " adam_update" + size);
+    }
+}
+
+static void test_integers(const KernelTable& ref, const KernelTable& simd, std::mt19937& gen) {
+    // dot_u8_i8 takes activations of at most 127
+    std::uniform_int_distribution<int> activation(0, 127);
+    std::uniform_int_distribution<int> weight(-128, 127);
+    for (size_t n : LENGTHS) {
+        const std::string size = " n=" + std::to_string(n);
+        std::vector<uint8_t> a(n);
+        std::vector<int8_t> b(n);
+        for (size_t i = 0; i < n; i++) {
+            a[i] = static_cast<uint8_t>(activation(gen));
+            b[i] = static_cast<int8_t>(weight(gen));
+        }
+        // The extremes, where the 16-bit pair sums are largest
+        if (n >= 2) {
+            a[0] = a[1] = 127;
+            b[0] = b[1] = -128;
+        }
+        check(ref.dot_u8_i8(n, a.data(), b.data()) == simd.dot_u8_i8(n, a.data(), b.data()), std::string(simd.name) + " dot_u8_i8" + size);
+        
+        std::vector<int32_t> expected(n, 1000), actual(n, 1000);
+        ref.accumulate_i8(n, b.data(), expected.data());
+        simd.accumulate_i8(n, b.data(), actual.data());
+        check(expected == actual, std::string(simd.name) + " accumulate_i8" + size);
+    }
+}
+
+template <typename Real>
+static void test_table(const KernelTable& table, std::mt19937& gen) {
+    const KernelSet<Real>& ref = kernel_set<Real>(scalar_kernels);
+    const KernelSet<Real>& simd = kernel_set<Real>(table);
+    const std::string name = std::string(table.name) + (std::is_same_v<Real, float> ? " f32" : " f64");
+    test_gemms(ref, simd, name, gen);
+    test_vectors(ref, simd, name, gen);
+    test_backward(ref, simd, name, gen);
+    test_optimizers(ref, simd, name, gen);
+}
+
+void test_kernels() {
+    std::vector<const KernelTable*> tables = {&scalar_kernels};
+#ifdef MY_TORCH_X86_KERNELS
+    __builtin_cpu_init();
+    tables.push_back(&sse2_kernels);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        tables.push_back(&avx2_kernels);
+    } else {
+        std::cout << "kernels: avx2 not supported by this CPU, skipped" << std::endl;
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma")) {
+        tables.push_back(&avx512_kernels);
+    } else {
+        std::cout << "kernels: avx512 not supported by this CPU, skipped" << std::endl;
+    }
+#endif
+    
+    std::mt19937 gen(12345);
+    for (const KernelTable* table : tables) {
+        test_table<double>(*table, gen);
+        test_table<float>(*table, gen);
+        test_integers(scalar_kernels, *table, gen);
+    }
+}
@@ -0,0 +1,39 @@
+#include "tests.hpp"
+#include <exception>
+#include <iostream>
+
+static size_t checks = 0;
+static size_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    checks++;
+    if (!condition) {
+        failures++;
+        std::cerr << "FAILED: " << what << std::endl;
+    }
+}
+
+struct TestGroup {
+    const char* name;
+    void (*run)();
+};
+
+int main() {
+    const TestGroup groups[] = {
+        {"kernels", test_kernels},
+        {"allocations", test_allocations},
+        {"gradients", test_gradients},
+        {"accumulators", test_accumulators},
+    };
+    for (const TestGroup& group : groups) {
+        size_t before = failures;
+        try {
+            group.run();
+        } catch (const std::exception& e) {
+            check(false, std::string(group.name) + " threw: " + e.what());
+        }
+        std::cout << group.name << ": " << (failures == before ? "ok" : "FAILED") << std::endl;
+    }
+    std::cout << checks << " checks, " << failures << " failed" << std::endl;
+    return failures == 0 ? 0 : 84;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "model.hpp"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks run by `make check`. A failed check is printed and counted, and the
+// run exits with 84 if any failed.
+void check(bool condition, const std::string& what);
+
+// One group per file
+void test_kernels();
+void test_allocations();
+void test_gradients();
+void test_accumulators();
+
+// Fully connected network with uniform random weights and biases in
+// [-scale, scale]; sizes holds the input size, then each layer's outputs
+template <typename Real>
+BasicNetwork<Real> random_network(const std::vector<size_t>& sizes, const std::vector<Activation>& activations, std::mt19937& gen, double scale = 0.3) {
+    std::uniform_real_distribution<double> dist(-scale, scale);
+    BasicNetwork<Real> network;
+    network.learning_rate = 0.01;
+    for (size_t i = 0; i + 1 < sizes.size(); i++) {
+        BasicLayer<Real> layer;
+        layer.inputs = sizes[i];
+        layer.outputs = sizes[i + 1];
+        layer.activation = activations[i];
+        layer.weights.assign(layer.inputs * layer.outputs, 0);
+        layer.biases.assign(layer.outputs, 0);
+        for (Real& w : layer.weights) {
+            w = static_cast<Real>(dist(gen));
+        }
+        for (Real& b : layer.biases) {
+            b = static_cast<Real>(dist(gen));
+        }
+        network.layers.push_back(std::move(layer));
+    }
+    return network;
+}
+
+// Sorted distinct active inputs out of size, as the FEN encoder produces them
+inline std::vector<uint16_t> random_features(std::mt19937& gen, size_t size, size_t count) {
+    std::vector<uint16_t> all(size);
+    for (size_t i = 0; i < size; i++) {
+        all[i] = static_cast<uint16_t>(i);
+    }
+    std::shuffle(all.begin(), all.end(), gen);
+    all.resize(count);
+    std::sort(all.begin(), all.end());
+    return all;
+}